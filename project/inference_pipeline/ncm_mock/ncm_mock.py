@@ -13,7 +13,9 @@ PORT_INF_DASH = 10123
 s.connect((host, PORT_INF_DASH))
 ## ----------------------------------------------------------------------------------------
 
-expected_format = "32siffffffffffiiffiiiiiiiiiiiiiiiiiii"
+# one batch: length prefix, record count and dropped samples, then the records
+batch_header_format = "=III"
+expected_format = "=32siffffffffffiiffiiiiiiiiiiiiiiiiiiii8sifffffff"
 
 # send mock data to inference and receive lqe
 def send_mock_data():
@@ -30,8 +32,14 @@ def send_mock_data():
         # pack the dictionary into a byte string with both the key and value
         rand = random.randint(0,4)
         mock_data_rand = mock_data[rand]
-        packed_data = struct.pack(expected_format, *mock_data_rand.values())
-        s.sendall(packed_data)
+        record = struct.pack(expected_format, *mock_data_rand.values(), 1,
+                             b'\xe0\x07\x34\xc5\x13\x57',
+                             mock_data_rand['signal'] + 95,
+                             mock_data_rand['signal'] + 95, 2.0,
+                             mock_data_rand['signal'] + 95, 0.9, 0.0, 0.0, 0.0)
+        header = struct.pack(batch_header_format,
+                             struct.calcsize(batch_header_format) - 4 + len(record), 1, 0)
+        s.sendall(header + record)
 
         lqe = s.recv(1024)
         print(lqe)
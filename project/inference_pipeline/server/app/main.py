@@ -23,8 +23,14 @@ np.random.seed(SEED)
 np.set_printoptions(suppress=True)
 
 dtree = joblib.load("app/dtree.joblib")
-expected_format = "32siffffffffffiiffiiiiiiiiiiiiiiiiiii"
+# The NCM sends batches: a length prefix, the number of records and the number
+# of samples it dropped, followed by one aggregated record per session.
+batch_header_format = "=III"
+batch_header_size = struct.calcsize(batch_header_format)
+expected_format = "=32siffffffffffiiffiiiiiiiiiiiiiiiiiiii8sifffffff"
 expected_size = struct.calcsize(expected_format)
+# Predictions are sent back per record, see lqe_prediction_msg in the NCM
+prediction_format = "=6sBB"
 
 memory = joblib.Memory(location=".cache", verbose=0)
 
@@ -47,18 +53,6 @@ logging.basicConfig(
 
 random.seed()
 labels = ["good", "interm.", "bad"]
-rssi_window10 = []
-rss_window10 = []
-
-def convert_rssi_to_value(rssi):
-    print("RSSI: " + str(rssi))
-    # if rssi > -35:
-    #     return 128  # Error
-    if rssi < -95:
-        return 128  # Error
-    else:
-        value = rssi + 95
-        return value if value >= 0 else 0 
 
 @app.get("/", response_class=HTMLResponse)
 async def read_root(request: Request):
@@ -72,19 +66,45 @@ async def chart_data(request: Request) -> StreamingResponse:
     response.headers["X-Accel-Buffering"] = "no"
     return response
 
+def recv_exact(size):
+    data = b""
+    while len(data) < size:
+        chunk = connection.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def receive_batch():
+    header = recv_exact(batch_header_size)
+    if header is None:
+        return None
+    length, count, dropped = struct.unpack(batch_header_format, header)
+    payload = recv_exact(length - (batch_header_size - 4))
+    if payload is None:
+        return None
+    if dropped:
+        logging.warning(f"NCM dropped {dropped} samples")
+    if len(payload) != count * expected_size:
+        print(f"Error: Expected {count * expected_size} bytes but got {len(payload)} bytes")
+        return []
+    return [
+        struct.unpack_from(expected_format, payload, i * expected_size)
+        for i in range(count)
+    ]
+
+
 async def receive_data(request: Request) -> Iterator[str]:
     while True:
         print(time.strftime("%H:%M:%S", time.localtime()), flush=True)
 
-        data = connection.recv(1024)
-        if not data:
+        batch = receive_batch()
+        if batch is None:
             print("no data")
             break
 
-        if len(data) != expected_size:
-            print(f"Error: Expected {expected_size} bytes but got {len(data)} bytes")
-        else:
-            session_info = struct.unpack(expected_format, data)
+        for session_info in batch:
             session_dict = {
                 # From session info struct
                 "session": session_info[0],
@@ -124,39 +144,46 @@ async def receive_data(request: Request) -> Iterator[str]:
                 # Remote address + Master or Slave
                 "remoteAddress": session_info[33],
                 "masterOrSlave": session_info[34],  # // -1 neither, 0 slave, 1 master
+                # Number of received frames aggregated into this record
+                "samples": session_info[35],
+                # Full address of the remote node
+                "remoteHwaddr": session_info[36][:6],
+                # Rolling features of the link, computed by the NCM
+                "rssi": session_info[37],
+                "rssi_avg": session_info[38],
+                "rssi_std": session_info[39],
+                "rssi_ewma": session_info[40],
+                "prr": session_info[41],
+                "retries_avg": session_info[42],
+                "retries_std": session_info[43],
+                "retries_ewma": session_info[44],
             }
 
             rssi_dbm = session_dict["signal"]
 
-            # plot the dimensions and datatypes
-            rssi = convert_rssi_to_value(rssi_dbm)
-
-            # add/replace the last value in the window
-            if len(rssi_window10) < 10:
-                rssi_window10.append(rssi)
-            else:
-                rssi_window10.pop(0)
-                rssi_window10.append(rssi)
-
-            # add/replace the last value in the window
-            if len(rss_window10) < 10:
-                rss_window10.append(rssi_dbm)
-            else:
-                rss_window10.pop(0)
-                rss_window10.append(rssi_dbm)
-
-            rssi_avg = sum(rssi_window10) / len(rssi_window10)
-            rss_avg = sum(rss_window10) / len(rss_window10)
+            # the NCM keeps the windows, see nb_features(). Signals below
+            # -95 dBm are invalid (128) and masked as 0 like in the training
+            # data, so that they neither skew the average nor the conversion
+            # back to dBm.
+            rssi = session_dict["rssi"]
+            rssi_avg = session_dict["rssi_avg"]
+            if rssi >= 128:
+                rssi = 0
+            if rssi_avg >= 128:
+                rssi_avg = 0
+            rss_avg = rssi_avg - 95 if rssi_avg > 0 else None
 
             print("converted rssi: " + str(rssi))
             print("rssi avg: " + str(rssi_avg))
 
-            y_pred = dtree.predict([[rssi, rssi_avg]])
+            proba = dtree.predict_proba([[rssi, rssi_avg]])[0]
+            y_pred = dtree.classes_[np.argmax(proba)]
+            confidence = int(round(max(proba) * 255))
             print("predicted lqe: " + y_pred)
 
-            if y_pred == ['good']:
+            if y_pred == 'good':
                 y_pred = 2
-            elif y_pred == ['bad']:
+            elif y_pred == 'bad':
                 y_pred = 0
             else:
                 y_pred = 1
@@ -176,8 +203,10 @@ async def receive_data(request: Request) -> Iterator[str]:
             yield f"data:{json_data}\n\n"
             print("-> yielded to dashboard")
             
-            # send lqe back to NCM
-            packed_data = struct.pack('<I', y_pred)
+            # send lqe back to NCM: remote address, class and confidence
+            packed_data = struct.pack(
+                prediction_format, session_dict["remoteHwaddr"], y_pred, confidence
+            )
             connection.sendall(packed_data)
             print("-> sent back to NCM")
             print("--------------------")
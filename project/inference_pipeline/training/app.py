@@ -95,6 +95,30 @@ def poly_features(
 
     return data
 
+def export_tree(model: pipeline.Pipeline, path: str):
+    """Writes the fitted tree as flat node arrays for the native inference of
+    the NCM (see moep80211ncm/src/dtree.h). The scaler is folded into the
+    thresholds, so the NCM evaluates raw feature values. Classes are encoded
+    like the dashboard does: bad = 0, interm. = 1, good = 2.
+    """
+    scaler, clf = model.named_steps["scaler"], model.named_steps["dtree"]
+    t = clf.tree_
+    codes = {"bad": 0, "interm.": 1, "good": 2}
+
+    with open(path, "w") as f:
+        f.write(f"dtree {t.node_count} {t.n_features}\n")
+        for i in range(t.node_count):
+            label = codes[clf.classes_[np.argmax(t.value[i][0])]]
+            if t.children_left[i] == t.children_right[i]:  # leaf
+                f.write(f"-1 0 -1 -1 {label}\n")
+                continue
+            feature = t.feature[i]
+            threshold = t.threshold[i] * scaler.scale_[feature] + scaler.mean_[feature]
+            f.write(
+                f"{feature} {threshold:.9g} {t.children_left[i]} "
+                f"{t.children_right[i]} {label}\n"
+            )
+
 features = ["rssi", "rssi_avg"]
 
 dtree = pipeline.Pipeline(
@@ -127,4 +151,8 @@ print("score: " + str(score))
 
 # save dtree to a file
 joblib.dump(dtree, "dtree.joblib")
-print("-> saved model to file")
\ No newline at end of file
+print("-> saved model to file")
+
+# flattened tree for the NCM, see ncm --lqe-model
+export_tree(dtree, "dtree.model")
+print("-> exported model for the NCM")
\ No newline at end of file
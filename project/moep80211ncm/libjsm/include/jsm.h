@@ -19,6 +19,8 @@
 #ifndef LIBJSM80211_H_
 #define LIBJSM80211_H_
 
+#include <stddef.h>
+
 #ifndef JSM80211_RINGBUFFER_LENGTH
 #define JSM80211_RINGBUFFER_LENGTH 65536 ///<Length of the packet ringbuffer (must be a power of 2)
 #endif
@@ -106,4 +108,21 @@ int jsm80211_queue(struct jsm80211_module* module, void* packet);
  */
 void jsm80211_log_state(struct jsm80211_module* module);
 
+/**
+ * \brief The module state, as logged by jsm80211_log_state()
+ */
+struct jsm80211_state {
+  double ipt_avg;        ///<Average inter-packet time in seconds
+  double ipt_timer;      ///<Current dequeue timer interval in seconds
+  size_t backlog;        ///<Queued packets
+  double backlog_target; ///<Target backlog in seconds
+};
+
+/**
+ * \brief Get the module state without logging it
+ * \param module The module
+ * \param state Filled with the module state
+ */
+void jsm80211_get_state(struct jsm80211_module* module, struct jsm80211_state* state);
+
 #endif // LIBJSM80211_H_
@@ -213,6 +213,14 @@ err:
   return(res);
 }
 
+void jsm80211_get_state(struct jsm80211_module* module, struct jsm80211_state* state)
+{
+  state->ipt_avg = module->average_interval;
+  state->ipt_timer = module->timer_interval;
+  state->backlog = jsm80211_ringbuffer_count(&module->queue);
+  state->backlog_target = module->target_backlog;
+}
+
 void jsm80211_log_state(struct jsm80211_module* module)
 {
   LOG(LOG_INFO, "jsm80211: ipt_avg=%g ms, ipt_timer=%g ms, backlog=%zd pkt, backlog_target=%g pkt (%g ms)",
@@ -166,11 +166,14 @@ rx_handler moep_dev_set_rx_handler(moep_dev_t dev, rx_handler handler);
  * \brief transmit a frame
  *
  * The function moep_dev_tx() is used to transmit a frame through the moep
- * device. This function does not actually transmit the frame, but only puts it
- * into an internal send queue. Be sure to call moep_select() or moep_run()
- * afterwards to schedule the transmission of the frame (except you have already
- * called it, because you are inside a rx handler). This function does not
- * block.
+ * device. If the internal send queue is empty, the headers and the payload of
+ * the frame are written to the device right away without copying the payload.
+ * Otherwise, or if the device is busy, the frame is encoded into the internal
+ * send queue. Be sure to call moep_select() or moep_run() afterwards to
+ * schedule the transmission of queued frames (except you have already called
+ * it, because you are inside a rx handler). In either case, the frame may be
+ * modified or destroyed as soon as this function returns. This function does
+ * not block.
  *
  * \param dev the moep device
  * \param frame the frame
@@ -185,6 +188,26 @@ rx_handler moep_dev_set_rx_handler(moep_dev_t dev, rx_handler handler);
  */
 int moep_dev_tx(moep_dev_t dev, moep_frame_t frame);
 
+/**
+ * \brief transmit a frame ahead of queued frames
+ *
+ * The function moep_dev_tx_urgent() works like moep_dev_tx(), but the frame
+ * may overtake frames that were queued by moep_dev_tx(). If no other urgent
+ * frame is queued, the frame is written to the device right away, even if the
+ * internal send queue is not empty. Otherwise, it is queued behind the other
+ * urgent frames, which are all sent before any frame queued by moep_dev_tx().
+ *
+ * \param dev the moep device
+ * \param frame the frame
+ *
+ * \retval 0 on success
+ * \retval -1 on error, errno is set appropriately
+ *
+ * \errors{The error values are the same as for moep_dev_tx().}
+ * \enderrors
+ */
+int moep_dev_tx_urgent(moep_dev_t dev, moep_frame_t frame);
+
 typedef int (*rx_raw_handler)(moep_dev_t dev, u8 *buf, size_t buflen);
 
 rx_raw_handler moep_dev_get_rx_raw_handler(moep_dev_t dev);
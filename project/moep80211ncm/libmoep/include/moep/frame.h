@@ -32,6 +32,8 @@
 
 #include <stddef.h>
 
+#include <sys/uio.h>
+
 #include <moep/types.h>
 
 
@@ -81,6 +83,25 @@ u8 *moep_frame_get_payload(moep_frame_t frame, size_t *len);
  */
 u8 *moep_frame_set_payload(moep_frame_t frame, u8 *payload, size_t len);
 
+/**
+ * \brief set a borrowed payload of a frame
+ *
+ * The function moep_frame_set_payload_view() works like
+ * moep_frame_set_payload(), but the content of \paramname{payload} is not
+ * copied. The frame only references \paramname{payload}, which must therefore
+ * stay valid until the payload is changed or the frame is destroyed. If the
+ * payload is grown with moep_frame_adjust_payload_len(), it is copied to an
+ * internal buffer first.
+ *
+ * \param frame the frame
+ * \param payload a pointer to the payload
+ * \param len the length of the payload
+ *
+ * \return This function returns \paramname{payload}.
+ * \retval NULL if \paramname{payload} is NULL
+ */
+u8 *moep_frame_set_payload_view(moep_frame_t frame, u8 *payload, size_t len);
+
 /**
  * \brief adjust the len of the payload of a frame
  *
@@ -147,6 +168,33 @@ int moep_frame_decode(moep_frame_t frame, u8 *buf, size_t buflen);
  */
 int moep_frame_encode(moep_frame_t frame, u8 **buf, size_t buflen);
 
+/**
+ * \brief encode a frame into an I/O vector
+ *
+ * The function moep_frame_encode_iov() encodes a frame without copying its
+ * payload. Only the headers are built into \paramname{buf}. Afterwards,
+ * \paramname{iov} holds two segments, the headers and the payload, which can be
+ * passed to writev() or sendmsg(). The payload segment references the internal
+ * payload buffer and is only valid as long as the payload is not changed.
+ *
+ * \param frame the frame to be encoded
+ * \param iov an array of two I/O vector elements
+ * \param buf the buffer for the headers
+ * \param buflen the length of the buffer
+ *
+ * \return This function returns the length of the encoded frame.
+ *
+ * \retval -1 on error, errno is set appropriately.
+ *
+ * \errors{These are some standard errors generated by this function. Additional
+ * errors may be generated and returned from the underlying device specific
+ * functions.}
+ * \errval{EMSGSIZE, The buffer is too small to hold the headers.}
+ * \enderrors
+ */
+int moep_frame_encode_iov(moep_frame_t frame, struct iovec *iov, u8 *buf,
+			  size_t buflen);
+
 /**
  * \brief destroy a frame
  *
@@ -85,6 +85,25 @@ struct moep_frame_ops {
 	 */
 	void *(* parse)(u8 **raw, size_t *maxlen);
 
+	/**
+	 * \brief parse a header in place
+	 *
+	 * The optional function parse_inplace() works like parse(), but the
+	 * new header may keep references into the buffer \paramname{raw}
+	 * instead of copying the parsed data. The buffer is owned by the frame
+	 * and stays valid until the frame is decoded again or destroyed. The
+	 * function may modify the buffer. If it is not implemented, parse() is
+	 * used instead.
+	 *
+	 * \param raw a pointer to the buffer
+	 * \param maxlen the available length in the buffer
+	 *
+	 * \return This function should return the new header.
+	 *
+	 * \retval NULL on error, errno should be set appropriately.
+	 */
+	void *(* parse_inplace)(u8 **raw, size_t *maxlen);
+
 	/**
 	 * \brief length of the built header
 	 *
@@ -229,6 +248,105 @@ struct moep_dev_ops {
 	 * \retval -1 on error, errno should be set appropriately.
 	 */
 	int (* close)(int fd, void *priv);
+
+	/**
+	 * \brief peek at the next received frame
+	 *
+	 * The optional function rx_peek() can be implemented by modules that
+	 * receive frames into a memory mapped ring instead of using read().
+	 * It should return a pointer to the next received frame and store
+	 * its length in \paramname{len}. The frame must stay valid until
+	 * rx_release() is called.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 * \param len the length of the frame
+	 *
+	 * \return This function should return a pointer to the frame.
+	 *
+	 * \retval NULL on error, errno should be set appropriately. If no
+	 * frame is available, errno should be set to EAGAIN.
+	 */
+	u8 *(* rx_peek)(int fd, void *priv, size_t *len);
+
+	/**
+	 * \brief release a received frame
+	 *
+	 * The function rx_release() should hand the frame returned by the last
+	 * call to rx_peek() back to the kernel. It is required if rx_peek() is
+	 * implemented.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 */
+	void (* rx_release)(int fd, void *priv);
+
+	/**
+	 * \brief reserve a transmit slot
+	 *
+	 * The optional function tx_reserve() can be implemented by modules
+	 * that transmit frames from a memory mapped ring instead of using
+	 * write(). It should return a pointer to a free slot, into which the
+	 * frame is encoded directly, and store the size of the slot in
+	 * \paramname{maxlen}.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 * \param maxlen the size of the slot
+	 *
+	 * \return This function should return a pointer to the slot.
+	 *
+	 * \retval NULL on error, errno should be set appropriately. If no
+	 * slot is available, errno should be set to EAGAIN.
+	 */
+	u8 *(* tx_reserve)(int fd, void *priv, size_t *maxlen);
+
+	/**
+	 * \brief commit a transmit slot
+	 *
+	 * The function tx_commit() should mark the slot returned by the last
+	 * call to tx_reserve() as ready for transmission. It is required if
+	 * tx_reserve() is implemented.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 * \param len the length of the frame in the slot
+	 *
+	 * \retval 0 on success
+	 * \retval -1 on error, errno should be set appropriately.
+	 */
+	int (* tx_commit)(int fd, void *priv, size_t len);
+
+	/**
+	 * \brief transmit all committed slots
+	 *
+	 * The function tx_flush() should ask the kernel to transmit all slots
+	 * committed since the last call. It is called once per batch when the
+	 * device becomes writable. It is required if tx_reserve() is
+	 * implemented.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 *
+	 * \retval 0 on success
+	 * \retval -1 on error, errno should be set appropriately.
+	 */
+	int (* tx_flush)(int fd, void *priv);
+
+	/**
+	 * \brief get the file descriptor of the transmit ring
+	 *
+	 * The optional function tx_fd() should return the file descriptor
+	 * that becomes writable when a slot of the transmit ring is free
+	 * again, if that is not \paramname{fd}. Frames that found the ring
+	 * full are queued until then.
+	 *
+	 * \param fd the file descriptor passed to moep_dev_open()
+	 * \param priv the private data passed to moep_dev_open()
+	 *
+	 * \return This function should return the file descriptor.
+	 */
+	int (* tx_fd)(int fd, void *priv);
 };
 
 
@@ -79,9 +79,58 @@ enum moep80211_chan_width {
 	MOEP80211_CHAN_WIDTH_160,
 };
 
+/**
+ * \brief packet ring parameters
+ *
+ * The struct moep80211_ring_params configures the memory mapped rings used by
+ * radio devices if enabled via moep_dev_radio_set_ring(). A value of 0 selects
+ * the default for the respective field.
+ */
+struct moep80211_ring_params {
+
+	/**
+	 * \brief size of a receive block in bytes (default 64 KiB)
+	 *
+	 * The size is rounded up to a multiple of the page size.
+	 */
+	unsigned int block_size;
+
+	/**
+	 * \brief number of receive blocks (default 64)
+	 */
+	unsigned int block_nr;
+
+	/**
+	 * \brief receive block retire timeout in ms (default 1)
+	 *
+	 * A partially filled receive block is handed to userspace after this
+	 * timeout, which bounds the latency added by the receive ring.
+	 */
+	unsigned int block_tov;
+
+	/**
+	 * \brief number of transmit slots (default 256)
+	 */
+	unsigned int frame_nr;
+};
+
 struct moep_frame_ops;
 
 
+/**
+ * \brief enable packet rings for radio devices
+ *
+ * The function moep_dev_radio_set_ring() is used to enable the PACKET_MMAP
+ * backend for radio devices opened afterwards. Received frames are then parsed
+ * in place from a TPACKET_V3 receive ring and frames are encoded directly into
+ * the slots of a TPACKET_V2 transmit ring, which are handed to the kernel with
+ * a single sendto() per batch. By default, radio devices use plain read() and
+ * write() calls.
+ *
+ * \param params the ring parameters or NULL to disable the rings
+ */
+void moep_dev_radio_set_ring(const struct moep80211_ring_params *params);
+
 /**
  * \brief open a radio device
  *
@@ -96,6 +96,65 @@ int moep_callback_change(moep_callback_t callback, u32 events);
  */
 int moep_callback_delete(moep_callback_t callback);
 
+/**
+ * \brief event loop backend
+ */
+enum moep_backend {
+
+	/**
+	 * \brief epoll backend (default)
+	 */
+	MOEP_BACKEND_EPOLL,
+
+	/**
+	 * \brief io_uring backend
+	 *
+	 * Callbacks are backed by poll requests on an io_uring instance.
+	 * Re-arming a callback does not need a system call of its own, as the
+	 * request is submitted together with the next wait.
+	 */
+	MOEP_BACKEND_IO_URING,
+};
+
+/**
+ * \brief select the event loop backend
+ *
+ * The moep_set_backend() call is used to select the backend that moep_wait()
+ * and moep_run() use to wait for I/O events. Existing callbacks are moved to the
+ * new backend. The call must not be used from within a callback. The backend
+ * can also be selected by setting the environment variable MOEP_BACKEND to
+ * "io_uring" or "epoll", which allows to switch unmodified programs.
+ *
+ * The callback API is the same for all backends. A custom wait call set via
+ * moep_set_custom_wait() is only used by the epoll backend.
+ *
+ * \param backend the backend
+ *
+ * \retval 0 on success
+ * \retval -1 on error, errno is set appropriately.
+ *
+ * \errors{These are some standard errors generated by this call. Additional
+ * errors may be generated and returned from the underlying system calls.}
+ * \errval{EINVAL, Invalid backend}
+ * \errval{ENOSYS, The kernel does not support io_uring.}
+ * \enderrors
+ */
+int moep_set_backend(enum moep_backend backend);
+
+/**
+ * \brief back the frame pools with hugepages
+ *
+ * Frames, headers, header extensions and MTU-sized buffers are allocated from
+ * per-thread pools, which draw their memory from large slabs. The
+ * moep_set_hugepages() call is used to request hugepages for slabs allocated
+ * afterwards. If no hugepages are available, regular pages are used instead.
+ * Hugepages can also be enabled by setting the environment variable
+ * MOEP_HUGEPAGES to 1.
+ *
+ * \param enable 1 to use hugepages, 0 to use regular pages
+ */
+void moep_set_hugepages(int enable);
+
 /**
  * \brief set a custom wait call
  *
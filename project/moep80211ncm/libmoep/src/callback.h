@@ -0,0 +1,38 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CALLBACK_H
+#define CALLBACK_H
+
+#include <moep/types.h>
+#include <moep/system.h>
+
+#include "list.h"
+
+
+struct moep_callback {
+	struct list_head list;
+	int fd;
+	cb_handler handler;
+	void *data;
+	u32 events;
+	void *priv;
+};
+
+#endif /* CALLBACK_H */
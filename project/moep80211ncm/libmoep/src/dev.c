@@ -23,13 +23,19 @@
 #include <string.h>
 #include <errno.h>
 
+#include <sys/uio.h>
+
 #include <moep/system.h>
 #include <moep/frame.h>
 #include <moep/dev.h>
 #include <moep/module.h>
 
+#include "frame.h"
 #include "list.h"
+#include "pool.h"
+
 
+#define TX_HDR_MAX	1024
 
 #define assert_module(dev, ops, ret)		\
 	if ((dev)->ops.close != (ops)->close) {	\
@@ -46,11 +52,15 @@ struct moep_dev {
 	void *priv;
 	struct moep_frame_ops l1_ops;
 	struct moep_frame_ops l2_ops;
+	struct list_head tx_urgent;
 	struct list_head tx_queue;
+	int tx_pending;
 	dev_status_cb tx_status_cb;
 	void *tx_status_cb_data;
 	int rx_status;
 	moep_callback_t dev_cb;
+	moep_callback_t slot_cb;
+	int slot_wait;
 	rx_handler rx;
 	rx_raw_handler rx_raw;
 };
@@ -72,8 +82,25 @@ static int configure_callback(moep_dev_t dev)
 	events = EPOLLONESHOT;
 	if (dev->rx_status)
 		events |= EPOLLIN;
-	if (!list_empty(&dev->tx_queue))
+	if (dev->tx_pending)
+		events |= EPOLLOUT;
+
+	/*
+	 * The socket owning a transmit ring only polls writable once a slot is
+	 * free again. Committed slots are still flushed through the device fd,
+	 * which is writable right away.
+	 */
+	if (dev->slot_cb) {
+		if (dev->slot_wait != !moep_dev_get_tx_status(dev)) {
+			dev->slot_wait = !dev->slot_wait;
+			if (moep_callback_change(dev->slot_cb, dev->slot_wait ?
+						 EPOLLOUT | EPOLLONESHOT : 0))
+				return -1;
+		}
+	} else if (!moep_dev_get_tx_status(dev)) {
 		events |= EPOLLOUT;
+	}
+
 	return moep_callback_change(dev->dev_cb, events);
 }
 
@@ -85,80 +112,226 @@ static int trigger_tx_status_cb(moep_dev_t dev)
 	return 0;
 }
 
+/*
+ * Frames are decoded straight out of the ring slot, which is handed back to
+ * the kernel as soon as the frame has been parsed.
+ */
+static int rx_ring_cb(moep_dev_t dev)
+{
+	moep_frame_t frame;
+	u8 *data;
+	size_t len;
+
+	while (dev->rx_status) {
+		if (!(data = dev->ops.rx_peek(dev->fd, dev->priv, &len))) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			return 0;
+		}
+
+		if (dev->rx_raw && dev->rx_raw(dev, data, len)) {
+			dev->ops.rx_release(dev->fd, dev->priv);
+			return -1;
+		}
+
+		if (!dev->rx) {
+			dev->ops.rx_release(dev->fd, dev->priv);
+			continue;
+		}
+
+		frame = moep_dev_frame_decode(dev, data, len);
+		dev->ops.rx_release(dev->fd, dev->priv);
+		if (!frame) {
+			if (errno != EINVAL)
+				return -1;
+			return 0;
+		}
+		if (dev->rx(dev, frame))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hands buf over to a new frame, which keeps the payload and the header
+ * extensions in place. buf is released in any case.
+ */
+static moep_frame_t frame_decode_owned(moep_dev_t dev, u8 *buf, size_t buflen)
+{
+	moep_frame_t frame;
+	int err;
+
+	if (!(frame = moep_dev_frame_create(dev))) {
+		pool_free(buf);
+		return NULL;
+	}
+	if (frame_decode_inplace(frame, buf, buflen)) {
+		err = errno;
+		moep_frame_destroy(frame);
+		errno = err;
+		return NULL;
+	}
+	return frame;
+}
+
 static int rx_cb(moep_dev_t dev)
 {
 	moep_frame_t frame;
 	u8 *data;
 	int len;
 
-	if (!(data = malloc(dev->mtu))) {
-		errno = ENOMEM;
-		return -1;
-	}
+	if (dev->ops.rx_peek)
+		return rx_ring_cb(dev);
 
+	data = NULL;
 	while (dev->rx_status) {
+		if (!data && !(data = pool_alloc(dev->mtu))) {
+			errno = ENOMEM;
+			return -1;
+		}
+
 		do {
 			len = read(dev->fd, data, dev->mtu);
 		} while (len < 0 && errno == EINTR);
 		if (len < 0) {
-			free(data);
+			pool_free(data);
 			if (errno != EAGAIN && errno != EWOULDBLOCK)
 				return -1;
 			return 0;
 		}
 
 		if (dev->rx_raw && dev->rx_raw(dev, data, len)) {
-			free(data);
+			pool_free(data);
 			return -1;
 		}
 
 		if (dev->rx) {
-			if (!(frame = moep_dev_frame_decode(dev, data, len))) {
-				free(data);
+			frame = frame_decode_owned(dev, data, len);
+			data = NULL;
+			if (!frame) {
 				if (errno != EINVAL)
 					return -1;
 				return 0;
 			}
-			if (dev->rx(dev, frame)) {
-				free(data);
+			if (dev->rx(dev, frame))
 				return -1;
-			}
 		}
 	}
 
-	free(data);
+	pool_free(data);
 	return 0;
 }
 
-static int tx_cb(moep_dev_t dev)
+/*
+ * Moves the frames of a send queue into free ring slots. Returns 1 if the ring
+ * is full.
+ */
+static int ring_queue(moep_dev_t dev, struct list_head *queue)
 {
 	struct frame *f, *tmp;
+	u8 *slot;
+	size_t maxlen;
 	int ret;
 
-	list_for_each_entry_safe(f, tmp, &dev->tx_queue, list) {
+	list_for_each_entry_safe(f, tmp, queue, list) {
+		if (!(slot = dev->ops.tx_reserve(dev->fd, dev->priv, &maxlen))) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			return 1;
+		}
+		list_del(&f->list);
+		if (f->len > maxlen) {
+			pool_free(f->data);
+			pool_free(f);
+			errno = EMSGSIZE;
+			return -1;
+		}
+		memcpy(slot, f->data, f->len);
+		ret = dev->ops.tx_commit(dev->fd, dev->priv, f->len);
+		pool_free(f->data);
+		pool_free(f);
+		if (ret)
+			return -1;
+		dev->tx_pending++;
+	}
+
+	return 0;
+}
+
+/*
+ * Frames that did not fit into the ring when they were sent are moved into
+ * free slots now, urgent frames first. All slots committed since the last call
+ * are then handed to the kernel with a single flush.
+ */
+static int tx_ring_cb(moep_dev_t dev)
+{
+	int ret;
+
+	if ((ret = ring_queue(dev, &dev->tx_urgent)) == 0)
+		ret = ring_queue(dev, &dev->tx_queue);
+	if (ret < 0)
+		return -1;
+
+	if (dev->tx_pending) {
+		if (dev->ops.tx_flush(dev->fd, dev->priv))
+			return -1;
+		dev->tx_pending = 0;
+	}
+
+	return trigger_tx_status_cb(dev);
+}
+
+/*
+ * Writes the frames of a send queue to the device. Returns 1 if the device is
+ * busy.
+ */
+static int write_queue(moep_dev_t dev, struct list_head *queue)
+{
+	struct frame *f, *tmp;
+	int ret;
+
+	list_for_each_entry_safe(f, tmp, queue, list) {
 		do {
 			ret = write(dev->fd, f->data, f->len);
 		} while (ret < 0 && errno == EINTR);
 		if (ret < 0) {
 			if (errno != EAGAIN && errno != EWOULDBLOCK) {
 				list_del(&f->list);
-				free(f->data);
-				free(f);
+				pool_free(f->data);
+				pool_free(f);
 				return -1;
 			}
-			return 0;
+			return 1;
 		}
 		if (ret != f->len) {
 			list_del(&f->list);
-			free(f->data);
-			free(f);
+			pool_free(f->data);
+			pool_free(f);
 			return -1;
 		}
 		list_del(&f->list);
-		free(f->data);
-		free(f);
+		pool_free(f->data);
+		pool_free(f);
 	}
 
+	return 0;
+}
+
+static int tx_cb(moep_dev_t dev)
+{
+	int ret;
+
+	if (dev->ops.tx_reserve)
+		return tx_ring_cb(dev);
+
+	if ((ret = write_queue(dev, &dev->tx_urgent)) == 0)
+		ret = write_queue(dev, &dev->tx_queue);
+	if (ret < 0)
+		return -1;
+	if (ret > 0)
+		return 0;
+
 	return trigger_tx_status_cb(dev);
 }
 
@@ -179,6 +352,16 @@ static int dev_cb(int fd, u32 events, moep_dev_t dev)
 	return configure_callback(dev);
 }
 
+static int slot_cb(int fd, u32 events, moep_dev_t dev)
+{
+	int ret;
+
+	dev->slot_wait = 0;
+	if ((ret = tx_ring_cb(dev)))
+		return ret;
+	return configure_callback(dev);
+}
+
 moep_dev_t moep_dev_open(int fd, int mtu, struct moep_dev_ops *ops, void *priv,
 			 struct moep_frame_ops *l1_ops,
 			 struct moep_frame_ops *l2_ops)
@@ -211,6 +394,7 @@ moep_dev_t moep_dev_open(int fd, int mtu, struct moep_dev_ops *ops, void *priv,
 	if (l2_ops)
 		dev->l2_ops = *l2_ops;
 
+	INIT_LIST_HEAD(&dev->tx_urgent);
 	INIT_LIST_HEAD(&dev->tx_queue);
 	dev->tx_status_cb = NULL;
 	dev->rx_status = 0;
@@ -221,6 +405,14 @@ moep_dev_t moep_dev_open(int fd, int mtu, struct moep_dev_ops *ops, void *priv,
 		errno = err;
 		return NULL;
 	}
+	if (dev->ops.tx_fd && !(dev->slot_cb = moep_callback_create(
+			dev->ops.tx_fd(fd, priv), (cb_handler)slot_cb, dev, 0))) {
+		err = errno;
+		moep_callback_delete(dev->dev_cb);
+		free(dev);
+		errno = err;
+		return NULL;
+	}
 
 	list_add(&dev->list, &moep_dev_list);
 
@@ -242,7 +434,7 @@ int moep_dev_set_rx_status(moep_dev_t dev, int status)
 
 int moep_dev_get_tx_status(moep_dev_t dev)
 {
-	return list_empty(&dev->tx_queue);
+	return list_empty(&dev->tx_urgent) && list_empty(&dev->tx_queue);
 }
 
 int moep_dev_set_tx_status_cb(moep_dev_t dev, dev_status_cb cb, void *data)
@@ -265,9 +457,10 @@ int moep_dev_pair(moep_dev_t dev1, moep_dev_t dev2)
 	return 0;
 }
 
-static int queue_frame(moep_dev_t dev, struct frame *f)
+static int queue_frame(moep_dev_t dev, struct frame *f,
+		       struct list_head *queue)
 {
-	list_add_tail(&f->list, &dev->tx_queue);
+	list_add_tail(&f->list, queue);
 
 	if (trigger_tx_status_cb(dev))
 		return -1;
@@ -288,22 +481,116 @@ rx_handler moep_dev_set_rx_handler(moep_dev_t dev, rx_handler handler)
 	return old;
 }
 
-int moep_dev_tx(moep_dev_t dev, moep_frame_t frame)
+/*
+ * Encode the frame directly into a free ring slot. The slot is flushed in
+ * tx_ring_cb() together with all other frames committed during the current
+ * iteration of the event loop. Returns 1 if the ring is full.
+ */
+static int ring_frame(moep_dev_t dev, moep_frame_t frame)
+{
+	u8 *slot;
+	size_t maxlen;
+	int len;
+
+	if (!(slot = dev->ops.tx_reserve(dev->fd, dev->priv, &maxlen))) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		return 1;
+	}
+	if (maxlen > dev->mtu)
+		maxlen = dev->mtu;
+
+	if ((len = moep_frame_encode(frame, &slot, maxlen)) < 0)
+		return -1;
+	if (dev->ops.tx_commit(dev->fd, dev->priv, len))
+		return -1;
+
+	if (dev->tx_pending++)
+		return 0;
+	return configure_callback(dev);
+}
+
+/*
+ * Writes the frame without copying its payload. Returns 1 if the frame has to
+ * be queued instead, i.e. if the device is busy or the headers do not fit into
+ * the stack buffer.
+ */
+static int write_frame(moep_dev_t dev, moep_frame_t frame)
+{
+	u8 hdr[TX_HDR_MAX];
+	struct iovec iov[2];
+	int len;
+	int ret;
+
+	if ((len = moep_frame_encode_iov(frame, iov, hdr, sizeof(hdr))) < 0) {
+		if (errno != EMSGSIZE)
+			return -1;
+		return 1;
+	}
+	if (len > dev->mtu) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	do {
+		ret = writev(dev->fd, iov, 2);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		return 1;
+	}
+	if (ret != len)
+		return -1;
+	return 0;
+}
+
+/*
+ * A frame is sent right away unless it would overtake a queued frame. Urgent
+ * frames may overtake frames of the regular queue.
+ */
+static int dev_tx(moep_dev_t dev, moep_frame_t frame, struct list_head *queue)
 {
 	struct frame *f;
+	int ret;
 
-	if (!(f = malloc(sizeof(*f)))) {
+	if (list_empty(&dev->tx_urgent) &&
+	    (queue == &dev->tx_urgent || list_empty(&dev->tx_queue))) {
+		if (dev->ops.tx_reserve)
+			ret = ring_frame(dev, frame);
+		else
+			ret = write_frame(dev, frame);
+		if (ret <= 0)
+			return ret;
+	}
+
+	if (!(f = pool_alloc(sizeof(*f)))) {
 		errno = ENOMEM;
 		return -1;
 	}
 
-	f->data = NULL;
+	if (!(f->data = pool_alloc(dev->mtu))) {
+		pool_free(f);
+		errno = ENOMEM;
+		return -1;
+	}
 	if ((f->len = moep_frame_encode(frame, &f->data, dev->mtu)) < 0) {
-		free(f);
+		pool_free(f->data);
+		pool_free(f);
 		return -1;
 	}
 
-	return queue_frame(dev, f);
+	return queue_frame(dev, f, queue);
+}
+
+int moep_dev_tx(moep_dev_t dev, moep_frame_t frame)
+{
+	return dev_tx(dev, frame, &dev->tx_queue);
+}
+
+int moep_dev_tx_urgent(moep_dev_t dev, moep_frame_t frame)
+{
+	return dev_tx(dev, frame, &dev->tx_urgent);
 }
 
 rx_raw_handler moep_dev_get_rx_raw_handler(moep_dev_t dev)
@@ -330,12 +617,12 @@ int moep_dev_tx_raw(moep_dev_t dev, u8 *buf, size_t buflen)
 		return -1;
 	}
 
-	if (!(f = malloc(sizeof(*f)))) {
+	if (!(f = pool_alloc(sizeof(*f)))) {
 		errno = ENOMEM;
 		return -1;
 	}
-	if (!(f->data = malloc(buflen))) {
-		free(f);
+	if (!(f->data = pool_alloc(buflen))) {
+		pool_free(f);
 		errno = ENOMEM;
 		return -1;
 	}
@@ -343,7 +630,7 @@ int moep_dev_tx_raw(moep_dev_t dev, u8 *buf, size_t buflen)
 	memcpy(f->data, buf, buflen);
 	f->len = buflen;
 
-	return queue_frame(dev, f);
+	return queue_frame(dev, f, &dev->tx_queue);
 }
 
 moep_frame_t moep_dev_frame_create(moep_dev_t dev)
@@ -373,12 +660,22 @@ void moep_dev_close(moep_dev_t dev)
 {
 	struct frame *f, *tmp;
 
+	list_for_each_entry_safe(f, tmp, &dev->tx_urgent, list) {
+		list_del(&f->list);
+		pool_free(f->data);
+		pool_free(f);
+	}
 	list_for_each_entry_safe(f, tmp, &dev->tx_queue, list) {
 		list_del(&f->list);
-		free(f);
+		pool_free(f->data);
+		pool_free(f);
 	}
+	if (dev->tx_pending)
+		dev->ops.tx_flush(dev->fd, dev->priv);
 	list_del(&dev->list);
 	moep_callback_delete(dev->dev_cb);
+	if (dev->slot_cb)
+		moep_callback_delete(dev->slot_cb);
 	if (dev->ops.close)
 		dev->ops.close(dev->fd, dev->priv);
 	free(dev);
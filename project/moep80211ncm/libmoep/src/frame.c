@@ -22,9 +22,13 @@
 #include <string.h>
 #include <errno.h>
 
+#include <sys/uio.h>
+
 #include <moep/frame.h>
 #include <moep/module.h>
 
+#include "frame.h"
+#include "pool.h"
 
 #define assert_module(frame_ops, ops, ret)		\
 	if ((frame_ops)->destroy != (ops)->destroy) {	\
@@ -40,6 +44,9 @@ struct moep_frame {
 	void *l2_hdr;
 	u8 *payload;
 	size_t payload_len;
+	int payload_view;
+	u8 *buf;
+	size_t buflen;
 };
 
 
@@ -48,7 +55,7 @@ moep_frame_t moep_frame_create(struct moep_frame_ops *l1_ops,
 {
 	moep_frame_t frame;
 
-	if (!(frame = malloc(sizeof(*frame)))) {
+	if (!(frame = pool_alloc(sizeof(*frame)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -72,17 +79,26 @@ static void clean_header(moep_frame_t frame)
 	frame->l2_hdr = NULL;
 }
 
+/*
+ * A payload view either points into the receive buffer owned by the frame or
+ * into memory borrowed from the caller. Neither must be freed here.
+ */
 static void clean_payload(moep_frame_t frame)
 {
-	free(frame->payload);
+	if (!frame->payload_view)
+		pool_free(frame->payload);
 	frame->payload = NULL;
 	frame->payload_len = 0;
+	frame->payload_view = 0;
 }
 
 static void clean_frame(moep_frame_t frame)
 {
 	clean_header(frame);
 	clean_payload(frame);
+	pool_free(frame->buf);
+	frame->buf = NULL;
+	frame->buflen = 0;
 }
 
 void moep_frame_convert(moep_frame_t frame, struct moep_frame_ops *l1_ops,
@@ -129,7 +145,7 @@ u8 *moep_frame_set_payload(moep_frame_t frame, u8 *payload, size_t len)
 	if (!payload)
 		return NULL;
 
-	if (!(frame->payload = malloc(len))) {
+	if (!(frame->payload = pool_alloc(len))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -139,6 +155,20 @@ u8 *moep_frame_set_payload(moep_frame_t frame, u8 *payload, size_t len)
 	return frame->payload;
 }
 
+u8 *moep_frame_set_payload_view(moep_frame_t frame, u8 *payload, size_t len)
+{
+	clean_payload(frame);
+
+	if (!payload)
+		return NULL;
+
+	frame->payload = payload;
+	frame->payload_len = len;
+	frame->payload_view = 1;
+
+	return frame->payload;
+}
+
 u8 *moep_frame_adjust_payload_len(moep_frame_t frame, size_t len)
 {
 	u8 *new;
@@ -147,12 +177,23 @@ u8 *moep_frame_adjust_payload_len(moep_frame_t frame, size_t len)
 		clean_payload(frame);
 		return NULL;
 	}
-	if (!(new = realloc(frame->payload, len))) {
+	if (frame->payload_view) {
+		if (len <= frame->payload_len) {
+			frame->payload_len = len;
+			return frame->payload;
+		}
+		if (!(new = pool_alloc(len))) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		memcpy(new, frame->payload, frame->payload_len);
+	} else if (!(new = pool_realloc(frame->payload, len))) {
 		errno = ENOMEM;
 		return NULL;
 	}
 	frame->payload = new;
 	frame->payload_len = len;
+	frame->payload_view = 0;
 
 	return frame->payload;
 }
@@ -175,11 +216,36 @@ int moep_frame_decode(moep_frame_t frame, u8 *buf, size_t buflen)
 	return 0;
 }
 
-int moep_frame_encode(moep_frame_t frame, u8 **buf, size_t buflen)
+int frame_decode_inplace(moep_frame_t frame, u8 *buf, size_t buflen)
+{
+	void *(* l1_parse)(u8 **, size_t *);
+	void *(* l2_parse)(u8 **, size_t *);
+
+	clean_frame(frame);
+	frame->buf = buf;
+	frame->buflen = buflen;
+
+	l1_parse = frame->l1_ops.parse_inplace ?: frame->l1_ops.parse;
+	l2_parse = frame->l2_ops.parse_inplace ?: frame->l2_ops.parse;
+
+	if (l1_parse) {
+		if (!(frame->l1_hdr = l1_parse(&buf, &buflen)))
+			return -1;
+	}
+	if (l2_parse) {
+		if (!(frame->l2_hdr = l2_parse(&buf, &buflen)))
+			return -1;
+	}
+	frame->payload = buf;
+	frame->payload_len = buflen;
+	frame->payload_view = 1;
+
+	return 0;
+}
+
+static int headers_len(moep_frame_t frame)
 {
-	u8 *data;
 	int len;
-	int internal;
 	int ret;
 
 	len = 0;
@@ -193,6 +259,38 @@ int moep_frame_encode(moep_frame_t frame, u8 **buf, size_t buflen)
 			return -1;
 		len += ret;
 	}
+	return len;
+}
+
+static int build_headers(moep_frame_t frame, u8 *buf, size_t buflen)
+{
+	u8 *data;
+	int ret;
+
+	data = buf;
+	if (frame->l1_ops.build) {
+		if ((ret = frame->l1_ops.build(frame->l1_hdr, data, buflen)) < 0)
+			return -1;
+		buflen -= ret;
+		data += ret;
+	}
+	if (frame->l2_ops.build) {
+		if ((ret = frame->l2_ops.build(frame->l2_hdr, data, buflen)) < 0)
+			return -1;
+		buflen -= ret;
+		data += ret;
+	}
+	return data - buf;
+}
+
+int moep_frame_encode(moep_frame_t frame, u8 **buf, size_t buflen)
+{
+	int len;
+	int internal;
+	int ret;
+
+	if ((len = headers_len(frame)) < 0)
+		return -1;
 	len += frame->payload_len;
 
 	if (!buf)
@@ -214,46 +312,42 @@ int moep_frame_encode(moep_frame_t frame, u8 **buf, size_t buflen)
 		return -1;
 	}
 
-	data = *buf;
-	if (frame->l1_ops.build) {
-		if ((ret = frame->l1_ops.build(frame->l1_hdr, data, len)) < 0) {
-			if (internal) {
-				free(*buf);
-				*buf = NULL;
-			}
-			return -1;
-		}
-		len -= ret;
-		data += ret;
+	if ((ret = build_headers(frame, *buf, len)) < 0)
+		goto err;
+	if (len - ret < frame->payload_len) {
+		errno = EMSGSIZE;
+		goto err;
 	}
-	if (frame->l2_ops.build) {
-		if ((ret = frame->l2_ops.build(frame->l2_hdr, data, len)) < 0) {
-			if (internal) {
-				free(*buf);
-				*buf = NULL;
-			}
-			return -1;
-		}
-		len -= ret;
-		data += ret;
+	memcpy(*buf + ret, frame->payload, frame->payload_len);
+
+	return ret + frame->payload_len;
+
+err:
+	if (internal) {
+		free(*buf);
+		*buf = NULL;
 	}
-	if (len < frame->payload_len) {
-		if (internal) {
-			free(*buf);
-			*buf = NULL;
-		}
-		errno = EMSGSIZE;
+	return -1;
+}
+
+int moep_frame_encode_iov(moep_frame_t frame, struct iovec *iov, u8 *buf,
+			  size_t buflen)
+{
+	int len;
+
+	if ((len = build_headers(frame, buf, buflen)) < 0)
 		return -1;
-	}
-	memcpy(data, frame->payload, frame->payload_len);
-	len -= frame->payload_len;
-	data += frame->payload_len;
 
-	return data - *buf;
+	iov[0].iov_base = buf;
+	iov[0].iov_len = len;
+	iov[1].iov_base = frame->payload;
+	iov[1].iov_len = frame->payload_len;
+
+	return len + frame->payload_len;
 }
 
 void moep_frame_destroy(moep_frame_t frame)
 {
 	clean_frame(frame);
-	free(frame);
+	pool_free(frame);
 }
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+
+#include <moep/types.h>
+#include <moep/frame.h>
+
+
+/*
+ * Decode the frame from a buffer allocated with pool_alloc() without copying
+ * the payload. The frame takes ownership of buf in any case and frees it on
+ * destruction. Headers implementing parse_inplace() may reference buf, too.
+ */
+int frame_decode_inplace(moep_frame_t frame, u8 *buf, size_t buflen);
+
+#endif /* FRAME_H */
@@ -28,6 +28,8 @@
 #include <moep/modules/ieee80211.h>
 #include <moep/modules/radio.h>
 
+#include "../../pool.h"
+
 
 #define DEREF_AND_INC_PTR(type, ptr)	(*((*(type **)&(ptr))++))
 
@@ -53,7 +55,7 @@ static void *ieee80211_create(void)
 {
 	struct ieee80211_hdr_gen *hdr;
 
-	if (!(hdr = malloc(sizeof(*hdr)))) {
+	if (!(hdr = pool_alloc(sizeof(*hdr)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -62,7 +64,7 @@ static void *ieee80211_create(void)
 
 static void ieee80211_destroy(void *hdr)
 {
-	free(hdr);
+	pool_free(hdr);
 }
 
 static void *ieee80211_parse(u8 **raw, size_t *maxlen)
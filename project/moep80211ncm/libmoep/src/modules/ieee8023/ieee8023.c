@@ -34,12 +34,14 @@
 #include <moep/modules/tap.h>
 #include <moep/modules/unix.h>
 
+#include "../../pool.h"
+
 
 static void *ieee8023_create(void)
 {
 	struct ether_header *hdr;
 
-	if (!(hdr = malloc(sizeof(*hdr)))) {
+	if (!(hdr = pool_alloc(sizeof(*hdr)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -48,7 +50,7 @@ static void *ieee8023_create(void)
 
 static void ieee8023_destroy(void *hdr)
 {
-	free(hdr);
+	pool_free(hdr);
 }
 
 static void *ieee8023_parse(u8 **raw, size_t *maxlen)
@@ -30,10 +30,11 @@
 #include <moep/modules/moep80211.h>
 
 #include "../../moep_hdr_ext.h"
+#include "../../pool.h"
 
 
 struct moep80211_hdr_pointers {
-	struct moep_hdr_ext *ext[MOEP_HDR_COUNT];
+	struct moep_hdr_pointers exts;
 	struct moep80211_hdr hdr;
 };
 
@@ -50,7 +51,7 @@ static void *moep80211_create(void)
 {
 	struct moep80211_hdr_pointers *ptrs;
 
-	if (!(ptrs = malloc(sizeof(*ptrs)))) {
+	if (!(ptrs = pool_alloc(sizeof(*ptrs)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -88,6 +89,26 @@ static void *moep80211_parse(u8 **raw, size_t *maxlen)
 	return ptrs;
 }
 
+static void *moep80211_parse_inplace(u8 **raw, size_t *maxlen)
+{
+	struct moep80211_hdr_pointers *ptrs;
+
+	if (moep80211_hdr_is_valid((struct moep80211_hdr *)*raw, *maxlen)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(ptrs = moep80211_create()))
+		return NULL;
+	memcpy(&ptrs->hdr, *raw, sizeof(ptrs->hdr));
+	*maxlen -= sizeof(ptrs->hdr);
+	*raw += sizeof(ptrs->hdr);
+	if (moep_hdr_ext_parse_inplace(ptrs, raw, maxlen)) {
+		moep_hdr_ext_destroy(ptrs);
+		return NULL;
+	}
+	return ptrs;
+}
+
 static int moep80211_build_len(void *ptrs)
 {
 	return sizeof(struct moep80211_hdr) + moep_hdr_ext_build_len(ptrs);
@@ -113,6 +134,7 @@ static int moep80211_build(void *ptrs, u8 *raw, size_t maxlen)
 static struct moep_frame_ops moep80211_frame_ops = {
 	.create		= moep80211_create,
 	.parse		= moep80211_parse,
+	.parse_inplace	= moep80211_parse_inplace,
 	.build_len	= moep80211_build_len,
 	.build		= moep80211_build,
 	.destroy	= moep_hdr_ext_destroy,
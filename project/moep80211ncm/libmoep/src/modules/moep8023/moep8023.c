@@ -31,10 +31,11 @@
 #include <moep/modules/moep8023.h>
 
 #include "../../moep_hdr_ext.h"
+#include "../../pool.h"
 
 
 struct moep8023_hdr_pointers {
-	struct moep_hdr_ext *ext[MOEP_HDR_COUNT];
+	struct moep_hdr_pointers exts;
 	struct moep8023_hdr hdr;
 };
 
@@ -43,7 +44,7 @@ static void *moep8023_create(void)
 {
 	struct moep8023_hdr_pointers *ptrs;
 
-	if (!(ptrs = malloc(sizeof(*ptrs)))) {
+	if (!(ptrs = pool_alloc(sizeof(*ptrs)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -81,6 +82,26 @@ static void *moep8023_parse(u8 **raw, size_t *maxlen)
 	return ptrs;
 }
 
+static void *moep8023_parse_inplace(u8 **raw, size_t *maxlen)
+{
+	struct moep8023_hdr_pointers *ptrs;
+
+	if (moep8023_hdr_is_valid((struct moep8023_hdr *)*raw, *maxlen)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(ptrs = moep8023_create()))
+		return NULL;
+	memcpy(&ptrs->hdr, *raw, sizeof(ptrs->hdr));
+	*maxlen -= sizeof(ptrs->hdr);
+	*raw += sizeof(ptrs->hdr);
+	if (moep_hdr_ext_parse_inplace(ptrs, raw, maxlen)) {
+		moep_hdr_ext_destroy(ptrs);
+		return NULL;
+	}
+	return ptrs;
+}
+
 static int moep8023_build_len(void *ptrs)
 {
 	return sizeof(struct moep8023_hdr) + moep_hdr_ext_build_len(ptrs);
@@ -106,6 +127,7 @@ static int moep8023_build(void *ptrs, u8 *raw, size_t maxlen)
 static struct moep_frame_ops moep8023_frame_ops = {
 	.create		= moep8023_create,
 	.parse		= moep8023_parse,
+	.parse_inplace	= moep8023_parse_inplace,
 	.build_len	= moep8023_build_len,
 	.build		= moep8023_build,
 	.destroy	= moep_hdr_ext_destroy,
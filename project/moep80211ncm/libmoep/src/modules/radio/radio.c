@@ -41,19 +41,25 @@
 #include <moep/modules/radio.h>
 
 #include "../../interfaces.h"
+#include "../../pool.h"
 
 #include "../../netlink/util.h"
 #include "../../netlink/error.h"
 
 #include "radiotap.h"
 #include "nl80211.h"
+#include "ring.h"
+
+
+static struct moep80211_ring_params ring_params;
+static int ring_enabled = 0;
 
 
 static void *radio_create(void)
 {
 	struct moep80211_radiotap *hdr;
 
-	if (!(hdr = malloc(sizeof(*hdr)))) {
+	if (!(hdr = pool_alloc(sizeof(*hdr)))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -64,7 +70,7 @@ static void *radio_create(void)
 
 static void radio_destroy(void *hdr)
 {
-	free(hdr);
+	pool_free(hdr);
 }
 
 
@@ -293,6 +299,9 @@ static int radio_close(int fd, void *priv)
 	}
 	ifindex = sll.sll_ifindex;
 
+	if (priv)
+		packet_ring_close(priv);
+
 	if (close(fd))
 		return -1;
 
@@ -322,10 +331,60 @@ static int radio_close(int fd, void *priv)
 	return 0;
 }
 
+static u8 *radio_rx_peek(int fd, void *priv, size_t *len)
+{
+	return packet_ring_rx_peek(priv, len);
+}
+
+static void radio_rx_release(int fd, void *priv)
+{
+	packet_ring_rx_release(priv);
+}
+
+static u8 *radio_tx_reserve(int fd, void *priv, size_t *maxlen)
+{
+	return packet_ring_tx_reserve(priv, maxlen);
+}
+
+static int radio_tx_commit(int fd, void *priv, size_t len)
+{
+	return packet_ring_tx_commit(priv, len);
+}
+
+static int radio_tx_flush(int fd, void *priv)
+{
+	return packet_ring_tx_flush(priv);
+}
+
+static int radio_tx_fd(int fd, void *priv)
+{
+	return packet_ring_tx_fd(priv);
+}
+
 static struct moep_dev_ops radio_dev_ops = {
 	.close		= radio_close,
 };
 
+static struct moep_dev_ops radio_ring_dev_ops = {
+	.close		= radio_close,
+	.rx_peek	= radio_rx_peek,
+	.rx_release	= radio_rx_release,
+	.tx_reserve	= radio_tx_reserve,
+	.tx_commit	= radio_tx_commit,
+	.tx_flush	= radio_tx_flush,
+	.tx_fd		= radio_tx_fd,
+};
+
+void moep_dev_radio_set_ring(const struct moep80211_ring_params *params)
+{
+	if (!params) {
+		ring_enabled = 0;
+		return;
+	}
+	ring_params = *params;
+	ring_enabled = 1;
+}
+
 moep_dev_t moep_dev_radio_open(const char *devname, u32 freq,
 			       enum moep80211_chan_width chan_width,
 			       u32 freq1, u32 freq2, int mtu,
@@ -333,6 +392,7 @@ moep_dev_t moep_dev_radio_open(const char *devname, u32 freq,
 {
 	moep_dev_t dev;
 	int fd;
+	struct packet_ring *ring;
 	struct nl_sock *sock;
 	int family;
 	int wiphy;
@@ -402,11 +462,25 @@ moep_dev_t moep_dev_radio_open(const char *devname, u32 freq,
 		return NULL;
 	}
 
+	ring = NULL;
+	if (ring_enabled &&
+	    !(ring = packet_ring_open(fd, ifindex, mtu, &ring_params))) {
+		err = errno;
+		close(fd);
+		del_iface(sock, family, ifindex);
+		nl_socket_free(sock);
+		errno = err;
+		return NULL;
+	}
+
 	nl_socket_free(sock);
 
-	if (!(dev = moep_dev_open(fd, mtu, &radio_dev_ops, NULL,
-				  &radio_frame_ops, l2_ops))) {
+	if (!(dev = moep_dev_open(fd, mtu, ring ? &radio_ring_dev_ops :
+				  &radio_dev_ops, ring, &radio_frame_ops,
+				  l2_ops))) {
 		err = errno;
+		if (ring)
+			packet_ring_close(ring);
 		close(fd);
 		del_iface(sock, family, ifindex);
 		errno = err;
@@ -0,0 +1,325 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <linux/if_packet.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <net/ethernet.h>
+
+#include <moep/types.h>
+
+#include "ring.h"
+
+
+#define RING_DEFAULT_BLOCK_SIZE		(1 << 16)
+#define RING_DEFAULT_BLOCK_NR		64
+#define RING_DEFAULT_BLOCK_TOV		1
+#define RING_DEFAULT_FRAME_NR		256
+
+#define TX_DATA_OFFSET	(TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+
+struct packet_ring {
+	int txfd;
+
+	u8 *rx_map;
+	size_t rx_maplen;
+	unsigned int rx_block_size;
+	unsigned int rx_block_nr;
+	unsigned int rx_block;
+	struct tpacket3_hdr *rx_pkt;
+	u32 rx_pkts_left;
+
+	u8 *tx_map;
+	size_t tx_maplen;
+	unsigned int tx_block_size;
+	unsigned int tx_frame_size;
+	unsigned int tx_frames_per_block;
+	unsigned int tx_frame_nr;
+	unsigned int tx_head;
+};
+
+
+static unsigned int page_align(unsigned int size)
+{
+	unsigned int pagesize = sysconf(_SC_PAGESIZE);
+
+	return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+static int setup_rx_ring(struct packet_ring *ring, int fd, int mtu,
+			 const struct moep80211_ring_params *params)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	unsigned int frame_size;
+
+	ring->rx_block_size = page_align(params->block_size ?:
+					 RING_DEFAULT_BLOCK_SIZE);
+	ring->rx_block_nr = params->block_nr ?: RING_DEFAULT_BLOCK_NR;
+
+	frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + mtu);
+	if (frame_size > ring->rx_block_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)))
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = ring->rx_block_size;
+	req.tp_block_nr = ring->rx_block_nr;
+	req.tp_frame_size = frame_size;
+	req.tp_frame_nr = (ring->rx_block_size / frame_size) *
+			  ring->rx_block_nr;
+	req.tp_retire_blk_tov = params->block_tov ?: RING_DEFAULT_BLOCK_TOV;
+	req.tp_feature_req_word = 0;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+		return -1;
+
+	ring->rx_maplen = (size_t)ring->rx_block_size * ring->rx_block_nr;
+	ring->rx_map = mmap(NULL, ring->rx_maplen, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (ring->rx_map == MAP_FAILED) {
+		ring->rx_map = NULL;
+		return -1;
+	}
+
+	ring->rx_block = 0;
+	ring->rx_pkt = NULL;
+	ring->rx_pkts_left = 0;
+	return 0;
+}
+
+static int setup_tx_ring(struct packet_ring *ring, int ifindex, int mtu,
+			 const struct moep80211_ring_params *params)
+{
+	struct tpacket_req req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V2;
+	unsigned int frame_nr;
+
+	ring->tx_frame_size = TPACKET_ALIGN(TPACKET2_HDRLEN + mtu);
+	ring->tx_block_size = page_align(ring->tx_frame_size);
+	ring->tx_frames_per_block = ring->tx_block_size / ring->tx_frame_size;
+	frame_nr = params->frame_nr ?: RING_DEFAULT_FRAME_NR;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_frame_size = ring->tx_frame_size;
+	req.tp_block_size = ring->tx_block_size;
+	req.tp_block_nr = (frame_nr + ring->tx_frames_per_block - 1) /
+			  ring->tx_frames_per_block;
+	req.tp_frame_nr = req.tp_block_nr * ring->tx_frames_per_block;
+	ring->tx_frame_nr = req.tp_frame_nr;
+
+	if ((ring->txfd = socket(PF_PACKET, SOCK_RAW | SOCK_NONBLOCK, 0)) < 0)
+		return -1;
+
+	if (setsockopt(ring->txfd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)))
+		return -1;
+	if (setsockopt(ring->txfd, SOL_PACKET, PACKET_TX_RING, &req,
+		       sizeof(req)))
+		return -1;
+
+	ring->tx_maplen = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->tx_map = mmap(NULL, ring->tx_maplen, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->txfd, 0);
+	if (ring->tx_map == MAP_FAILED) {
+		ring->tx_map = NULL;
+		return -1;
+	}
+
+	/*
+	 * A protocol of 0 keeps the TX socket from receiving any frames, so
+	 * the RX ring socket is the only one the kernel has to feed.
+	 */
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifindex;
+	if (bind(ring->txfd, (struct sockaddr *)&sll, sizeof(sll)))
+		return -1;
+
+	ring->tx_head = 0;
+	return 0;
+}
+
+struct packet_ring *packet_ring_open(int rxfd, int ifindex, int mtu,
+				     const struct moep80211_ring_params *params)
+{
+	struct packet_ring *ring;
+	int err;
+
+	if (!(ring = malloc(sizeof(*ring)))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->txfd = -1;
+
+	if (setup_rx_ring(ring, rxfd, mtu, params) ||
+	    setup_tx_ring(ring, ifindex, mtu, params)) {
+		err = errno;
+		packet_ring_close(ring);
+		errno = err;
+		return NULL;
+	}
+
+	return ring;
+}
+
+void packet_ring_close(struct packet_ring *ring)
+{
+	if (ring->tx_map)
+		munmap(ring->tx_map, ring->tx_maplen);
+	if (ring->txfd >= 0)
+		close(ring->txfd);
+	if (ring->rx_map)
+		munmap(ring->rx_map, ring->rx_maplen);
+	free(ring);
+}
+
+static struct tpacket_block_desc *rx_block(struct packet_ring *ring)
+{
+	return (struct tpacket_block_desc *)
+		(ring->rx_map + (size_t)ring->rx_block * ring->rx_block_size);
+}
+
+static void rx_block_release(struct packet_ring *ring)
+{
+	__sync_synchronize();
+	rx_block(ring)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	ring->rx_block = (ring->rx_block + 1) % ring->rx_block_nr;
+	ring->rx_pkt = NULL;
+	ring->rx_pkts_left = 0;
+}
+
+u8 *packet_ring_rx_peek(struct packet_ring *ring, size_t *len)
+{
+	struct tpacket_block_desc *bd;
+
+	while (!ring->rx_pkt) {
+		bd = rx_block(ring);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+			errno = EAGAIN;
+			return NULL;
+		}
+		__sync_synchronize();
+
+		if (!bd->hdr.bh1.num_pkts) {
+			rx_block_release(ring);
+			continue;
+		}
+		ring->rx_pkts_left = bd->hdr.bh1.num_pkts;
+		ring->rx_pkt = (struct tpacket3_hdr *)
+			((u8 *)bd + bd->hdr.bh1.offset_to_first_pkt);
+	}
+
+	*len = ring->rx_pkt->tp_snaplen;
+	return (u8 *)ring->rx_pkt + ring->rx_pkt->tp_mac;
+}
+
+void packet_ring_rx_release(struct packet_ring *ring)
+{
+	if (!ring->rx_pkt)
+		return;
+
+	if (--ring->rx_pkts_left)
+		ring->rx_pkt = (struct tpacket3_hdr *)
+			((u8 *)ring->rx_pkt + ring->rx_pkt->tp_next_offset);
+	else
+		rx_block_release(ring);
+}
+
+/*
+ * Frames never span blocks, so there may be a gap at the end of each block if
+ * the frame size does not divide the block size.
+ */
+static struct tpacket2_hdr *tx_frame(struct packet_ring *ring)
+{
+	unsigned int block, frame;
+
+	block = ring->tx_head / ring->tx_frames_per_block;
+	frame = ring->tx_head % ring->tx_frames_per_block;
+	return (struct tpacket2_hdr *)
+		(ring->tx_map + (size_t)block * ring->tx_block_size +
+		 (size_t)frame * ring->tx_frame_size);
+}
+
+u8 *packet_ring_tx_reserve(struct packet_ring *ring, size_t *maxlen)
+{
+	struct tpacket2_hdr *hdr;
+
+	hdr = tx_frame(ring);
+	switch (hdr->tp_status) {
+	case TP_STATUS_AVAILABLE:
+	case TP_STATUS_WRONG_FORMAT:
+		break;
+	default:
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	*maxlen = ring->tx_frame_size - TX_DATA_OFFSET;
+	return (u8 *)hdr + TX_DATA_OFFSET;
+}
+
+int packet_ring_tx_commit(struct packet_ring *ring, size_t len)
+{
+	struct tpacket2_hdr *hdr;
+
+	if (len > ring->tx_frame_size - TX_DATA_OFFSET) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	hdr = tx_frame(ring);
+	hdr->tp_len = len;
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+	ring->tx_head = (ring->tx_head + 1) % ring->tx_frame_nr;
+	return 0;
+}
+
+int packet_ring_tx_flush(struct packet_ring *ring)
+{
+	int ret;
+
+	do {
+		ret = sendto(ring->txfd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+	    errno != ENOBUFS)
+		return -1;
+	return 0;
+}
+
+int packet_ring_tx_fd(struct packet_ring *ring)
+{
+	return ring->txfd;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+#include <moep/types.h>
+#include <moep/modules/radio.h>
+
+
+struct packet_ring;
+
+/*
+ * Attach a TPACKET_V3 RX ring to the bound packet socket rxfd and open a
+ * second packet socket on ifindex that carries a TPACKET_V2 TX ring.
+ */
+struct packet_ring *packet_ring_open(int rxfd, int ifindex, int mtu,
+				     const struct moep80211_ring_params *params);
+
+void packet_ring_close(struct packet_ring *ring);
+
+u8 *packet_ring_rx_peek(struct packet_ring *ring, size_t *len);
+
+void packet_ring_rx_release(struct packet_ring *ring);
+
+u8 *packet_ring_tx_reserve(struct packet_ring *ring, size_t *maxlen);
+
+int packet_ring_tx_commit(struct packet_ring *ring, size_t len);
+
+int packet_ring_tx_flush(struct packet_ring *ring);
+
+/*
+ * The TX socket polls writable while the next TX slot is available.
+ */
+int packet_ring_tx_fd(struct packet_ring *ring);
+
+#endif /* RING_H */
@@ -26,21 +26,30 @@
 #include <moep/moep_hdr_ext.h>
 
 #include "moep_hdr_ext.h"
+#include "pool.h"
 
 
-struct moep_hdr_pointers {
-	struct moep_hdr_ext *ext[MOEP_HDR_COUNT];
-};
+static int is_view(struct moep_hdr_pointers *ptrs, struct moep_hdr_ext *ext)
+{
+	return ptrs->view && (u8 *)ext >= ptrs->view &&
+	       (u8 *)ext < ptrs->view + ptrs->viewlen;
+}
 
+static void release_moep_hdr_ext(struct moep_hdr_pointers *ptrs, u8 type)
+{
+	if (!is_view(ptrs, ptrs->ext[type]))
+		pool_free(ptrs->ext[type]);
+	ptrs->ext[type] = NULL;
+}
 
 void moep_hdr_ext_destroy(void *ptrs)
 {
 	int i;
 
 	for (i = 0; i < MOEP_HDR_COUNT; i++) {
-		free(((struct moep_hdr_pointers *)ptrs)->ext[i]);
+		release_moep_hdr_ext(ptrs, i);
 	}
-	free(ptrs);
+	pool_free(ptrs);
 }
 
 static int moep_hdr_ext_is_valid(struct moep_hdr_ext *ext, int maxlen)
@@ -58,8 +67,8 @@ static int set_moep_hdr_ext(struct moep_hdr_pointers *ptrs,
 	u8 type;
 
 	type = ext->type & MOEP_HDR_MASK;
-	free(ptrs->ext[type]);
-	if (!(ptrs->ext[type] = malloc(ext->len))) {
+	release_moep_hdr_ext(ptrs, type);
+	if (!(ptrs->ext[type] = pool_alloc(ext->len))) {
 		errno = ENOMEM;
 		return -1;
 	}
@@ -89,6 +98,33 @@ int moep_hdr_ext_parse(void *ptrs, u8 **raw, size_t *maxlen)
 	return 0;
 }
 
+int moep_hdr_ext_parse_inplace(void *ptrs, u8 **raw, size_t *maxlen)
+{
+	struct moep_hdr_pointers *p = ptrs;
+	struct moep_hdr_ext *ext;
+	u8 nexthdr;
+	u8 type;
+
+	p->view = *raw;
+	p->viewlen = *maxlen;
+
+	do {
+		ext = (struct moep_hdr_ext *)*raw;
+		if (moep_hdr_ext_is_valid(ext, *maxlen)) {
+			errno = EINVAL;
+			return -1;
+		}
+		nexthdr = ext->type & MOEP_HDR_NEXTHDR_PRESENT;
+		type = ext->type & MOEP_HDR_MASK;
+		ext->type = type;
+		release_moep_hdr_ext(p, type);
+		p->ext[type] = ext;
+		*maxlen -= ext->len;
+		*raw += ext->len;
+	} while (nexthdr);
+	return 0;
+}
+
 int moep_hdr_ext_build_len(void *ptrs)
 {
 	int i;
@@ -169,8 +205,8 @@ struct moep_hdr_ext *moep_frame_add_moep_hdr_ext(moep_frame_t frame,
 		errno = EINVAL;
 		return NULL;
 	}
-	free(ptrs->ext[type]);
-	if (!(ptrs->ext[type] = malloc(len))) {
+	release_moep_hdr_ext(ptrs, type);
+	if (!(ptrs->ext[type] = pool_alloc(len))) {
 		errno = ENOMEM;
 		return NULL;
 	}
@@ -206,7 +242,6 @@ int moep_frame_del_moep_hdr_ext(moep_frame_t frame,
 		errno = EINVAL;
 		return -1;
 	}
-	free(ptrs->ext[type]);
-	ptrs->ext[type] = NULL;
+	release_moep_hdr_ext(ptrs, type);
 	return 0;
 }
@@ -21,12 +21,27 @@
 #define MOEP_HDR_EXT_H
 
 #include <moep/types.h>
+#include <moep/moep_hdr_ext.h>
 
 
+/*
+ * Modules using moep header extensions must place this struct at the start of
+ * their header. If the extensions were parsed in place, the pointers may
+ * reference the receive buffer given by view and viewlen. Such extensions are
+ * never freed, and modifying them replaces the view by a private copy.
+ */
+struct moep_hdr_pointers {
+	struct moep_hdr_ext *ext[MOEP_HDR_COUNT];
+	u8 *view;
+	size_t viewlen;
+};
+
 void moep_hdr_ext_destroy(void *ptrs);
 
 int moep_hdr_ext_parse(void *ptrs, u8 **raw, size_t *maxlen);
 
+int moep_hdr_ext_parse_inplace(void *ptrs, u8 **raw, size_t *maxlen);
+
 int moep_hdr_ext_build_len(void *ptrs);
 
 int moep_hdr_ext_build(void *ptrs, u8 *raw, size_t maxlen);
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include <moep/types.h>
+#include <moep/system.h>
+
+#include "pool.h"
+#include "util.h"
+
+
+#define POOL_SLAB_SIZE		(256 * 1024)
+#define POOL_HUGE_SLAB_SIZE	(2 * 1024 * 1024)
+
+#define POOL_CLASS_NONE		((u32)-1)
+
+
+/*
+ * Every object is preceded by a header that records its size class, so that
+ * pool_free() does not need to know the size. The header is 16 bytes to keep
+ * the object aligned like malloc() memory.
+ */
+struct pool_hdr {
+	u32 class;
+	u32 size;
+	u64 pad;
+};
+
+struct pool_obj {
+	struct pool_obj *next;
+};
+
+static const u32 pool_classes[] = {
+	128,
+	256,
+	512,
+	2048,
+	4096,
+	8192,
+};
+
+#define POOL_CLASS_COUNT	ARRAY_SIZE(pool_classes)
+
+struct pool_cache {
+	struct pool_obj *free[POOL_CLASS_COUNT];
+	u8 *slab;
+	size_t slab_left;
+};
+
+
+static int pool_hugepages = 0;
+static __thread struct pool_cache cache;
+
+
+__attribute__((constructor)) static void pool_init(void)
+{
+	const char *env;
+
+	if ((env = getenv("MOEP_HUGEPAGES")) && atoi(env))
+		pool_hugepages = 1;
+}
+
+void moep_set_hugepages(int enable)
+{
+	pool_hugepages = !!enable;
+}
+
+static int size_class(size_t size)
+{
+	int i;
+
+	for (i = 0; i < POOL_CLASS_COUNT; i++) {
+		if (size <= pool_classes[i])
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Slabs are never returned to the system. Their objects cycle through the
+ * free lists of the threads that release them.
+ */
+static int slab_refill(void)
+{
+	void *slab;
+	size_t len;
+
+	slab = MAP_FAILED;
+	if (pool_hugepages) {
+		len = POOL_HUGE_SLAB_SIZE;
+		slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+	if (slab == MAP_FAILED) {
+		len = POOL_SLAB_SIZE;
+		slab = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (slab == MAP_FAILED) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	cache.slab = slab;
+	cache.slab_left = len;
+	return 0;
+}
+
+static struct pool_hdr *slab_alloc(int class)
+{
+	struct pool_hdr *hdr;
+	size_t len;
+
+	len = sizeof(*hdr) + pool_classes[class];
+	if (cache.slab_left < len && slab_refill())
+		return NULL;
+
+	hdr = (struct pool_hdr *)cache.slab;
+	cache.slab += len;
+	cache.slab_left -= len;
+	return hdr;
+}
+
+void *pool_alloc(size_t size)
+{
+	struct pool_hdr *hdr;
+	struct pool_obj *obj;
+	int class;
+
+	if ((class = size_class(size)) < 0) {
+		if (!(hdr = malloc(sizeof(*hdr) + size))) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		hdr->class = POOL_CLASS_NONE;
+		hdr->size = size;
+		return hdr + 1;
+	}
+
+	if ((obj = cache.free[class])) {
+		cache.free[class] = obj->next;
+		return obj;
+	}
+
+	if (!(hdr = slab_alloc(class)))
+		return NULL;
+	hdr->class = class;
+	hdr->size = pool_classes[class];
+	return hdr + 1;
+}
+
+void *pool_realloc(void *ptr, size_t size)
+{
+	struct pool_hdr *hdr;
+	void *new;
+
+	if (!ptr)
+		return pool_alloc(size);
+
+	hdr = (struct pool_hdr *)ptr - 1;
+	if (size <= hdr->size)
+		return ptr;
+
+	if (!(new = pool_alloc(size)))
+		return NULL;
+	memcpy(new, ptr, hdr->size);
+	pool_free(ptr);
+	return new;
+}
+
+void pool_free(void *ptr)
+{
+	struct pool_hdr *hdr;
+	struct pool_obj *obj;
+
+	if (!ptr)
+		return;
+
+	hdr = (struct pool_hdr *)ptr - 1;
+	if (hdr->class == POOL_CLASS_NONE) {
+		free(hdr);
+		return;
+	}
+
+	obj = ptr;
+	obj->next = cache.free[hdr->class];
+	cache.free[hdr->class] = obj;
+}
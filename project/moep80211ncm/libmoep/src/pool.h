@@ -0,0 +1,39 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+
+/*
+ * Per-thread pool allocator for the small, short-lived objects on the frame
+ * path, i.e. frames, headers, header extensions and MTU-sized buffers. Memory
+ * obtained from these functions must be released with pool_free() and never
+ * with free().
+ */
+
+void *pool_alloc(size_t size);
+
+void *pool_realloc(void *ptr, size_t size);
+
+void pool_free(void *ptr);
+
+#endif /* POOL_H */
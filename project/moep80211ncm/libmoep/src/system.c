@@ -29,14 +29,11 @@
 #include <moep/system.h>
 
 #include "util.h"
+#include "list.h"
+#include "callback.h"
+#include "uring.h"
 
 
-struct moep_callback {
-	int fd;
-	cb_handler handler;
-	void *data;
-};
-
 struct sfd_data {
 	sig_handler sigh;
 	void *data;
@@ -46,25 +43,46 @@ struct sfd_data {
 static int (*moep_epoll_pwait)(int, struct epoll_event *, int, int,
 			       const sigset_t *) = epoll_pwait;
 static int moep_epfd;
+static enum moep_backend moep_backend = MOEP_BACKEND_EPOLL;
+
+static LIST_HEAD(moep_callback_list);
 
 
 __attribute__((constructor)) static void create_epfd(void) {
+	const char *backend;
+
 	if ((moep_epfd = epoll_create1(0)) < 0) {
 		fprintf(stderr, "libmoep initialization error: "
 			"Cannot create epoll instance: %s\n", strerror(errno));
 		exit(-1);
 	}
+
+	if ((backend = getenv("MOEP_BACKEND")) &&
+	    !strcmp(backend, "io_uring") &&
+	    moep_set_backend(MOEP_BACKEND_IO_URING))
+		fprintf(stderr, "libmoep initialization warning: "
+			"Cannot use io_uring backend: %s\n", strerror(errno));
 }
 
 __attribute__((destructor)) static void close_epfd(void) {
+	uring_close();
 	close(moep_epfd);
 }
 
+static int epoll_add(moep_callback_t callback)
+{
+	struct epoll_event event;
+
+	event.events = callback->events;
+	event.data.ptr = callback;
+	return epoll_ctl(moep_epfd, EPOLL_CTL_ADD, callback->fd, &event);
+}
+
 moep_callback_t moep_callback_create(int fd, cb_handler handler, void *data,
 				     u32 events)
 {
-	struct epoll_event event;
 	moep_callback_t callback;
+	int ret;
 
 	if (!(callback = malloc(sizeof(*callback)))) {
 		errno = ENOMEM;
@@ -73,14 +91,19 @@ moep_callback_t moep_callback_create(int fd, cb_handler handler, void *data,
 	callback->fd = fd;
 	callback->handler = handler;
 	callback->data = data;
-
-	event.events = events;
-	event.data.ptr = callback;
-	if (epoll_ctl(moep_epfd, EPOLL_CTL_ADD, callback->fd, &event) < 0) {
+	callback->events = events;
+	callback->priv = NULL;
+
+	if (moep_backend == MOEP_BACKEND_IO_URING)
+		ret = uring_callback_add(callback);
+	else
+		ret = epoll_add(callback);
+	if (ret < 0) {
 		free(callback);
 		return NULL;
 	}
 
+	list_add(&callback->list, &moep_callback_list);
 	return callback;
 }
 
@@ -88,6 +111,10 @@ int moep_callback_change(moep_callback_t callback, u32 events)
 {
 	struct epoll_event event;
 
+	callback->events = events;
+	if (moep_backend == MOEP_BACKEND_IO_URING)
+		return uring_callback_change(callback);
+
 	event.events = events;
 	event.data.ptr = callback;
 
@@ -96,14 +123,50 @@ int moep_callback_change(moep_callback_t callback, u32 events)
 
 int moep_callback_delete(moep_callback_t callback)
 {
-	if (epoll_ctl(moep_epfd, EPOLL_CTL_DEL, callback->fd, NULL) < 0) {
+	if (moep_backend == MOEP_BACKEND_IO_URING)
+		uring_callback_delete(callback);
+	else if (epoll_ctl(moep_epfd, EPOLL_CTL_DEL, callback->fd, NULL) < 0)
 		return -1;
-	}
 
+	list_del(&callback->list);
 	free(callback);
 	return 0;
 }
 
+int moep_set_backend(enum moep_backend backend)
+{
+	moep_callback_t callback;
+
+	if (backend == moep_backend)
+		return 0;
+
+	switch (backend) {
+	case MOEP_BACKEND_EPOLL:
+		list_for_each_entry(callback, &moep_callback_list, list) {
+			uring_callback_delete(callback);
+			if (epoll_add(callback))
+				return -1;
+		}
+		uring_close();
+		break;
+	case MOEP_BACKEND_IO_URING:
+		if (uring_open())
+			return -1;
+		list_for_each_entry(callback, &moep_callback_list, list) {
+			epoll_ctl(moep_epfd, EPOLL_CTL_DEL, callback->fd, NULL);
+			if (uring_callback_add(callback))
+				return -1;
+		}
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	moep_backend = backend;
+	return 0;
+}
+
 void moep_set_custom_wait(int (*wait)(int, struct epoll_event *, int, int,
 				     const sigset_t *))
 {
@@ -120,6 +183,9 @@ int moep_wait(int epfd, struct epoll_event *events, int maxevents, int timeout,
 	int ret;
 	int err;
 
+	if (moep_backend == MOEP_BACKEND_IO_URING)
+		return uring_wait(epfd, events, maxevents, timeout, sigmask);
+
 	t = timeout;
 	if (timeout > 0)
 		clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -138,7 +204,7 @@ int moep_wait(int epfd, struct epoll_event *events, int maxevents, int timeout,
 				t = 0;
 		}
 
-		ret = moep_epoll_pwait(moep_epfd, &event, 100, t, sigmask);
+		ret = moep_epoll_pwait(moep_epfd, &event, 1, t, sigmask);
 		if (ret <= 0) {
 			err = errno;
 			if (epfd >= 0 &&
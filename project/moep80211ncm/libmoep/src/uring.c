@@ -0,0 +1,586 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * io_uring backend for the moep callback system
+ *
+ * Every callback is backed by a poll request on the ring. Callbacks without
+ * EPOLLONESHOT use multishot polls that stay armed, and oneshot callbacks are
+ * re-armed by queueing a new SQE. Unlike epoll_ctl(), re-arming therefore costs
+ * no system call, as the SQE is submitted together with the next wait. Watched
+ * file descriptors are installed in a sparse fixed file table, and the
+ * moep_wait() timeout is implemented as a timeout SQE.
+ *
+ * The ring is driven through the raw system calls, so there is no dependency
+ * on liburing.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+#include <moep/types.h>
+#include <moep/system.h>
+
+#include "callback.h"
+#include "uring.h"
+
+
+#define URING_ENTRIES		256
+#define URING_FILES		256
+
+#define POLL_EVENT_MASK		(~(u32)(EPOLLONESHOT | EPOLLET))
+
+/*
+ * Tags the user_data of cancel SQEs, whose CQEs drop the reference the cancel
+ * holds on its target. Requests are malloc()ed and thus at least 8 byte
+ * aligned.
+ */
+#define REQ_CANCEL_TAG		1ULL
+
+
+enum req_type {
+	REQ_POLL,
+	REQ_EPFD,
+	REQ_TIMEOUT,
+};
+
+struct uring_req {
+	enum req_type type;
+	moep_callback_t callback;
+	int stale;
+	/*
+	 * A request is freed once its last CQE and the CQEs of all cancels
+	 * targeting it are reaped. The address keys the cancels, so it must not
+	 * be reused while a cancel is in flight.
+	 */
+	int refs;
+	struct __kernel_timespec ts;
+};
+
+static struct {
+	int fd;
+
+	void *sq_ptr;
+	size_t sq_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned sqe_tail;
+	unsigned to_submit;
+
+	void *cq_ptr;
+	size_t cq_len;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	int fixed;
+	int files[URING_FILES];
+} ring = {
+	.fd = -1,
+};
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(unsigned to_submit, unsigned min_complete,
+			      unsigned flags, const sigset_t *sigmask)
+{
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+		       flags, sigmask, _NSIG / 8);
+}
+
+static int sys_io_uring_register(unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, ring.fd, opcode, arg, nr_args);
+}
+
+static int enter(unsigned min_complete, const sigset_t *sigmask)
+{
+	unsigned flags;
+	int ret;
+
+	flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	__atomic_store_n(ring.sq_tail, ring.sqe_tail, __ATOMIC_RELEASE);
+	if ((ret = sys_io_uring_enter(ring.to_submit, min_complete, flags,
+				      sigmask)) < 0)
+		return -1;
+	ring.to_submit -= ret < ring.to_submit ? ret : ring.to_submit;
+	return 0;
+}
+
+static struct io_uring_sqe *get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head, idx;
+
+	head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+	if (ring.sqe_tail - head >= *ring.sq_entries) {
+		if (enter(0, NULL))
+			return NULL;
+		head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		if (ring.sqe_tail - head >= *ring.sq_entries) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	idx = ring.sqe_tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[idx] = idx;
+	ring.sqe_tail++;
+	ring.to_submit++;
+	return sqe;
+}
+
+static int set_fixed_file(int slot, int fd)
+{
+	struct io_uring_files_update up;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = slot;
+	up.fds = (u64)(uintptr_t)&fd;
+	if (sys_io_uring_register(IORING_REGISTER_FILES_UPDATE, &up, 1) < 0)
+		return -1;
+	ring.files[slot] = fd;
+	return 0;
+}
+
+static int get_fixed_file(int fd)
+{
+	int i;
+
+	for (i = 0; i < URING_FILES; i++) {
+		if (ring.files[i] == fd)
+			return i;
+	}
+	return -1;
+}
+
+static void install_fixed_file(int fd)
+{
+	int slot;
+
+	if (!ring.fixed || get_fixed_file(fd) >= 0)
+		return;
+	if ((slot = get_fixed_file(-1)) < 0)
+		return;
+	set_fixed_file(slot, fd);
+}
+
+static void remove_fixed_file(int fd)
+{
+	int slot;
+
+	if (!ring.fixed || (slot = get_fixed_file(fd)) < 0)
+		return;
+	set_fixed_file(slot, -1);
+}
+
+static void prep_fd(struct io_uring_sqe *sqe, int fd)
+{
+	int slot;
+
+	if ((slot = ring.fixed ? get_fixed_file(fd) : -1) >= 0) {
+		sqe->fd = slot;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = fd;
+	}
+}
+
+static struct uring_req *req_create(enum req_type type,
+				    moep_callback_t callback)
+{
+	struct uring_req *req;
+
+	if (!(req = malloc(sizeof(*req)))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(req, 0, sizeof(*req));
+	req->type = type;
+	req->callback = callback;
+	req->refs = 1;
+	return req;
+}
+
+static void req_put(struct uring_req *req)
+{
+	if (!--req->refs)
+		free(req);
+}
+
+static int poll_add(struct uring_req *req, int fd, u32 events, int multishot)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = get_sqe()))
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	prep_fd(sqe, fd);
+	sqe->poll32_events = events;
+	if (multishot)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = (u64)(uintptr_t)req;
+	return 0;
+}
+
+static int cancel(struct uring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = get_sqe()))
+		return -1;
+	sqe->opcode = req->type == REQ_TIMEOUT ? IORING_OP_TIMEOUT_REMOVE :
+						 IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (u64)(uintptr_t)req;
+	sqe->user_data = (u64)(uintptr_t)req | REQ_CANCEL_TAG;
+	req->refs++;
+	return 0;
+}
+
+static int arm(moep_callback_t callback)
+{
+	struct uring_req *req;
+
+	if (!(callback->events & POLL_EVENT_MASK))
+		return 0;
+
+	if (!(req = req_create(REQ_POLL, callback)))
+		return -1;
+	if (poll_add(req, callback->fd, callback->events & POLL_EVENT_MASK,
+		     !(callback->events & EPOLLONESHOT))) {
+		free(req);
+		return -1;
+	}
+	callback->priv = req;
+	return 0;
+}
+
+static int disarm(moep_callback_t callback)
+{
+	struct uring_req *req;
+
+	if (!(req = callback->priv))
+		return 0;
+	callback->priv = NULL;
+	req->callback = NULL;
+	return cancel(req);
+}
+
+int uring_open(void)
+{
+	struct io_uring_params p;
+	int err;
+
+	memset(&p, 0, sizeof(p));
+	if ((ring.fd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0)
+		return -1;
+
+	ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_len = p.cq_off.cqes + p.cq_entries *
+		      sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_len > ring.sq_len)
+			ring.sq_len = ring.cq_len;
+		ring.cq_len = ring.sq_len;
+	}
+
+	ring.sq_ptr = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring.fd,
+			   IORING_OFF_SQ_RING);
+	if (ring.sq_ptr == MAP_FAILED)
+		goto err_sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	} else {
+		ring.cq_ptr = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ring.fd,
+				   IORING_OFF_CQ_RING);
+		if (ring.cq_ptr == MAP_FAILED)
+			goto err_cq;
+	}
+
+	ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto err_sqes;
+
+	ring.sq_head = ring.sq_ptr + p.sq_off.head;
+	ring.sq_tail = ring.sq_ptr + p.sq_off.tail;
+	ring.sq_mask = ring.sq_ptr + p.sq_off.ring_mask;
+	ring.sq_entries = ring.sq_ptr + p.sq_off.ring_entries;
+	ring.sq_array = ring.sq_ptr + p.sq_off.array;
+	ring.sqe_tail = *ring.sq_tail;
+	ring.to_submit = 0;
+
+	ring.cq_head = ring.cq_ptr + p.cq_off.head;
+	ring.cq_tail = ring.cq_ptr + p.cq_off.tail;
+	ring.cq_mask = ring.cq_ptr + p.cq_off.ring_mask;
+	ring.cqes = ring.cq_ptr + p.cq_off.cqes;
+
+	/*
+	 * Fixed files are an optimization only, so the backend keeps working
+	 * with plain file descriptors if the kernel refuses a sparse table.
+	 */
+	memset(ring.files, -1, sizeof(ring.files));
+	ring.fixed = !sys_io_uring_register(IORING_REGISTER_FILES, ring.files,
+					    URING_FILES);
+
+	return 0;
+
+err_sqes:
+	err = errno;
+	if (ring.cq_ptr != ring.sq_ptr)
+		munmap(ring.cq_ptr, ring.cq_len);
+	errno = err;
+err_cq:
+	err = errno;
+	munmap(ring.sq_ptr, ring.sq_len);
+	errno = err;
+err_sq:
+	err = errno;
+	close(ring.fd);
+	ring.fd = -1;
+	errno = err;
+	return -1;
+}
+
+void uring_close(void)
+{
+	if (ring.fd < 0)
+		return;
+
+	munmap(ring.sqes, ring.sqes_len);
+	if (ring.cq_ptr != ring.sq_ptr)
+		munmap(ring.cq_ptr, ring.cq_len);
+	munmap(ring.sq_ptr, ring.sq_len);
+	close(ring.fd);
+	ring.fd = -1;
+}
+
+int uring_callback_add(moep_callback_t callback)
+{
+	install_fixed_file(callback->fd);
+	callback->priv = NULL;
+	return arm(callback);
+}
+
+int uring_callback_change(moep_callback_t callback)
+{
+	if (disarm(callback))
+		return -1;
+	return arm(callback);
+}
+
+void uring_callback_delete(moep_callback_t callback)
+{
+	disarm(callback);
+
+	/*
+	 * Submit the removal right away, as the pending poll would otherwise
+	 * keep the file open after the caller closed the file descriptor.
+	 */
+	enter(0, NULL);
+	remove_fixed_file(callback->fd);
+}
+
+static void abandon(struct uring_req *req)
+{
+	if (!req)
+		return;
+	req->stale = 1;
+	cancel(req);
+}
+
+enum cqe_result {
+	CQE_CONSUMED,
+	CQE_RETURN,
+	CQE_EPFD,
+};
+
+static enum cqe_result handle_cqe(struct io_uring_cqe *cqe,
+				  struct uring_req **epfd_req,
+				  struct uring_req **timeout_req, int *ret)
+{
+	struct uring_req *req;
+	moep_callback_t callback;
+	int res, more;
+
+	req = (struct uring_req *)(uintptr_t)(cqe->user_data & ~REQ_CANCEL_TAG);
+	res = cqe->res;
+	more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (!req)
+		return CQE_CONSUMED;
+
+	if (cqe->user_data & REQ_CANCEL_TAG) {
+		req_put(req);
+		return CQE_CONSUMED;
+	}
+
+	if (req->stale) {
+		if (!more)
+			req_put(req);
+		return CQE_CONSUMED;
+	}
+
+	switch (req->type) {
+	case REQ_EPFD:
+		req_put(req);
+		*epfd_req = NULL;
+		if (res < 0) {
+			errno = -res;
+			*ret = -1;
+			return CQE_RETURN;
+		}
+		return CQE_EPFD;
+	case REQ_TIMEOUT:
+		req_put(req);
+		*timeout_req = NULL;
+		*ret = 0;
+		return CQE_RETURN;
+	case REQ_POLL:
+		break;
+	}
+
+	callback = req->callback;
+	if (!more) {
+		if (callback && callback->priv == req)
+			callback->priv = NULL;
+		req_put(req);
+	}
+	if (!callback)
+		return CQE_CONSUMED;
+
+	if (res < 0) {
+		errno = -res;
+		*ret = -1;
+		return CQE_RETURN;
+	}
+
+	/*
+	 * The kernel may terminate a multishot poll, e.g. if the completion
+	 * queue overflows. Re-arm before the handler runs, as the handler may
+	 * delete the callback.
+	 */
+	if (!more && !(callback->events & EPOLLONESHOT) && arm(callback)) {
+		*ret = -1;
+		return CQE_RETURN;
+	}
+
+	if ((*ret = callback->handler(callback->fd, res, callback->data)))
+		return CQE_RETURN;
+	return CQE_CONSUMED;
+}
+
+int uring_wait(int epfd, struct epoll_event *events, int maxevents,
+	       int timeout, const sigset_t *sigmask)
+{
+	struct uring_req *epfd_req = NULL, *timeout_req = NULL;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe cqe;
+	unsigned head;
+	int ret = 0;
+	int err;
+
+	if (epfd >= 0) {
+		if (!(epfd_req = req_create(REQ_EPFD, NULL)))
+			return -1;
+		if (poll_add(epfd_req, epfd, EPOLLIN, 0)) {
+			free(epfd_req);
+			return -1;
+		}
+	}
+
+	if (timeout > 0) {
+		if (!(timeout_req = req_create(REQ_TIMEOUT, NULL)))
+			goto out_err;
+		timeout_req->ts.tv_sec = timeout / 1000;
+		timeout_req->ts.tv_nsec = (timeout % 1000) * 1000000;
+		if (!(sqe = get_sqe())) {
+			free(timeout_req);
+			timeout_req = NULL;
+			goto out_err;
+		}
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (u64)(uintptr_t)&timeout_req->ts;
+		sqe->len = 1;
+		sqe->user_data = (u64)(uintptr_t)timeout_req;
+	}
+
+	for (;;) {
+		head = *ring.cq_head;
+		if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			if (enter(timeout ? 1 : 0, sigmask))
+				goto out_err;
+			if (!timeout &&
+			    *ring.cq_head == __atomic_load_n(ring.cq_tail,
+							     __ATOMIC_ACQUIRE))
+				goto out;
+			continue;
+		}
+
+		cqe = ring.cqes[head & *ring.cq_mask];
+		__atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+		switch (handle_cqe(&cqe, &epfd_req, &timeout_req, &ret)) {
+		case CQE_CONSUMED:
+			continue;
+		case CQE_RETURN:
+			goto out;
+		case CQE_EPFD:
+			abandon(timeout_req);
+			return epoll_pwait(epfd, events, maxevents, 0, sigmask);
+		}
+	}
+
+out_err:
+	ret = -1;
+out:
+	err = errno;
+	abandon(epfd_req);
+	abandon(timeout_req);
+	errno = err;
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2013, 2014		Maurice Leclaire <leclaire@in.tum.de>
+ *				Stephan M. Guenther <moepi@moepi.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * See COPYING for more details.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <signal.h>
+
+#include <sys/epoll.h>
+
+#include <moep/system.h>
+
+
+int uring_open(void);
+
+void uring_close(void);
+
+int uring_callback_add(moep_callback_t callback);
+
+int uring_callback_change(moep_callback_t callback);
+
+void uring_callback_delete(moep_callback_t callback);
+
+int uring_wait(int epfd, struct epoll_event *events, int maxevents,
+	       int timeout, const sigset_t *sigmask);
+
+#endif /* URING_H */
@@ -9,26 +9,58 @@
 
 #define RLNC_STRUCTURED 0x1
 
+#define RLNC_SLAB_HUGEPAGES 0x1
+
 /* Forward declaration for typedef */
 struct rlnc_block;
 
 /* Nobody should look inside an rlnc block */
 typedef struct rlnc_block * rlnc_block_t;
 
+/* A slab hands out zeroed, aligned slots to the blocks drawing from it. Blocks
+ * take a slot only when a row is written to and return it on reset, so memory
+ * is proportional to the number of packets actually held. A slab created for
+ * count and dlen serves all blocks with at most count packets of dlen bytes. */
+struct rlnc_slab;
+typedef struct rlnc_slab * rlnc_slab_t;
+
+rlnc_slab_t	rlnc_slab_init(int count, size_t dlen, size_t alignment,
+					enum MOEPGF_TYPE gftype, int flags);
+void		rlnc_slab_free(rlnc_slab_t s);
+
 /* Functions to init, free, and reset (zero-out memory, do not touch paramters
  * such as packet count, and to not deallocate/reallocate memory) */
 rlnc_block_t	rlnc_block_init(int count, size_t dlen, size_t alignment,
 						enum MOEPGF_TYPE gftype);
+rlnc_block_t	rlnc_block_init_slab(int count, size_t dlen, size_t alignment,
+				enum MOEPGF_TYPE gftype, rlnc_slab_t slab);
 void		rlnc_block_free(rlnc_block_t b);
 int		rlnc_block_reset(rlnc_block_t b);
 
+/* Resets the block and changes its packet count. The count must not exceed the
+ * count the block was initialized with. */
+int		rlnc_block_resize(rlnc_block_t b, int count);
+
 /* Functions to add source frames, add/decode encoded frames, encode frames, and
  * get (return) decoded frames if available. */
 int 	rlnc_block_add(rlnc_block_t b, int pv, const uint8_t *data, size_t len);
 int 	rlnc_block_decode(rlnc_block_t b, const uint8_t *src, size_t len);
 ssize_t	rlnc_block_encode(const rlnc_block_t b, uint8_t *dst, size_t maxlen, int flags);
+ssize_t	rlnc_block_encode_view(const rlnc_block_t b, uint8_t **dst, int flags);
 ssize_t	rlnc_block_get(rlnc_block_t b, int pv, uint8_t *dst, size_t maxlen);
 
+/* Like rlnc_block_get(), but dst points into the decoded slot instead of
+ * receiving a copy. The view stays valid until the block is reset or freed. */
+ssize_t	rlnc_block_get_view(rlnc_block_t b, int pv, const uint8_t **dst);
+
+/* The decoded state is tracked as packets are decoded. A decoded packet is
+ * delivered once rlnc_block_get() or rlnc_block_get_view() returned it.
+ * rlnc_block_get_decoded() stores up to max pivots that are decoded but not
+ * delivered yet in pvs, in ascending order, and returns their number. */
+int	rlnc_block_is_decoded(const rlnc_block_t b, int pv);
+int	rlnc_block_undelivered(const rlnc_block_t b);
+int	rlnc_block_get_decoded(const rlnc_block_t b, int *pvs, int max);
+
 /* Temporary helper functions that may become static in the future. */
 void 	print_block(const rlnc_block_t b);
 
@@ -1,14 +1,36 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <sys/mman.h>
+
 #include <moeprlnc/rlnc.h>
 #include <moepcommon/util.h>
 
+#define RLNC_SLAB_CHUNK		(256 * 1024)
+#define RLNC_SLAB_HUGE_CHUNK	(2 * 1024 * 1024)
+
 struct slot {
 	uint16_t	len;
 	uint8_t		data[0];
 } __attribute__ ((packed));
 
+struct chunk {
+	struct chunk	*next;
+	size_t		len;
+};
+
+// Slots on the free list are always zeroed except for the list pointer, which
+// is cleared when the slot is handed out again.
+struct rlnc_slab {
+	size_t		slotlen;
+	size_t		alignment;
+	int		flags;
+
+	uint8_t		*zero;
+	uint8_t		*free;
+	struct chunk	*chunks;
+};
+
 struct length {
         unsigned int max;
 	unsigned int max_data;
@@ -20,10 +42,12 @@ struct rank {
 	int encode;
 	int decode;
 	int max;
+	int capacity;	// packet count the block was allocated for
 };
 
 struct rlnc_block {
-	uint8_t 	*buffer;
+	rlnc_slab_t	slab;
+	int		own_slab;
 	uint8_t 	**slot;
 
 	struct rank	rank;
@@ -33,6 +57,16 @@ struct rlnc_block {
 
 	int     	*pvlist;
 
+	// A row is decoded once its coefficients form a unit vector. Rows
+	// returned by rlnc_block_get() are delivered, source frames added to
+	// the block count as delivered right away.
+	uint64_t	*decoded;
+	uint64_t	*delivered;
+	int		undelivered;
+
+	// Nonzero coefficients of a row besides its pivot, -1 if unknown
+	int		*weight;
+
 	unsigned int 	r_seed;
 	struct		moepgf gf;
 
@@ -80,22 +114,95 @@ print_block(const rlnc_block_t b)
 }
 
 static int
-is_decoded(const rlnc_block_t b, int pv)
+row_weight(const rlnc_block_t b, int x, int pv)
 {
-	int i;
+	int i, w = 0;
 
 	for (i=0; i<b->rank.max; i++) {
-		if (i == pv) {
-			if (get_coefficient(b, pv, i) == 0)
-				return 0;
-			continue;
-		}
-
-		if (get_coefficient(b, pv, i))
-			return 0;
+		if (i != pv && get_coefficient(b, x, i))
+			w++;
 	}
 
-	return 1;
+	return w;
+}
+
+#define BITMAP_WORDS(n)	(((n) + 63) / 64)
+
+static inline int
+test_bit(const uint64_t *map, int x)
+{
+	return (map[x / 64] >> (x % 64)) & 1;
+}
+
+static inline void
+set_bit(uint64_t *map, int x)
+{
+	map[x / 64] |= 1ULL << (x % 64);
+}
+
+static void
+set_decoded(rlnc_block_t b, int x)
+{
+	if (test_bit(b->decoded, x))
+		return;
+
+	set_bit(b->decoded, x);
+	if (!test_bit(b->delivered, x))
+		b->undelivered++;
+}
+
+/*
+ * Row x was reduced by a new row with w nonzero coefficients besides its pivot.
+ * If the new row is a unit vector, x only lost its coefficient at the new pivot
+ * position. Otherwise, the coefficients of x only cancel out if x had just as
+ * many, so its weight is only counted again then or once it is needed, see
+ * resolve_weight(). At full rank, all rows are marked decoded anyway.
+ */
+static void
+reduce_weight(rlnc_block_t b, int x, int w)
+{
+	if (w && b->weight[x] - 1 != w)
+		b->weight[x] = -1;
+	else if (w || b->weight[x] < 0)
+		b->weight[x] = row_weight(b, x, x);
+	else
+		b->weight[x]--;
+
+	if (!b->weight[x])
+		set_decoded(b, x);
+}
+
+/* Counts the weight of a row of unknown weight, which is then cached until the
+ * row is reduced by a row that is not a unit vector again. Such rows are common
+ * with recoded traffic, which would otherwise only be returned at full rank. */
+static void
+resolve_weight(rlnc_block_t b, int x)
+{
+	if (b->weight[x] >= 0)
+		return;
+
+	b->weight[x] = row_weight(b, x, x);
+	if (!b->weight[x])
+		set_decoded(b, x);
+}
+
+static void
+resolve_weights(rlnc_block_t b)
+{
+	int i;
+
+	for (i=0; i<rank(b); i++)
+		resolve_weight(b, b->pvlist[i]);
+}
+
+static void
+set_delivered(rlnc_block_t b, int x)
+{
+	if (test_bit(b->delivered, x))
+		return;
+
+	set_bit(b->delivered, x);
+	b->undelivered--;
 }
 
 static inline int
@@ -111,8 +218,151 @@ find_pivot_position(const rlnc_block_t b, int x)
 	return -1;
 }
 
+static size_t
+slot_length(int count, size_t dlen, size_t alignment, int exponent,
+							unsigned int *coeff)
+{
+	unsigned int len;
+
+	len = count / (8/exponent);
+	if (count % (8/exponent))
+		len++;
+	if (coeff)
+		*coeff = len;
+
+	return aligned_length(len + sizeof(struct slot) + dlen, alignment);
+}
+
+static int
+slab_grow(rlnc_slab_t s)
+{
+	struct chunk *c;
+	uint8_t *p;
+	size_t len, off;
+
+	c = MAP_FAILED;
+	len = aligned_length(aligned_length(sizeof(*c), s->alignment) +
+				s->slotlen, RLNC_SLAB_CHUNK);
+	if (s->flags & RLNC_SLAB_HUGEPAGES) {
+		len = aligned_length(len, RLNC_SLAB_HUGE_CHUNK);
+		c = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+	if (c == MAP_FAILED) {
+		len = aligned_length(len, RLNC_SLAB_CHUNK);
+		c = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (c == MAP_FAILED) {
+		LOG(LOG_ERR, "mmap() failed");
+		return -1;
+	}
+
+	c->len = len;
+	c->next = s->chunks;
+	s->chunks = c;
+
+	// Anonymous mappings are zeroed, so the slots only need to be linked.
+	off = aligned_length(sizeof(*c), s->alignment);
+	for (; off + s->slotlen <= len; off += s->slotlen) {
+		p = (uint8_t *)c + off;
+		*(uint8_t **)p = s->free;
+		s->free = p;
+	}
+
+	return 0;
+}
+
+static uint8_t *
+slab_get(rlnc_slab_t s)
+{
+	uint8_t *p;
+
+	if (!s->free && slab_grow(s))
+		return NULL;
+
+	p = s->free;
+	s->free = *(uint8_t **)p;
+	*(uint8_t **)p = NULL;
+
+	return p;
+}
+
+// Only the first len bytes of a slot may have been written to.
+static void
+slab_put(rlnc_slab_t s, uint8_t *p, size_t len)
+{
+	memset(p, 0, len);
+	*(uint8_t **)p = s->free;
+	s->free = p;
+}
+
+rlnc_slab_t
+rlnc_slab_init(int count, size_t dlen, size_t alignment,
+				enum MOEPGF_TYPE gftype, int flags)
+{
+	rlnc_slab_t s;
+	struct moepgf gf;
+
+	if (NULL == (s = malloc(sizeof(struct rlnc_slab)))) {
+		LOG(LOG_ERR, "malloc() failed");
+		return NULL;
+	}
+
+	memset(s, 0, sizeof(*s));
+
+	moepgf_init(&gf, gftype, MOEPGF_ALGORITHM_BEST);
+
+	s->slotlen	= slot_length(count, dlen, alignment, gf.exponent, NULL);
+	s->alignment	= alignment;
+	s->flags	= flags;
+
+	if (posix_memalign((void *)&s->zero, alignment, s->slotlen)) {
+		LOG(LOG_ERR, "posix_memalign() failed");
+		free(s);
+		return NULL;
+	}
+
+	memset(s->zero, 0, s->slotlen);
+
+	return s;
+}
+
+void
+rlnc_slab_free(rlnc_slab_t s)
+{
+	struct chunk *c, *next;
+
+	for (c=s->chunks; c; c=next) {
+		next = c->next;
+		munmap(c, c->len);
+	}
+
+	free(s->zero);
+	free(s);
+}
+
+// Rows without a pivot share the read-only zero slot. A slot is only taken
+// from the slab when the row is written to for the first time.
+static uint8_t *
+get_slot(rlnc_block_t b, int x)
+{
+	uint8_t *p;
+
+	if (b->slot[x] != b->slab->zero)
+		return b->slot[x];
+
+	if (NULL == (p = slab_get(b->slab)))
+		return NULL;
+
+	b->slot[x] = p;
+
+	return p;
+}
+
 rlnc_block_t
-rlnc_block_init(int count, size_t dlen, size_t alignment, enum MOEPGF_TYPE gftype)
+rlnc_block_init_slab(int count, size_t dlen, size_t alignment,
+				enum MOEPGF_TYPE gftype, rlnc_slab_t slab)
 {
 	int i;
 	rlnc_block_t b;
@@ -126,47 +376,95 @@ rlnc_block_init(int count, size_t dlen, size_t alignment, enum MOEPGF_TYPE gftyp
 
 	moepgf_init(&b->gf, gftype, MOEPGF_ALGORITHM_BEST);
 
-	b->len.coeff = count / (8/b->gf.exponent);
-	if (count % (8/b->gf.exponent))
-		b->len.coeff++;
 	b->len.max_data	= dlen;
-	b->len.max	= aligned_length(b->len.coeff + sizeof(struct slot)
-						+ b->len.max_data, alignment);
+	b->len.max	= slot_length(count, dlen, alignment, b->gf.exponent,
+							&b->len.coeff);
 	b->rank.max	= count;
+	b->rank.capacity = count;
 	b->alignment	= alignment;
 
-	if (posix_memalign((void *)&b->buffer, alignment,
-						(b->len.max)*(count+1))) {
-		LOG(LOG_ERR, "posix_memalign() failed");
+	if (b->len.max > slab->slotlen) {
+		LOG(LOG_ERR, "slab slots too small, have %lu, need %u",
+			slab->slotlen, b->len.max);
+		free(b);
 		return NULL;
 	}
 
+	b->slab = slab;
+
 	if (NULL == (b->slot = malloc((b->rank.max+1) * sizeof(*b->slot)))) {
 		LOG(LOG_ERR, "malloc() failed");
 		return NULL;
 	}
 
 	for (i=0; i<b->rank.max+1; i++)
-		b->slot[i] = &b->buffer[i*b->len.max];
+		b->slot[i] = slab->zero;
 
 	if (NULL == (b->pvlist = malloc(sizeof(*b->pvlist)*count))) {
 		LOG(LOG_ERR, "malloc() failed");
 		return NULL;
 	}
 
+	b->decoded = calloc(BITMAP_WORDS(count), sizeof(*b->decoded));
+	b->delivered = calloc(BITMAP_WORDS(count), sizeof(*b->delivered));
+	b->weight = calloc(count, sizeof(*b->weight));
+	if (NULL == b->decoded || NULL == b->delivered || NULL == b->weight) {
+		LOG(LOG_ERR, "calloc() failed");
+		return NULL;
+	}
+
 	(void) rlnc_block_reset(b);
 
 	return b;
 }
 
+rlnc_block_t
+rlnc_block_init(int count, size_t dlen, size_t alignment, enum MOEPGF_TYPE gftype)
+{
+	rlnc_slab_t slab;
+	rlnc_block_t b;
+
+	if (NULL == (slab = rlnc_slab_init(count, dlen, alignment, gftype, 0)))
+		return NULL;
+
+	if (NULL == (b = rlnc_block_init_slab(count, dlen, alignment, gftype,
+								slab))) {
+		rlnc_slab_free(slab);
+		return NULL;
+	}
+
+	b->own_slab = 1;
+
+	return b;
+}
+
+static void
+release_slots(rlnc_block_t b)
+{
+	int i;
+
+	for (i=0; i<b->rank.max+1; i++) {
+		if (b->slot[i] == b->slab->zero)
+			continue;
+
+		slab_put(b->slab, b->slot[i], b->len.cc);
+		b->slot[i] = b->slab->zero;
+	}
+}
+
 int
 rlnc_block_reset(rlnc_block_t b)
 {
-	if (!b->buffer)
+	if (!b->slab)
 		return -1;
 
-	memset(b->buffer, 0, b->len.max * (b->rank.max+1));
+	release_slots(b);
 	memset(b->pvlist, -1, sizeof(*b->pvlist) * b->rank.max);
+	memset(b->decoded, 0, BITMAP_WORDS(b->rank.max) * sizeof(*b->decoded));
+	memset(b->delivered, 0,
+		BITMAP_WORDS(b->rank.max) * sizeof(*b->delivered));
+	memset(b->weight, 0, sizeof(*b->weight) * b->rank.max);
+	b->undelivered = 0;
 
 	b->len.cc	= 0;
 	b->rank.encode	= 0;
@@ -178,35 +476,46 @@ rlnc_block_reset(rlnc_block_t b)
 	return 0;
 }
 
+int
+rlnc_block_resize(rlnc_block_t b, int count)
+{
+	if (count < 1 || count > b->rank.capacity)
+		return -1;
+
+	// Release all slots while the spare slot is still at rank.max.
+	if (rlnc_block_reset(b))
+		return -1;
+
+	b->len.max	= slot_length(count, b->len.max_data, b->alignment,
+					b->gf.exponent, &b->len.coeff);
+	b->rank.max	= count;
+
+	return rlnc_block_reset(b);
+}
+
 void
 rlnc_block_free(rlnc_block_t b)
 {
-	free(b->buffer);
+	release_slots(b);
+	if (b->own_slab)
+		rlnc_slab_free(b->slab);
 	free(b->slot);
 	free(b->pvlist);
+	free(b->decoded);
+	free(b->delivered);
+	free(b->weight);
 	free(b);
 }
 
-ssize_t
-rlnc_block_encode(const rlnc_block_t b, uint8_t *dst, size_t maxlen, int flags)
+static int
+encode_spare(const rlnc_block_t b, int flags)
 {
 	int i, x;
 	uint8_t c;
-	uint8_t *tmp = b->slot[b->rank.max];
-
-	// Check whether or not an encoded frame can be generated, i.e., if flen
-	// is 0, there are currently no frames in this block.
-	if (b->len.cc == 0) {
-		LOG(LOG_ERR, "block empty, unable to retrieve encoded frame");
-		return -1;
-	}
+	uint8_t *tmp;
 
-	// maxlen must be large enough
-	if (maxlen < aligned_length(b->len.cc, b->alignment)) {
-		LOG(LOG_ERR, "buffer too small, have %lu, need %lu",
-			maxlen, aligned_length(b->len.cc, b->alignment));
+	if (NULL == (tmp = get_slot(b, b->rank.max)))
 		return -1;
-	}
 
 	memset(tmp, 0, b->len.max);
 	if ((flags & RLNC_STRUCTURED) && b->encode_start > -1 && b->sent < b->rank.encode) {
@@ -227,7 +536,46 @@ rlnc_block_encode(const rlnc_block_t b, uint8_t *dst, size_t maxlen, int flags)
 		}
 	}
 
-	memcpy(dst, tmp, b->len.cc);
+	return 0;
+}
+
+ssize_t
+rlnc_block_encode(const rlnc_block_t b, uint8_t *dst, size_t maxlen, int flags)
+{
+	// Check whether or not an encoded frame can be generated, i.e., if flen
+	// is 0, there are currently no frames in this block.
+	if (b->len.cc == 0) {
+		LOG(LOG_ERR, "block empty, unable to retrieve encoded frame");
+		return -1;
+	}
+
+	// maxlen must be large enough
+	if (maxlen < aligned_length(b->len.cc, b->alignment)) {
+		LOG(LOG_ERR, "buffer too small, have %lu, need %lu",
+			maxlen, aligned_length(b->len.cc, b->alignment));
+		return -1;
+	}
+
+	if (encode_spare(b, flags))
+		return -1;
+	memcpy(dst, b->slot[b->rank.max], b->len.cc);
+
+	return b->len.cc;
+}
+
+ssize_t
+rlnc_block_encode_view(const rlnc_block_t b, uint8_t **dst, int flags)
+{
+	if (b->len.cc == 0) {
+		LOG(LOG_ERR, "block empty, unable to retrieve encoded frame");
+		return -1;
+	}
+
+	// The encoded frame stays in the spare slot, which is overwritten by
+	// the next call to rlnc_block_encode() or rlnc_block_decode().
+	if (encode_spare(b, flags))
+		return -1;
+	*dst = b->slot[b->rank.max];
 
 	return b->len.cc;
 }
@@ -235,9 +583,9 @@ rlnc_block_encode(const rlnc_block_t b, uint8_t *dst, size_t maxlen, int flags)
 int
 rlnc_block_decode(rlnc_block_t b, const uint8_t *src, size_t len)
 {
-	int i, pv, pvpos;
+	int i, pv, pvpos, w, full;
 	uint8_t inv, c;
-	uint8_t *tmp = b->slot[b->rank.max];
+	uint8_t *tmp;
 
 	if (len > b->len.max)
 		return -1;
@@ -245,6 +593,9 @@ rlnc_block_decode(rlnc_block_t b, const uint8_t *src, size_t len)
 	if (rank(b) == b->rank.max)
 		return 0;
 
+	if (NULL == (tmp = get_slot(b, b->rank.max)))
+		return -1;
+
 	// Copy encoded data into the spare slot
 	memset(tmp, 0, b->len.max);
 	memcpy(tmp, src, len);
@@ -272,6 +623,11 @@ rlnc_block_decode(rlnc_block_t b, const uint8_t *src, size_t len)
 	inv = b->gf.inv(pv);
 	b->gf.mulrc(tmp, inv, b->len.cc);
 
+	// At full rank, all rows are unit vectors. Before, only rows reduced
+	// by a unit vector can become one, see reduce_weight().
+	full = (rank(b) + 1 == b->rank.max);
+	w = full ? 0 : row_weight(b, b->rank.max, pvpos);
+
 	// Backward substitution
 	for (i=0; i<rank(b); i++) {
 		c = get_coefficient(b, b->pvlist[i], pvpos);
@@ -279,17 +635,29 @@ rlnc_block_decode(rlnc_block_t b, const uint8_t *src, size_t len)
 			continue;
 
 		b->gf.maddrc(b->slot[b->pvlist[i]], tmp, c, b->len.cc);
+		if (!full)
+			reduce_weight(b, b->pvlist[i], w);
 	}
 
 	// Insert new pivot position into pivo list and increment rank
 	b->pvlist[rank(b)] = pvpos;
 	b->rank.decode++;
 
-	// Swap pointers between spare slot und slot t pivot position
+	// Swap pointers between spare slot und slot t pivot position. The row
+	// had no pivot before, so the spare slot becomes the zero slot and is
+	// taken from the slab again when it is needed.
 	tmp = b->slot[pvpos];
 	b->slot[pvpos] = b->slot[b->rank.max];
 	b->slot[b->rank.max] = tmp;
 
+	b->weight[pvpos] = w;
+	if (full) {
+		for (i=0; i<b->rank.max; i++)
+			set_decoded(b, i);
+	} else if (!w) {
+		set_decoded(b, pvpos);
+	}
+
 	return 0;
 }
 
@@ -316,6 +684,9 @@ rlnc_block_add(rlnc_block_t b, int pv, const uint8_t *data, size_t len)
 		}
 	}
 
+	if (NULL == get_slot(b, pv))
+		return -1;
+
 	b->pvlist[rank(b)] = pv;
 
 	s = (void *)(b->slot[pv] + b->len.coeff);
@@ -323,6 +694,9 @@ rlnc_block_add(rlnc_block_t b, int pv, const uint8_t *data, size_t len)
 	memcpy(s->data, data, len);
 	s->len = len;
 	set_coefficient(b, pv, pv, 1);
+	set_bit(b->decoded, pv);
+	set_bit(b->delivered, pv);
+	b->weight[pv] = 0;
 
 	b->len.cc = max_t(size_t, b->len.cc, len+b->len.coeff+sizeof(*s));
 	b->rank.encode++;
@@ -340,7 +714,8 @@ rlnc_block_get(rlnc_block_t b, int pv, uint8_t *dst, size_t maxlen)
 	size_t len;
 
 	// check if frame in row(pv) is decoded
-	if (!is_decoded(b, pv))
+	resolve_weight(b, pv);
+	if (!test_bit(b->decoded, pv))
 		return 0;
 
 	len = b->len.cc - b->len.coeff - sizeof(*s);
@@ -352,10 +727,62 @@ rlnc_block_get(rlnc_block_t b, int pv, uint8_t *dst, size_t maxlen)
 
 	s = (void *)(b->slot[pv] + b->len.coeff);
 	memcpy(dst, s->data, s->len);
+	set_delivered(b, pv);
 
 	return s->len;
 }
 
+ssize_t
+rlnc_block_get_view(rlnc_block_t b, int pv, const uint8_t **dst)
+{
+	struct slot *s;
+
+	resolve_weight(b, pv);
+	if (!test_bit(b->decoded, pv))
+		return 0;
+
+	// A decoded row is not touched by further decoding, so the view stays
+	// valid until the block is reset or freed.
+	s = (void *)(b->slot[pv] + b->len.coeff);
+	*dst = s->data;
+	set_delivered(b, pv);
+
+	return s->len;
+}
+
+int
+rlnc_block_is_decoded(const rlnc_block_t b, int pv)
+{
+	resolve_weight(b, pv);
+	return test_bit(b->decoded, pv);
+}
+
+int
+rlnc_block_undelivered(const rlnc_block_t b)
+{
+	resolve_weights(b);
+	return b->undelivered;
+}
+
+int
+rlnc_block_get_decoded(const rlnc_block_t b, int *pvs, int max)
+{
+	int i, n = 0;
+	uint64_t w;
+
+	resolve_weights(b);
+
+	for (i=0; i<BITMAP_WORDS(b->rank.max) && n<max; i++) {
+		w = b->decoded[i] & ~b->delivered[i];
+		while (w && n<max) {
+			pvs[n++] = i*64 + __builtin_ctzll(w);
+			w &= w - 1;
+		}
+	}
+
+	return n;
+}
+
 int
 rlnc_block_rank_encode(const rlnc_block_t b)
 {
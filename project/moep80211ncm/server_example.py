@@ -4,9 +4,24 @@ import struct
 HOST = "localhost"
 PORT = 10123
 # define your expected format string and expected size
-expected_format = "32siffffffffffiiffiiiiiiiiiiiiiiiiiii"
+# The ncm sends batches: a length prefix, the number of records and the number
+# of samples it dropped, followed by one aggregated record per session.
+batch_header_format = "=III"
+batch_header_size = struct.calcsize(batch_header_format)
+expected_format = "=32siffffffffffiiffiiiiiiiiiiiiiiiiiiii8sifffffff"
 expected_size = struct.calcsize(expected_format)
 
+
+def recv_exact(connection, size):
+    data = b""
+    while len(data) < size:
+        chunk = connection.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
 server_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
 server_socket.bind(("localhost", PORT))
 server_socket.listen(1)
@@ -17,14 +32,24 @@ while True:
     print(f"Connected by: {address}")
 
     while True:
-        data = connection.recv(1024)
+        header = recv_exact(connection, batch_header_size)
+        if not header:
+            break
+
+        length, count, dropped = struct.unpack(batch_header_format, header)
+        data = recv_exact(connection, length - (batch_header_size - 4))
         if not data:
             break
 
-        if len(data) != expected_size:
-            print(f"Error: Expected {expected_size} bytes but got {len(data)} bytes")
-        else:
-            session_info = struct.unpack(expected_format, data)
+        if dropped:
+            print(f"ncm dropped {dropped} samples")
+
+        if len(data) != count * expected_size:
+            print(f"Error: Expected {count * expected_size} bytes but got {len(data)} bytes")
+            continue
+
+        for i in range(count):
+            session_info = struct.unpack_from(expected_format, data, i * expected_size)
             session_dict = {
                 # From session info struct
                 "session": session_info[0],
@@ -64,6 +89,19 @@ while True:
                 # Remote address + Master or Slave
                 "remoteAddress": session_info[33],
                 "masterOrSlave": session_info[34],  # // -1 neither, 0 slave, 1 master
+                # Number of received frames aggregated into this record
+                "samples": session_info[35],
+                # Full address of the remote node
+                "remoteHwaddr": session_info[36][:6],
+                # Rolling features of the link, computed by the NCM
+                "rssi": session_info[37],
+                "rssi_avg": session_info[38],
+                "rssi_std": session_info[39],
+                "rssi_ewma": session_info[40],
+                "prr": session_info[41],
+                "retries_avg": session_info[42],
+                "retries_std": session_info[43],
+                "retries_ewma": session_info[44],
             }
 
             # Print the decoded data
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include <moep/modules/ieee8023.h>
+
+#include <moepcommon/util.h>
+
+#include "classify.h"
+
+#define CLASSIFY_MAX_RULES	16
+#define CLASSIFY_DSCP_REALTIME	40	// CS5
+
+enum rule_type {
+	RULE_DSCP,
+	RULE_PROTO,
+	RULE_PORT,
+};
+
+struct rule {
+	enum rule_type type;
+	int value;
+};
+
+struct flow {
+	int dscp;
+	int proto;
+	int sport;
+	int dport;
+};
+
+static struct rule rules[CLASSIFY_MAX_RULES];
+static int rule_count = 0;
+
+int
+classify_add_rule(const char *rule)
+{
+	static const struct {
+		const char *name;
+		enum rule_type type;
+		int max;
+	} types[] = {
+		{"dscp=",	RULE_DSCP,	63},
+		{"proto=",	RULE_PROTO,	255},
+		{"port=",	RULE_PORT,	UINT16_MAX},
+	};
+	char *endptr;
+	long value;
+	size_t i, len;
+
+	if (rule_count == CLASSIFY_MAX_RULES) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	for (i=0; i<sizeof(types)/sizeof(types[0]); i++) {
+		len = strlen(types[i].name);
+		if (strncmp(rule, types[i].name, len))
+			continue;
+
+		value = strtol(rule + len, &endptr, 0);
+		if (endptr == rule + len || *endptr || value < 0 ||
+							value > types[i].max)
+			break;
+
+		rules[rule_count].type = types[i].type;
+		rules[rule_count].value = value;
+		rule_count++;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static int
+parse_ports(struct flow *flow, const u8 *l4, size_t len)
+{
+	switch (flow->proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP:
+		if (len < 4)
+			return -1;
+		flow->sport = (l4[0] << 8) | l4[1];
+		flow->dport = (l4[2] << 8) | l4[3];
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* Only the fixed IP headers are parsed. IPv6 extension headers are not
+ * skipped, so ports of such packets are never matched. */
+static int
+parse_flow(struct flow *flow, u16 type, const u8 *p, size_t len)
+{
+	size_t hlen;
+
+	flow->dscp = -1;
+	flow->proto = -1;
+	flow->sport = -1;
+	flow->dport = -1;
+
+	switch (type) {
+	case ETHERTYPE_IP:
+		if (len < 20)
+			return -1;
+		hlen = (p[0] & 0x0f) * 4;
+		if (hlen < 20 || hlen > len)
+			return -1;
+		flow->dscp = p[1] >> 2;
+		flow->proto = p[9];
+		// only the first fragment carries the ports
+		if ((((p[6] << 8) | p[7]) & 0x1fff) != 0)
+			return 0;
+		return parse_ports(flow, p + hlen, len - hlen);
+	case ETHERTYPE_IPV6:
+		if (len < 40)
+			return -1;
+		flow->dscp = (((p[0] & 0x0f) << 4) | (p[1] >> 4)) >> 2;
+		flow->proto = p[6];
+		return parse_ports(flow, p + 40, len - 40);
+	default:
+		return -1;
+	}
+}
+
+static int
+rule_match(const struct rule *rule, const struct flow *flow)
+{
+	switch (rule->type) {
+	case RULE_DSCP:
+		return flow->dscp == rule->value;
+	case RULE_PROTO:
+		return flow->proto == rule->value;
+	case RULE_PORT:
+		return flow->sport == rule->value ||
+					flow->dport == rule->value;
+	}
+
+	return 0;
+}
+
+int
+classify_frame(moep_frame_t frame)
+{
+	struct ether_header *ether;
+	struct flow flow;
+	const u8 *payload;
+	size_t len;
+	int i;
+
+	if (!(ether = moep_frame_ieee8023_hdr(frame)))
+		return NCM_TC_BULK;
+
+	payload = moep_frame_get_payload(frame, &len);
+
+	if (parse_flow(&flow, be16toh(ether->ether_type), payload, len))
+		return NCM_TC_BULK;
+
+	if (flow.dscp >= CLASSIFY_DSCP_REALTIME)
+		return NCM_TC_REALTIME;
+
+	for (i=0; i<rule_count; i++) {
+		if (rule_match(&rules[i], &flow))
+			return NCM_TC_REALTIME;
+	}
+
+	return NCM_TC_BULK;
+}
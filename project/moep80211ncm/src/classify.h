@@ -0,0 +1,26 @@
+#ifndef __CLASSIFY_H
+#define __CLASSIFY_H
+
+#include <moep/types.h>
+#include <moep/frame.h>
+
+/* Traffic classes. Every class has a session of its own per pair of nodes, so
+ * bulk transfers do not delay latency-sensitive packets of the same pair. */
+enum NCM_TC {
+	NCM_TC_BULK	= 0,
+	NCM_TC_REALTIME	= 1,
+	NCM_TC_COUNT,
+};
+
+/* Adds a rule that maps matching packets to the realtime class. A rule has the
+ * form "dscp=N", "proto=N" or "port=N", where a port matches both the source
+ * and the destination port of TCP, UDP and SCTP packets. Returns -1 and sets
+ * errno to EINVAL if the rule cannot be parsed. */
+int classify_add_rule(const char *rule);
+
+/* Returns the traffic class of an IEEE 802.3 frame received on the tap device.
+ * Packets marked with DSCP CS5 or higher, which includes EF, are realtime
+ * traffic even without any rules. Everything else is bulk traffic. */
+int classify_frame(moep_frame_t frame);
+
+#endif //__CLASSIFY_H
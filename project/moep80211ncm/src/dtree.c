@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <moep/system.h>
+#include <moep/types.h>
+
+#include "dtree.h"
+
+/*
+ * The tree is kept as flat arrays indexed by node, so an evaluation touches a
+ * handful of cache lines and does not chase pointers. Children always have a
+ * larger index than their parent, which the loader checks, hence evaluation
+ * terminates on any accepted file.
+ */
+static struct
+{
+    int nodes;
+    s8 *feature;     // DTREE_* input, -1 for leaves
+    float *threshold;
+    u16 (*child)[2]; // left (<= threshold) and right child
+    s8 *class;       // enum lq_class of leaves
+} tree;
+
+static void dtree_free()
+{
+    free(tree.feature);
+    free(tree.threshold);
+    free(tree.child);
+    free(tree.class);
+    memset(&tree, 0, sizeof(tree));
+}
+
+int dtree_load(const char *path)
+{
+    int nodes, features, feature, left, right, class, i;
+    float threshold;
+    FILE *file;
+
+    if (!(file = fopen(path, "r")))
+        return -1;
+
+    dtree_free();
+
+    if (2 != fscanf(file, "dtree %d %d", &nodes, &features) || nodes < 1 ||
+        nodes > DTREE_MAX_NODES || features != DTREE_FEATURES)
+    {
+        LOG(LOG_ERR, "dtree_load: %s: invalid header", path);
+        goto fail;
+    }
+
+    tree.feature = calloc(nodes, sizeof(*tree.feature));
+    tree.threshold = calloc(nodes, sizeof(*tree.threshold));
+    tree.child = calloc(nodes, sizeof(*tree.child));
+    tree.class = calloc(nodes, sizeof(*tree.class));
+    if (!tree.feature || !tree.threshold || !tree.child || !tree.class)
+        DIE("calloc() failed: %s", strerror(errno));
+
+    for (i = 0; i < nodes; i++)
+    {
+        if (5 != fscanf(file, "%d %f %d %d %d", &feature, &threshold, &left,
+                        &right, &class))
+        {
+            LOG(LOG_ERR, "dtree_load: %s: node %d is missing", path, i);
+            goto fail;
+        }
+
+        if (feature >= DTREE_FEATURES || class < LQ_UNKNOWN ||
+            class > LQ_GOOD || (feature >= 0 &&
+            (left <= i || left >= nodes || right <= i || right >= nodes)))
+        {
+            LOG(LOG_ERR, "dtree_load: %s: node %d is invalid", path, i);
+            goto fail;
+        }
+
+        if (feature < 0 && class == LQ_UNKNOWN)
+        {
+            LOG(LOG_ERR, "dtree_load: %s: leaf %d has no class", path, i);
+            goto fail;
+        }
+
+        tree.feature[i] = feature < 0 ? -1 : feature;
+        tree.threshold[i] = threshold;
+        tree.child[i][0] = feature < 0 ? 0 : left;
+        tree.child[i][1] = feature < 0 ? 0 : right;
+        tree.class[i] = class;
+    }
+
+    fclose(file);
+    tree.nodes = nodes;
+
+    LOG(LOG_INFO, "loaded decision tree with %d nodes from %s", nodes, path);
+    return 0;
+
+fail:
+    fclose(file);
+    dtree_free();
+    errno = EINVAL;
+    return -1;
+}
+
+int dtree_loaded()
+{
+    return tree.nodes > 0;
+}
+
+enum lq_class dtree_predict(const float *x)
+{
+    int i = 0;
+
+    if (!tree.nodes)
+        return LQ_UNKNOWN;
+
+    while (tree.feature[i] >= 0)
+        i = tree.child[i][x[tree.feature[i]] > tree.threshold[i]];
+
+    return tree.class[i];
+}
+
+int dtree_rssi(s8 signal)
+{
+    return signal < DTREE_RSSI_MIN ? 0 : signal - DTREE_RSSI_MIN;
+}
+
+const char *dtree_class_name(enum lq_class class)
+{
+    switch (class)
+    {
+    case LQ_BAD:
+        return "bad";
+    case LQ_INTERM:
+        return "interm.";
+    case LQ_GOOD:
+        return "good";
+    default:
+        return "unknown";
+    }
+}
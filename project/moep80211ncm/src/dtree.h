@@ -0,0 +1,47 @@
+#ifndef _DTREE_H_
+#define _DTREE_H_
+
+#include <moep/types.h>
+
+#include "global.h"
+
+// Link classes predicted by the tree, same encoding as the dashboard
+enum lq_class
+{
+    LQ_UNKNOWN = -1,
+    LQ_BAD = 0,
+    LQ_INTERM = 1,
+    LQ_GOOD = 2,
+};
+
+// Model inputs, in the order used for training
+enum dtree_feature
+{
+    DTREE_RSSI = 0,
+    DTREE_RSSI_AVG,
+    DTREE_FEATURES,
+};
+
+/*
+ * Loads a tree exported by the training pipeline. The file starts with a line
+ * "dtree <nodes> <features>" followed by one line per node in preorder:
+ * "<feature> <threshold> <left> <right> <class>", where leaves have feature -1
+ * and inputs <= threshold descend to the left child. Thresholds are given in
+ * raw feature units, i.e. the scaler of the training pipeline is folded in.
+ */
+int dtree_load(const char *path);
+
+int dtree_loaded();
+
+// Evaluates the tree for one feature vector, returns LQ_UNKNOWN without a tree
+enum lq_class dtree_predict(const float *x);
+
+/*
+ * Converts a signal (dBm) to the RSSI scale of the training data. Signals below
+ * the floor are invalid and masked as 0, like the training data does.
+ */
+int dtree_rssi(s8 signal);
+
+const char *dtree_class_name(enum lq_class class);
+
+#endif
@@ -12,6 +12,7 @@ enum headertypes {
 	NCM_HDR_CODED,
 	NCM_HDR_BCAST,
 	NCM_HDR_BEACON,
+	NCM_HDR_PROBE,
 	NCM_HDR_INVALID	= MOEP_HDR_COUNT-1
 };
 
@@ -19,6 +20,7 @@ enum frametypes {
 	NCM_DATA = 0,
 	NCM_CODED,
 	NCM_BEACON,
+	NCM_PROBE,
 	NCM_INVALID,
 };
 
@@ -26,12 +28,42 @@ struct ncm_hdr_beacon {
 	struct moep_hdr_ext hdr;
 } __attribute__((packed));
 
+/*
+ * Packet control header in front of every frame in a coded payload. It extends
+ * moep_hdr_pctrl by the time the frame entered the TAP device of the sender.
+ * Receivers find the frame hdr.len bytes after the header start.
+ */
+struct ncm_hdr_pctrl {
+	struct moep_hdr_pctrl pctrl;
+	u64 ts;		// CLOCK_REALTIME in ns, little endian
+} __attribute__((packed));
+
 struct ncm_beacon_payload {
 	u8 mac[IEEE80211_ALEN];
 	u16 p;
 	u16 q;
 } __attribute__((packed));
 
+enum probetypes {
+	PROBE_REQUEST = 0,
+	PROBE_REPLY,
+};
+
+/**
+  Probe frames measure a link at startup, see probe.h. Every request is
+  answered by a reply that echoes its seq, mcs and ts fields.
+  */
+struct ncm_hdr_probe {
+	struct moep_hdr_ext hdr;
+	u8 type;
+	u8 burst;	// replies to older bursts are ignored
+	u16 seq;	// request number within the burst
+	u8 mcs;		// MCS the request was sent at
+	s8 signal;	// reply: signal of the request at the peer, 0 if unknown
+	u16 rcvd;	// reply: requests of this burst received by the peer
+	u64 ts;		// request: send time in ns
+} __attribute__((packed));
+
 /**
   Bware: the coding header is a variable-length header, depending on the galois
   field and generation size.
@@ -41,6 +73,7 @@ struct ncm_hdr_coded {
 	u8 sid[2*IEEE80211_ALEN];
 	u8 gf:2;
 	u8 window_size:6;
+	u8 tc;
 	u16 seq;
 	u16 lseq;
 	struct generation_feedback fb[0];
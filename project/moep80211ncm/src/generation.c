@@ -18,13 +18,17 @@
 #include "session.h"
 #include "ncm.h"
 #include "qdelay.h"
+#include "trace.h"
 
 
 static int cb_rtx(timeout_t t, u32 overrun, void *data);
 static int cb_ack(timeout_t t, u32 overrun, void *data);
+static int cb_flush(timeout_t t, u32 overrun, void *data);
 extern int rad_tx_event;
 extern int sfd;
 
+static rlnc_slab_t slab = NULL;
+
 struct pvpos {
 	int cur;
 	int min;
@@ -53,10 +57,29 @@ struct generation {
 
 	struct pvpos		encoder;
 	struct pvpos		decoder;
+	int			returned;	// decoded packets returned
 
 	int			ack_block;
 	int			missing;
 
+	// Set once the packet count of this generation is agreed on. Only the
+	// master chooses the size and layout, see generation_adopt().
+	int			sized;
+	enum GENERATION_LAYOUT	layout;
+	int			rq;	// pivots requested from the remote node
+	struct timespec		started;	// first packet added or received
+	struct timespec		rx_started;	// first packet received
+	int			ranked;		// full rank committed
+
+	// RTT probe: the time the first transmission of a source packet raised
+	// the source dimension to dim, until feedback reports that dimension as
+	// received. Cleared by redundant frames and retransmissions, after which
+	// no new probe is started before dim is acknowledged (Karn's algorithm).
+	struct {
+		struct timespec	sent;
+		int		dim;
+	} probe;
+
 	session_t		session;
 	struct list_head	*gl;
 
@@ -66,6 +89,7 @@ struct generation {
 	struct {
 		timeout_t rtx;
 		timeout_t ack;
+		timeout_t flush;
 	} task;
 };
 
@@ -114,12 +138,17 @@ rtx_reset(generation_t g)
 static struct itimerspec *
 rtx_timeout(const generation_t g)
 {
-	double t;
+	double t, rto;
+
+	// Without RTT samples, rto is GENERATION_RTX_MIN_TIMEOUT.
+	rto = session_rto(g->session);
 
 	if (rtx(g) > -1) {
-		t = (double)GENERATION_RTX_MIN_TIMEOUT;
+		t = rto;
 		t += generation_index(g)+rtx(g)+1.0;
-		t = min(t, (double)GENERATION_RTX_MAX_TIMEOUT);
+		t = min(t, rto + (double)(GENERATION_RTX_MAX_TIMEOUT -
+						GENERATION_RTX_MIN_TIMEOUT));
+		t *= session_rtx_pace(g->session);
 	}
 	else {
 		t = 0;
@@ -130,6 +159,99 @@ rtx_timeout(const generation_t g)
 	return timeout_msec((int)t, 0);
 }
 
+/* Acknowledgements are delayed by a fraction of the smoothed RTT to give data
+ * frames a chance to carry the feedback, and repeated once per RTO. */
+static struct itimerspec *
+ack_timeout(const generation_t g)
+{
+	double delay, interval;
+
+	delay = max(session_srtt(g->session) / 8.0,
+				(double)GENERATION_ACK_MIN_TIMEOUT);
+	interval = max(session_rto(g->session),
+				(double)GENERATION_ACK_INTERVAL);
+
+	return timeout_usec((s64)(delay*1000), (s64)(interval*1000));
+}
+
+static void
+probe_start(generation_t g)
+{
+	struct generation_flowstate *local = g->state.local;
+
+	if (g->gentype == FORWARD || timespecisset(&g->probe.sent))
+		return;
+	if (local->ddim < g->probe.dim || local->ddim >= local->sdim)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &g->probe.sent);
+	g->probe.dim = local->sdim;
+}
+
+static void
+probe_finish(generation_t g)
+{
+	struct timespec now;
+
+	if (!timespecisset(&g->probe.sent))
+		return;
+	if (g->state.local->ddim < g->probe.dim)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &g->probe.sent);
+	timespecclear(&g->probe.sent);
+
+	session_commit_rtt(g->session, (double)now.tv_sec*1000.0 +
+						(double)now.tv_nsec/1000000.0);
+}
+
+/* Returns 1 once size and layout of g are known, i.e. g may be used for coding.
+ */
+static inline int
+generation_agreed(const generation_t g)
+{
+	return (g->sized && g->layout != LAYOUT_NONE);
+}
+
+/* Returns 1 if g is a slave generation that waits for the master to announce
+ * its size or layout. */
+static inline int
+generation_waits(const generation_t g)
+{
+	return (g->gentype == SLAVE && !generation_agreed(g));
+}
+
+/* Returns 1 if the local endpoint cannot add source packets to g before the
+ * master has decided its size and layout, or because the remote endpoint owns
+ * all pivots of g. */
+static int
+generation_needs_pivots(const generation_t g)
+{
+	if (g->gentype == FORWARD)
+		return 0;
+	if (!generation_agreed(g))
+		return 1;
+
+	switch (g->layout) {
+	case LAYOUT_UNI_MS:
+		return (g->gentype != MASTER);
+	case LAYOUT_UNI_SM:
+		return (g->gentype != SLAVE);
+	default:
+		return 0;
+	}
+}
+
+/* Returns 1 if g waits for an answer of the remote endpoint, i.e. for granted
+ * pivots or for its size and layout. The acks of such generations repeat once
+ * per RTO until the answer arrives. */
+static int
+generation_unanswered(const generation_t g)
+{
+	return (generation_waits(g) || (g->rq && generation_needs_pivots(g)));
+}
+
 inline int
 generation_window_size(const struct list_head *gl)
 {
@@ -159,7 +281,13 @@ generation_feedback(generation_t g, struct generation_feedback *fb,
 		fb->sdim.ms	= cur->state.fms.sdim;
 		fb->ddim.sm	= cur->state.fsm.ddim;
 		fb->sdim.sm	= cur->state.fsm.sdim;
-		timeout_settime(cur->task.ack, 0, NULL);
+		fb->gensize	= cur->sized ? cur->packet_count : 0;
+		fb->lock.layout	= cur->layout;
+		fb->lock.rq	= cur->rq && generation_needs_pivots(cur);
+		fb->lock.ask	= generation_waits(cur);
+		// Acks keep asking until the remote answered, see cb_ack()
+		if (!generation_unanswered(cur))
+			timeout_settime(cur->task.ack, 0, NULL);
 		fb++;
 	}
 
@@ -171,6 +299,9 @@ generation_lock(generation_t g)
 {
 	g->state.local->lock = 1;
 	g->encoder.max = g->encoder.cur - 1;
+
+	TRACE(generation_lock, g->session, g->seq,
+	      rlnc_block_rank_encode(g->rb));
 }
 
 static inline void
@@ -198,6 +329,12 @@ generation_update_locks(generation_t g, const struct generation_feedback *fb)
 	// detect when all decoded packets have been returned, we have to update
 	// the decoder.max pivot.
 	if (g->state.remote->lock) {
+		// An empty remote flow was locked on request, see
+		// generation_grant(). Report our lock back without waiting for
+		// data.
+		if (!g->state.local->lock && !g->state.remote->sdim)
+			timeout_settime(g->task.ack, TIMEOUT_FLAG_INACTIVE,
+							ack_timeout(g));
 		generation_lock(g);
 		g->decoder.max = g->decoder.min + g->state.remote->sdim - 1;
 	}
@@ -334,7 +471,7 @@ generation_is_returned(const generation_t g)
 	if (g->gentype == FORWARD)
 		return 1;
 
-	if (g->state.remote->sdim == g->decoder.cur - g->decoder.min)
+	if (g->state.remote->sdim == g->returned)
 		return 1;
 
 	return 0;
@@ -343,23 +480,40 @@ generation_is_returned(const generation_t g)
 static void
 init_pvpos(generation_t g)
 {
+	int split;
+
+	g->returned = 0;
+
+	// The master owns pivots [0,split), the slave [split,packet_count).
+	switch (g->layout) {
+	case LAYOUT_UNI_MS:
+		split = g->packet_count;
+		break;
+	case LAYOUT_UNI_SM:
+		split = 0;
+		break;
+	default:
+		split = g->packet_count / 2;
+		break;
+	}
+
 	switch (g->gentype) {
 	case MASTER:
 		g->encoder.min	= 0;
-		g->encoder.max	= g->packet_count / 2 - 1;
+		g->encoder.max	= split - 1;
 		g->encoder.cur	= g->encoder.min;
-		g->decoder.min	= g->packet_count / 2;
+		g->decoder.min	= split;
 		g->decoder.max	= g->packet_count - 1;
 		g->decoder.cur	= g->decoder.min;
 		g->state.local	= &g->state.fms;
 		g->state.remote	= &g->state.fsm;
 		break;
 	case SLAVE:
-		g->encoder.min 	= g->packet_count / 2;
+		g->encoder.min 	= split;
 		g->encoder.max 	= g->packet_count - 1;
 		g->encoder.cur	= g->encoder.min;
 		g->decoder.min 	= 0;
-		g->decoder.max 	= g->packet_count / 2 - 1;
+		g->decoder.max 	= split - 1;
 		g->decoder.cur	= g->decoder.min;
 		g->state.local	= &g->state.fsm;
 		g->state.remote	= &g->state.fms;
@@ -375,6 +529,18 @@ init_pvpos(generation_t g)
 	}
 }
 
+int
+generation_slab_init(size_t packet_size, int hugepages)
+{
+	slab = rlnc_slab_init(GENERATION_MAX_SIZE, packet_size,
+				MEMORY_ALIGNMENT, MOEPGF256,
+				hugepages ? RLNC_SLAB_HUGEPAGES : 0);
+	if (!slab)
+		return -1;
+
+	return 0;
+}
+
 generation_t
 generation_init(session_t s, struct list_head *gl,
 		enum GENERATION_TYPE gentype, enum MOEPGF_TYPE gftype,
@@ -387,8 +553,12 @@ generation_init(session_t s, struct list_head *gl,
 
 	memset(g, 0, sizeof(*g));
 
-	g->rb = rlnc_block_init(packet_count, packet_size, MEMORY_ALIGNMENT,
-								gftype);
+	if (slab)
+		g->rb = rlnc_block_init_slab(packet_count, packet_size,
+					MEMORY_ALIGNMENT, gftype, slab);
+	else
+		g->rb = rlnc_block_init(packet_count, packet_size,
+					MEMORY_ALIGNMENT, gftype);
 	if (!g->rb)
 		DIE("rlnc_block_init() failed");
 
@@ -399,6 +569,8 @@ generation_init(session_t s, struct list_head *gl,
 	g->gentype	= gentype;
 	g->session	= s;
 	g->gl		= gl;
+	g->sized	= 1;
+	g->layout	= session_layout(s);
 
 	list_add_tail(&g->list, g->gl);
 
@@ -408,6 +580,8 @@ generation_init(session_t s, struct list_head *gl,
 		DIE("timeout_create() failed: %s", strerror(errno));
 	if (0 > timeout_create(CLOCK_MONOTONIC, &g->task.ack, cb_ack,g))
 		DIE("timeout_create() failed: %s", strerror(errno));
+	if (0 > timeout_create(CLOCK_MONOTONIC, &g->task.flush, cb_flush,g))
+		DIE("timeout_create() failed: %s", strerror(errno));
 
 	return g;
 }
@@ -417,6 +591,7 @@ generation_destroy(generation_t g)
 {
 	timeout_delete(g->task.rtx);
 	timeout_delete(g->task.ack);
+	timeout_delete(g->task.flush);
 	rlnc_block_free(g->rb);
 	free(g);
 }
@@ -432,6 +607,60 @@ generation_list_destroy(struct list_head *gl)
 	}
 }
 
+static int
+generation_resize(generation_t g, int packet_count)
+{
+	if (packet_count < 2 || packet_count % 2)
+		return EGENINVAL;
+
+	if (packet_count != g->packet_count) {
+		if (rlnc_block_resize(g->rb, packet_count))
+			return EGENFAIL;
+		g->packet_count = packet_count;
+	}
+
+	init_pvpos(g);
+
+	return 0;
+}
+
+static void
+generation_commit_latency(generation_t g)
+{
+	struct timespec now;
+
+	if (!timespecisset(&g->started))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &g->started);
+	timespecclear(&g->started);
+
+	session_commit_latency(g->session, (double)now.tv_sec*1000.0 +
+						(double)now.tv_nsec/1000000.0);
+}
+
+/*
+ * Commits the time from the first received packet until the remote flow was
+ * decoded, once per generation.
+ */
+static void
+generation_commit_rank(generation_t g)
+{
+	struct timespec now;
+
+	if (g->ranked || !timespecisset(&g->rx_started) ||
+	    !g->state.remote->sdim)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &g->rx_started);
+	g->ranked = 1;
+
+	session_commit_rank_latency(g->session, (double)now.tv_sec*1000.0 +
+						(double)now.tv_nsec/1000000.0);
+}
+
 int
 generation_reset(generation_t g, uint16_t seq)
 {
@@ -451,8 +680,12 @@ generation_reset(generation_t g, uint16_t seq)
 
 	session_commit_state(g->session, &g->state);
 
+	TRACE(generation_reset, g->session, g->seq, seq);
+
 	g->seq = seq;
 	rtx_reset(g);
+	timespecclear(&g->probe.sent);
+	g->probe.dim = 0;
 
 	local = g->state.local;
 	remote = g->state.remote;
@@ -460,10 +693,36 @@ generation_reset(generation_t g, uint16_t seq)
 	g->state.local = local;
 	g->state.remote = remote;
 
-	init_pvpos(g);
+	generation_commit_latency(g);
+	timespecclear(&g->rx_started);
+	g->ranked = 0;
+
+	// In unidirectional sessions, the master picks the layout of every new
+	// generation. All other nodes learn it from its feedback.
+	g->rq = 0;
+	if (g->gentype == MASTER || !session_unidirectional(g->session))
+		g->layout = session_layout(g->session);
+	else
+		g->layout = LAYOUT_NONE;
+
+	// With adaptive generation sizes, the master picks the size of every
+	// new generation. All other nodes learn it from its feedback.
+	if (session_adaptive(g->session) && g->gentype == MASTER)
+		generation_resize(g, session_gensize(g->session));
+	else
+		init_pvpos(g);
+
+	if (session_adaptive(g->session) && g->gentype != MASTER)
+		g->sized = 0;
 
 	timeout_settime(g->task.rtx, 0, NULL);
 	timeout_settime(g->task.ack, 0, NULL);
+	timeout_settime(g->task.flush, 0, NULL);
+
+	// Ask right away instead of waiting for feedback of the master, which
+	// may have nothing to send. Until the answer, the TAP stays blocked.
+	if (generation_waits(g))
+		timeout_settime(g->task.ack, 0, ack_timeout(g));
 
 	return 0;
 }
@@ -495,10 +754,18 @@ encoder_add(generation_t g, const uint8_t *src, size_t len)
 	g->encoder.cur++;
 	g->state.local->sdim++;
 
+	TRACE(encode, g->session, g->seq, rlnc_block_rank_encode(g->rb), len);
+
+	if (!timespecisset(&g->started))
+		clock_gettime(CLOCK_MONOTONIC, &g->started);
+
 	/* encoder.cur points to the next available slot, i.e., the generation
 	   must be locked when it points to an invalid position */
 	if (g->encoder.cur > g->encoder.max)
 		generation_lock(g);
+	else if (g->state.local->sdim == 1 && session_flush_timeout(g->session))
+		timeout_settime(g->task.flush, 0,
+			timeout_msec(session_flush_timeout(g->session), 0));
 
 	rtx_dec(g);
 
@@ -507,23 +774,51 @@ encoder_add(generation_t g, const uint8_t *src, size_t len)
 	return 0;
 }
 
+// In out-of-order mode, any decoded packet that has not been returned yet is
+// returned, lowest pivot first. The rlnc block keeps track of the returned
+// pivots, so every packet is still returned exactly once.
+static int
+decoder_next_decoded(generation_t g)
+{
+	int pvs[8];
+	int i, n;
+
+	n = rlnc_block_get_decoded(g->rb, pvs, sizeof(pvs)/sizeof(pvs[0]));
+	for (i=0; i<n; i++) {
+		if (pvs[i] >= g->decoder.min && pvs[i] <= g->decoder.max)
+			return pvs[i];
+	}
+
+	return -1;
+}
+
 static ssize_t
-decoder_get(generation_t g, uint8_t *dst, size_t maxlen)
+decoder_get_view(generation_t g, const uint8_t **data)
 {
-	int ret;
+	ssize_t ret;
+	int pv, ooo;
 
-	if (g->decoder.cur > g->decoder.max)
-		return EGENNOMORE;
+	if ((ooo = session_out_of_order(g->session))) {
+		if (0 > (pv = decoder_next_decoded(g)))
+			return EGENNOMORE;
+	} else {
+		if (g->decoder.cur > g->decoder.max)
+			return EGENNOMORE;
+		pv = g->decoder.cur;
+	}
 
-	ret = rlnc_block_get(g->rb, g->decoder.cur, dst, maxlen);
+	ret = rlnc_block_get_view(g->rb, pv, data);
 
 	if (0 > ret) {
-		LOG(LOG_ERR, "rlnc_block_get() failed");
+		LOG(LOG_ERR, "rlnc_block_get_view() failed");
 		return EGENFAIL;
 	}
 
-	if (ret > 0)
-		g->decoder.cur++;
+	if (ret > 0) {
+		if (!ooo)
+			g->decoder.cur++;
+		g->returned++;
+	}
 
 	return ret;
 }
@@ -547,6 +842,25 @@ generation_encoder_get(const generation_t g, void *buffer, size_t maxlen)
 	return ret;
 }
 
+ssize_t
+generation_encoder_get_view(const generation_t g, void **payload)
+{
+	ssize_t ret;
+	int flags = RLNC_STRUCTURED;
+
+	if (g->gentype == FORWARD)
+		flags &= ~RLNC_STRUCTURED;
+
+	ret = rlnc_block_encode_view(g->rb, (uint8_t **)payload, flags);
+
+	if (0 > ret) {
+		LOG(LOG_ERR, "rlnc_block_encode_view() failed");
+		return EGENFAIL;
+	}
+
+	return ret;
+}
+
 static int
 decoder_add(generation_t g, const void *payload, size_t len)
 {
@@ -555,7 +869,14 @@ decoder_add(generation_t g, const void *payload, size_t len)
 	 * b) The packet is linear dependent => it is eliminated anyway
 	 **/
 
-	int ret;
+	int ret, rank;
+
+	if (!timespecisset(&g->started))
+		clock_gettime(CLOCK_MONOTONIC, &g->started);
+	if (!timespecisset(&g->rx_started))
+		clock_gettime(CLOCK_MONOTONIC, &g->rx_started);
+
+	rank = rlnc_block_rank_decode(g->rb);
 
 	ret = rlnc_block_decode(g->rb, payload, len);
 	if (0 > ret) {
@@ -563,6 +884,14 @@ decoder_add(generation_t g, const void *payload, size_t len)
 		return EGENFAIL;
 	}
 
+	if (rlnc_block_rank_decode(g->rb) == rank) {
+		g->state.rx.excess++;
+		TRACE(dependent, g->session, g->seq, rank, len);
+	} else {
+		TRACE(innovative, g->session, g->seq,
+		      rlnc_block_rank_decode(g->rb), len);
+	}
+
 	if (g->gentype != FORWARD)
 		g->state.remote->ddim = rlnc_block_rank_decode(g->rb);
 
@@ -574,6 +903,10 @@ generation_encoder_space(const generation_t g)
 {
 	int ret;
 
+	// Forwarders have no source packets, their space never runs out.
+	if (g->gentype != FORWARD && !generation_agreed(g))
+		return 0;
+
 	ret = g->encoder.max - g->encoder.cur + 1;
 	assert (ret >= 0);
 
@@ -600,12 +933,102 @@ generation_debug_print_state(const generation_t g)
 		g->state.remote->sdim, g->state.remote->ddim, g->state.remote->lock);
 }
 
+/*
+ * Called on the master of a unidirectional session when endpoint who wants to
+ * send. The session becomes bidirectional once both endpoints have sent.
+ * Generations without a layout take the new one right away, all others keep
+ * theirs until they are reset.
+ */
+static void
+generation_claim(struct list_head *gl, enum GENERATION_TYPE who)
+{
+	enum GENERATION_LAYOUT layout, own;
+	generation_t g;
+	session_t s;
+
+	g = list_first_entry(gl, struct generation, list);
+	s = g->session;
+
+	own = (who == MASTER) ? LAYOUT_UNI_MS : LAYOUT_UNI_SM;
+	layout = session_layout(s);
+	if (layout == LAYOUT_NONE)
+		layout = own;
+	else if (layout != own)
+		layout = LAYOUT_BIDIR;
+	session_set_layout(s, layout);
+
+	list_for_each_entry(g, gl, list) {
+		if (g->layout != LAYOUT_NONE)
+			continue;
+		g->layout = layout;
+		init_pvpos(g);
+	}
+}
+
+/*
+ * Asks the remote endpoint for pivots in all generations the local endpoint
+ * cannot use. The request is sent with the next acknowledgement and repeated in
+ * the feedback until it is granted.
+ */
+static void
+generation_request(struct list_head *gl)
+{
+	generation_t g;
+	int n = 0;
+
+	list_for_each_entry(g, gl, list) {
+		if (!generation_needs_pivots(g))
+			continue;
+		g->rq = 1;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	g = list_first_entry(gl, struct generation, list);
+	timeout_settime(g->task.ack, TIMEOUT_FLAG_INACTIVE, ack_timeout(g));
+}
+
+/*
+ * Answers a pivot request of the remote endpoint. The master decides the layout
+ * of generations that have none yet. Generations the local endpoint owns alone
+ * but has not used yet are locked, so that they complete and are replaced by
+ * generations with the new layout. Either way, an acknowledgement carries the
+ * answer.
+ */
+static void
+generation_grant(struct list_head *gl)
+{
+	generation_t g;
+
+	g = list_first_entry(gl, struct generation, list);
+	if (g->gentype == MASTER && session_unidirectional(g->session))
+		generation_claim(gl, SLAVE);
+
+	list_for_each_entry(g, gl, list) {
+		if (g->layout == LAYOUT_BIDIR || generation_needs_pivots(g))
+			continue;
+		if (g->state.local->sdim || g->state.local->lock)
+			continue;
+		generation_lock(g);
+	}
+
+	g = list_first_entry(gl, struct generation, list);
+	timeout_settime(g->task.ack, TIMEOUT_FLAG_INACTIVE, ack_timeout(g));
+}
+
 generation_t
 generation_encoder_add(struct list_head *gl, void *buffer, size_t len)
 {
 	int ret;
 	generation_t g;
 
+	g = list_first_entry(gl, struct generation, list);
+	if (g->gentype == MASTER && session_unidirectional(g->session) &&
+				session_layout(g->session) != LAYOUT_BIDIR)
+		generation_claim(gl, MASTER);
+
 	list_for_each_entry(g, gl, list) {
 		if (!generation_encoder_space(g))
 			continue;
@@ -618,6 +1041,8 @@ generation_encoder_add(struct list_head *gl, void *buffer, size_t len)
 		return g;
 	}
 
+	generation_request(gl);
+
 	return NULL;
 }
 
@@ -644,6 +1069,9 @@ generation_advance(struct list_head *gl)
 	if (n == 0)
 		return 0;
 
+	first = list_first_entry(gl, struct generation, list);
+	TRACE(generation_advance, first->session, first->seq, n);
+
 	list_for_each_entry(g, gl, list) {
 		if (g->gentype == FORWARD) {
 			if (generation_is_decoded(g))
@@ -716,6 +1144,8 @@ generation_process_feedback(struct list_head *gl,
 		generation_update_dimensions(g, &hdr->fb[i]);
 		generation_update_locks(g, &hdr->fb[i]);
 
+		probe_finish(g);
+
 		if (g->gentype == FORWARD) {
 			if (generation_is_decoded(g)) {
 				timeout_settime(g->task.rtx, 0, NULL);
@@ -732,6 +1162,55 @@ generation_process_feedback(struct list_head *gl,
 	return 0;
 }
 
+/*
+ * Generations whose size or layout is not known yet take it from the feedback.
+ * Both originate at the master and are echoed by every node that knows them, so
+ * forwarders pass them on as well. Pivot requests of the remote endpoint are
+ * answered here, too.
+ */
+static void
+generation_adopt(struct list_head *gl, const struct ncm_hdr_coded *hdr)
+{
+	size_t len;
+	int count, i, seq, rq, ask;
+	generation_t g;
+
+	len = hdr->hdr.len - sizeof(*hdr);
+	count = len/sizeof(*hdr->fb);
+	rq = ask = 0;
+
+	for (i=0; i<count; i++) {
+		rq |= hdr->fb[i].lock.rq;
+		ask |= hdr->fb[i].lock.ask;
+
+		seq = (hdr->lseq + i) % (GENERATION_MAX_SEQ+1);
+		g = generation_find(gl, seq);
+		if (!g || g->gentype == MASTER)
+			continue;
+
+		if (!g->sized && hdr->fb[i].gensize) {
+			if (generation_resize(g, hdr->fb[i].gensize)) {
+				LOG(LOG_ERR, "invalid generation size %d",
+						hdr->fb[i].gensize);
+				continue;
+			}
+			g->sized = 1;
+		}
+
+		if (g->layout == LAYOUT_NONE && hdr->fb[i].lock.layout) {
+			g->layout = hdr->fb[i].lock.layout;
+			init_pvpos(g);
+		}
+	}
+
+	g = list_first_entry(gl, struct generation, list);
+	if (rq && g->gentype != FORWARD)
+		generation_grant(gl);
+	else if (ask && g->gentype == MASTER)
+		timeout_settime(g->task.ack, TIMEOUT_FLAG_INACTIVE,
+							ack_timeout(g));
+}
+
 generation_t
 generation_decoder_add(struct list_head *gl, const void *payload, size_t len,
 				const struct ncm_hdr_coded *hdr)
@@ -758,20 +1237,26 @@ generation_decoder_add(struct list_head *gl, const void *payload, size_t len,
 
 	(void) generation_advance(gl);
 
+	generation_adopt(gl, hdr);
+
 	if (!(g = generation_find(gl, hdr->seq))) {
 		if (len > 0) {
 			g = list_first_entry(gl, struct generation, list);
 			timeout_settime(g->task.ack, TIMEOUT_FLAG_INACTIVE,
-				timeout_usec(GENERATION_ACK_MIN_TIMEOUT*1000,
-						GENERATION_ACK_INTERVAL*1000));
+				ack_timeout(g));
 		}
 		return NULL;
 	}
 
 	if (len > 0) {
-		ret = decoder_add(g, payload, len);
-		if (0 > ret)
-			DIE("decoder_add() failed: %d", ret);
+		// Coded packets of a generation of unknown size or layout
+		// cannot be decoded. They are only sent by nodes that know both,
+		// so these are adopted from the same frame in practice.
+		if (generation_agreed(g)) {
+			ret = decoder_add(g, payload, len);
+			if (0 > ret)
+				DIE("decoder_add() failed: %d", ret);
+		}
 		g->state.rx.data++;
 		if (g->gentype == FORWARD)
 			rtx_dec(g);
@@ -787,20 +1272,16 @@ generation_decoder_add(struct list_head *gl, const void *payload, size_t len,
 		if (g->gentype == FORWARD) {
 			if (generation_is_decoded(g))
 				timeout_settime(g->task.ack,
-					TIMEOUT_FLAG_INACTIVE,
-					timeout_usec(
-					GENERATION_ACK_MIN_TIMEOUT*1000,
-					GENERATION_ACK_INTERVAL*1000));
+					TIMEOUT_FLAG_INACTIVE, ack_timeout(g));
 			else
 				timeout_settime(g->task.rtx,
 					TIMEOUT_FLAG_SHORTEN, rtx_timeout(g));
 		} else {
-			if (generation_remote_flow_decoded(g))
+			if (generation_remote_flow_decoded(g)) {
+				generation_commit_rank(g);
 				timeout_settime(g->task.ack,
-					TIMEOUT_FLAG_INACTIVE,
-					timeout_usec(
-					GENERATION_ACK_MIN_TIMEOUT*1000,
-					GENERATION_ACK_INTERVAL*1000));
+					TIMEOUT_FLAG_INACTIVE, ack_timeout(g));
+			}
 		}
 	}
 
@@ -814,22 +1295,48 @@ generation_decoder_add(struct list_head *gl, const void *payload, size_t len,
 	return g;
 }
 
+ssize_t
+generation_decoder_get_view(struct list_head *gl, const void **data)
+{
+	ssize_t len = EGENNOMORE;
+	generation_t g;
+
+	// In order, only the first generation of the window may return packets.
+	// Out of order, later generations are tried as well.
+	list_for_each_entry(g, gl, list) {
+		len = decoder_get_view(g, (const uint8_t **)data);
+		if (len > 0)
+			return len;
+		if (len != EGENNOMORE || !session_out_of_order(g->session))
+			break;
+	}
+
+	if (len == EGENNOMORE && generation_advance(gl) > 0)
+		return generation_decoder_get_view(gl, data);
+
+	return EGENNOMORE;
+}
+
 ssize_t
 generation_decoder_get(struct list_head *gl, void *dst, size_t maxlen)
 {
 	ssize_t len;
-	generation_t g;
+	const void *data;
 
-	g = list_first_entry(gl, struct generation, list);
-	len = decoder_get(g, (void *)dst, maxlen);
+	len = generation_decoder_get_view(gl, &data);
 
-	if (len > 0)
+	if (len <= 0)
 		return len;
 
-	if (len == EGENNOMORE && generation_advance(g->gl) > 0)
-		return generation_decoder_get(g->gl, dst, maxlen);
+	if ((size_t)len > maxlen) {
+		LOG(LOG_ERR, "destination buffer too small (buffer has %d B "
+			"but %d B needed)", (int)maxlen, (int)len);
+		return EGENFAIL;
+	}
 
-	return EGENNOMORE;
+	memcpy(dst, data, len);
+
+	return len;
 }
 
 session_t
@@ -867,6 +1374,7 @@ cb_rtx(timeout_t t, u32 overrun, void *data)
 	s = g->session;
 	struct itimerspec *it;
 	struct timespec min_timeout;
+	int fresh;
 
 	if (g->gentype == FORWARD) {
 		if (generation_is_decoded(g))
@@ -881,10 +1389,21 @@ cb_rtx(timeout_t t, u32 overrun, void *data)
 	if (overrun > 0)
 		LOG(LOG_ERR, "rtx overrun = %d", overrun);
 
-	timespecmset(&min_timeout, GENERATION_RTX_MIN_TIMEOUT);
+	g->state.rtx++;
+
+	TRACE(rtx_fire, s, g->seq, rlnc_block_rank_decode(g->rb), g->state.rtx);
+
+	timespecmset(&min_timeout, SESSION_RTO_MIN);
 	overrun++;
 	do {
+		// Only frames carrying a new source packet are timed. After any
+		// other frame, feedback may be triggered by either transmission.
+		fresh = g->tx_src < 0;
+		if (!fresh)
+			timespecclear(&g->probe.sent);
 		tx_encoded_frame(s, g);
+		if (fresh)
+			probe_start(g);
 		rtx_inc(g);
 		it = rtx_timeout(g);
 		if (overrun > 0)
@@ -916,10 +1435,38 @@ cb_ack(timeout_t t, u32 overrun, void *data)
 		return 0;
 	}
 
+	TRACE(ack_fire, s, g->seq, rlnc_block_rank_decode(g->rb));
+
 	tx_ack_frame(s, g);
 	g->state.tx.ack++;
 
-	timeout_settime(g->task.ack, 0, NULL);
+	// Unanswered requests and questions repeat the ack once per RTO
+	if (!generation_unanswered(g))
+		timeout_settime(g->task.ack, 0, NULL);
+
+	return 0;
+}
+
+/* A partially filled generation is locked once its first packet is older than
+ * the flush timeout. The lock is reported to the remote side in the feedback of
+ * the next frame, which lets the window advance without waiting for more
+ * packets to fill the generation. */
+static int
+cb_flush(timeout_t t, u32 overrun, void *data)
+{
+	(void) t;
+	(void) overrun;
+	generation_t g;
+	g = data;
+
+	if (g->state.local->lock)
+		return 0;
+
+	generation_lock(g);
+
+	timeout_settime(g->task.ack, TIMEOUT_FLAG_SHORTEN, ack_timeout(g));
+
+	set_tap_status();
 
 	return 0;
 }
@@ -930,12 +1477,29 @@ generation_remaining_space(const struct list_head *gl)
 	generation_t g;
 	int space = 0;
 
-	list_for_each_entry(g, gl, list)
-		space += generation_encoder_space(g);
+	// Generations this node has no pivots in have no space. A frame that
+	// finds no space requests them, see session_encoder_add().
+	list_for_each_entry(g, gl, list) {
+		if (!generation_needs_pivots(g))
+			space += generation_encoder_space(g);
+	}
 
 	return space;
 }
 
+int
+generation_remote_owned(const struct list_head *gl)
+{
+	generation_t g;
+
+	list_for_each_entry(g, gl, list) {
+		if (generation_agreed(g) && generation_needs_pivots(g))
+			return 1;
+	}
+
+	return 0;
+}
+
 int
 generation_lseq(const struct list_head *gl)
 {
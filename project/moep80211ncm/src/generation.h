@@ -35,17 +35,29 @@ typedef struct session * session_t;
    A forwarder is an intermediate node and does not generate source packets.
    Forwarders simply call generation_decoder_add_pdu() for every incoming
    packet, which is guaranteed to succeed. Encoded packets can be generated by
-   calling generation_encoder_get_pdu(). */
+   calling generation_encoder_get_pdu(). In unidirectional sessions, a single
+   endpoint may own all slots, see enum GENERATION_LAYOUT. */
 enum GENERATION_TYPE {
 	MASTER	= 0,
 	SLAVE	= 1,
 	FORWARD	= 2,
 };
 
+/* Pivot layout of a generation. In a bidirectional generation, master and slave
+   own half of the pivots each. In a unidirectional generation, one endpoint owns
+   all pivots and the other endpoint only sends feedback. Layouts are decided by
+   the master, see generation_claim(). */
+enum GENERATION_LAYOUT {
+	LAYOUT_NONE	= 0,	// not decided yet
+	LAYOUT_BIDIR	= 1,
+	LAYOUT_UNI_MS	= 2,	// master -> slave only
+	LAYOUT_UNI_SM	= 3,	// slave -> master only
+};
+
 struct generation_packet_counter {
 	int data;
 	int redundant;
-	int excess;
+	int excess;	// rx: linearly dependent packets
 	int ack;
 };
 
@@ -63,6 +75,7 @@ struct generation_state {
 
 	struct generation_packet_counter tx;
 	struct generation_packet_counter rx;
+	int rtx;				// rtx timer firings
 };
 
 
@@ -70,7 +83,10 @@ struct generation_feedback {
 	struct {
 	       uint8_t ms:1;
 	       uint8_t sm:1;
-	       uint8_t unused:6;
+	       uint8_t layout:2;	// enum GENERATION_LAYOUT
+	       uint8_t rq:1;		// sender waits for pivots
+	       uint8_t ask:1;		// sender waits for size and layout
+	       uint8_t unused:2;
 	} __attribute__ ((packed)) lock;
 	struct {
 	       uint8_t ms;
@@ -80,6 +96,7 @@ struct generation_feedback {
 	       uint8_t ms;
 	       uint8_t sm;
 	} __attribute__ ((packed)) sdim;
+	uint8_t gensize;	// 0 if the size is not known yet
 } __attribute__ ((packed));
 
 /* Initializes and returns a new generation. */
@@ -87,6 +104,10 @@ generation_t	generation_init(session_t s, struct list_head *glhead,
 				enum GENERATION_TYPE gentype, 
 				enum MOEPGF_TYPE gftype, int packet_count, 
 				size_t packet_size, int sequence_number);
+/* Creates the slab all generations draw their slots from. Slots are sized for
+   packets of up to packet_size bytes and the largest generation size. Without
+   a slab, every generation allocates its own slots. */
+int		generation_slab_init(size_t packet_size, int hugepages);
 /* Frees a generation. */
 void		generation_list_destroy(struct list_head *gl);
 
@@ -100,6 +121,12 @@ int		generation_reset(generation_t g, uint16_t seq);
 ssize_t		generation_encoder_get(const generation_t g,
 					void *buffer, size_t maxlen);
 
+/* Like generation_encoder_get(), but returns a pointer to the encoded packet
+   inside the coding block instead of copying it. The packet is only valid until
+   the generation is encoded into or decoded again. */
+ssize_t		generation_encoder_get_view(const generation_t g,
+					void **payload);
+
 /* Returns a generation header filled with the current generation state. */
 ssize_t generation_feedback(generation_t g, struct generation_feedback *fb,
 		size_t maxlen);
@@ -181,6 +208,13 @@ generation_t	generation_encoder_add(struct list_head *head, void *buffer,
 ssize_t		generation_decoder_get(struct list_head *gl, void *buffer,
 								size_t maxlen);
 
+/* Like generation_decoder_get(), but data points into the decoded packet inside
+ * its generation instead of receiving a copy. The view stays valid until that
+ * generation is reset, i.e. until the window is advanced past it by a later
+ * call. */
+ssize_t		generation_decoder_get_view(struct list_head *gl,
+							const void **data);
+
 generation_t	generation_decoder_add(struct list_head *gl,
 					const void *payload, size_t len,
 					const struct ncm_hdr_coded *hdr);
@@ -204,6 +238,9 @@ int generation_window_size(const struct list_head *gl);
 int generation_index(const generation_t g);
 
 int generation_remaining_space(const struct list_head *gl);
+/* Returns 1 if the layout of a generation is known but the remote endpoint
+ * owns its pivots, i.e. if a frame could only be encoded after a request. */
+int generation_remote_owned(const struct list_head *gl);
 
 int generation_lseq(const struct list_head *gl);
 int generation_seq(const generation_t g);
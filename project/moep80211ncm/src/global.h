@@ -22,21 +22,73 @@
 #define GENERATION_ACK_INTERVAL		5
 #define GENERATION_RTX_MAX_TIMEOUT	20
 #define GENERATION_RTX_MIN_TIMEOUT	5
+#define GENERATION_FLUSH_TIMEOUT	100
 
 #define GENERATION_MAX_WINDOW		32
 #define GENERATION_WINDOW		4
 #define GENERATION_MAX_SIZE		254
 #define GENERATION_SIZE			128
+#define TC_REALTIME_GENSIZE		8
+#define TC_REALTIME_FLUSH		10
+#define GENERATION_ADAPT_MIN_SIZE	4
 
 #define QDELAY_UPDATE_WEIGHT		0.5
 //#define WMEWMA_WEIGHT			0.9
 #define RALQE_TAU			0.05
 #define RALQE_THETA			0.98
 #define RALQE_MAX			5000
+#define RALQE_MEMO_SIZE			1024
+#define RALQE_MEMO_BITS			7	// quantization of p and q
+
+#define NB_WINDOW			10	// frames, at most 32
+#define NB_FEATURE_EWMA			0.1
+
+#define PROBE_SIZES			{64, 512, 1400}	// payload bytes
+#define PROBE_MAX_SIZE			1400
+#define PROBE_REPLY_SIZE		16
+#define PROBE_REPEAT			4	// requests per size and MCS
+#define PROBE_MAX_MCS			4
+#define PROBE_MCS_STEP			2
+#define PROBE_MCS_LIMIT			7	// highest single stream MCS
+#define PROBE_MIN_PRR			0.9
+#define PROBE_TIMEOUT			100	// ms
+#define PROBE_MAX_PEERS			8
+
+#define PERSIST_MAGIC			0x6e636d73	// "ncms"
+#define PERSIST_VERSION			1
+#define PERSIST_INTERVAL		10000	// ms
+#define PERSIST_MAX_NEIGHBORS		64
+#define PERSIST_MAX_LINKS		256
+#define PERSIST_MAX_SESSIONS		64
+#define PERSIST_MAX_AGE			300	// s, for session parameters
+
+#define LQE_RING_SIZE			1024	// power of two
+#define LQE_MAX_SESSIONS		32	// records per batch
+#define LQE_QUALITY_CACHE		16
+#define LQE_EXPORT_INTERVAL		1000	// ms
+#define LQE_EXPORT_POLL			5	// ms
+#define LQE_PREDICTION_SLOTS		64	// power of two
+#define LQE_PREDICTION_TTL		3000	// ms
+
+#define DTREE_RSSI_MIN			-95	// dBm
+#define DTREE_MAX_NODES			UINT16_MAX
 
 #define SESSION_TIMEOUT			30000
-
-#define SESSION_LOG_FILE_PREFIX		"/dev/shm/ncm_session_"
+#define SESSION_MAX_FORWARD		8
+#define SESSION_PASSIVE_DEFICIT		8
+#define SESSION_PASSIVE_TIMEOUT		100	// ms
+#define SESSION_ADAPT_LOSS_HIGH		0.2
+#define SESSION_ADAPT_LOSS_LOW		0.05
+#define SESSION_ADAPT_QDELAY		20	// ms
+#define SESSION_ADAPT_LATENCY		100	// ms
+#define SESSION_ADAPT_ALPHA		0.125
+#define SESSION_RTT_ALPHA		0.125
+#define SESSION_RTT_BETA		0.25
+#define SESSION_RTO_MIN			2	// ms
+#define SESSION_RTO_MAX			500	// ms
+#define SESSION_LQE_MIN_CONFIDENCE	0.5
+#define SESSION_LQE_BAD_FACTOR		1.5	// redundancy on links predicted bad
+#define SESSION_LQE_RTX_PACE		0.5	// rtx timeout on links predicted bad
 
 
 #define BIT(x) (1ULL << (x))
@@ -47,9 +99,10 @@
 //FIXME
 #define MOEPGF				MOEPGF256
 
-#define GENERATION_FBLEN		1+2+2
-#define NCM_HDRLEN_CODED		2+13+1+2+2
+// Taken from the wire formats, see frametypes.h and generation.h
+#define GENERATION_FBLEN		(sizeof(struct generation_feedback))
+#define NCM_HDRLEN_CODED		(sizeof(struct ncm_hdr_coded))
 #define NCM_COEFFLEN			GENERATION_SIZE/(8/(8 >> (3-MOEPGF)))
-#define NCM_HDRLEN_CODED_TOTAL		NCM_HDRLEN_CODED + GENERATION_FBLEN * GENERATION_WINDOW + NCM_COEFFLEN
+#define NCM_HDRLEN_CODED_TOTAL		(NCM_HDRLEN_CODED + GENERATION_FBLEN * GENERATION_WINDOW + NCM_COEFFLEN)
 
 #endif
@@ -0,0 +1,90 @@
+#ifndef __HIST_H
+#define __HIST_H
+
+#include <moep/types.h>
+
+/*
+ * Log-bucket histogram in the spirit of HdrHistogram. Values below HIST_SUB
+ * get a bucket each, every larger power of two is split into HIST_SUB buckets,
+ * so the relative error of a percentile is below 1/HIST_SUB. Adding a value
+ * costs a bit scan and three increments. Values of HIST_MAX_BITS bits and more
+ * share the last bucket, but still count towards sum and max.
+ */
+#define HIST_SUB_BITS	3
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	40
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist
+{
+	u64 count;
+	u64 sum;
+	u64 max;
+	u32 bucket[HIST_BUCKETS];
+};
+
+static inline int
+hist_index(u64 v)
+{
+	int shift, i;
+
+	if (v < HIST_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	i = (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+	return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+// Smallest value that falls into bucket i
+static inline u64
+hist_lowest(int i)
+{
+	if (i < HIST_SUB)
+		return i;
+
+	return (u64)(HIST_SUB + i % HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+static inline void
+hist_add(struct hist *h, u64 v)
+{
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+	h->bucket[hist_index(v)]++;
+}
+
+/*
+ * Returns an upper bound of the p-quantile (0 < p <= 1), i.e. the largest
+ * value of the bucket that holds it, capped by the largest value seen.
+ */
+static inline u64
+hist_percentile(const struct hist *h, double p)
+{
+	u64 rank, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = p * h->count;
+	if (rank < p * h->count)
+		rank++;
+	if (!rank)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS - 1; i++)
+	{
+		seen += h->bucket[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == HIST_BUCKETS - 1 || hist_lowest(i + 1) - 1 > h->max)
+		return h->max;
+	return hist_lowest(i + 1) - 1;
+}
+
+#endif
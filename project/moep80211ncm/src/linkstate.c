@@ -124,6 +124,40 @@ int ls_update(const u8 *ta, const u8 *ra, int p, int q)
 	return 0;
 }
 
+int ls_restore(const u8 *ta, const u8 *ra, double p, double q, double age)
+{
+	struct linkstate *ls;
+
+	if (!(ls = find(ta, ra)))
+	{
+		if (0 > ls_add(ta, ra))
+			DIE("ls_add() failed where it must not");
+		if (!(ls = find(ta, ra)))
+			DIE("ls_find)() failed where it must not");
+	}
+
+	ralqe_set(ls->lq, p, q, age);
+
+	return 0;
+}
+
+int ls_fill_state(ls_state_filler_t filler, void *data)
+{
+	struct linkstate *ls;
+	double p, q;
+	int i;
+
+	i = 0;
+	list_for_each_entry(ls, &ll, list)
+	{
+		ralqe_get(ls->lq, &p, &q);
+		filler(data, i, ls->ta, ls->ra, p, q);
+		i++;
+	}
+
+	return i;
+}
+
 double
 ls_quality(const u8 *ta, const u8 *ra, int *p, int *q)
 {
@@ -12,5 +12,10 @@ int ls_add(const u8 *ta, const u8 *ra);
 int ls_del(const u8 *ta, const u8 *ra);
 int ls_update(const u8 *ta, const u8 *ra, int p, int q);
 double ls_quality(const u8 *ta, const u8 *ra, int *p, int *q);
+/* Replaces the estimate of a link with one taken age seconds ago */
+int ls_restore(const u8 *ta, const u8 *ra, double p, double q, double age);
+typedef void (*ls_state_filler_t)(void *data, int i, const u8 *ta,
+				  const u8 *ra, double p, double q);
+int ls_fill_state(ls_state_filler_t filler, void *data);
 
 #endif
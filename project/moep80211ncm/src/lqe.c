@@ -2,12 +2,17 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <netinet/ether.h>
+#include <sys/socket.h>
 #include <moep/system.h>
 #include <moep/types.h>
 #include <moep/radiotap.h>
 #include <moep/modules/moep80211.h>
 
 #include <moepcommon/timeout.h>
+#include <moepcommon/util/timespec.h>
 
 #include "frametypes.h"
 #include "ncm.h"
@@ -16,219 +21,552 @@
 #include "neighbor.h"
 #include "lqe.h"
 
-// Pushes statistics of the current link via the LQE socket
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-void lqe_push_data(session_t s, struct moep80211_radiotap *rt, int socket)
+/*
+ * Samples travel from the radio RX path (producer) to the exporter thread
+ * (consumer) through a single-producer single-consumer ring. Neither side
+ * takes a lock; head is only written by the producer and tail only by the
+ * consumer. If the ring is full, the sample is dropped and counted.
+ */
+struct lqe_sample
 {
-#pragma GCC diagnostic pop
-    u8 *remoteAddress;
+    u8 sid[2 * IEEE80211_ALEN];
+    u8 tc;
+    s8 master_or_slave;
+    u8 remote;
+    u8 has_rt;
+    u8 remote_hwaddr[IEEE80211_ALEN];
+
+    struct session_state state;
+    struct nb_features features;
+
+    // Refreshed at most once per export interval, see lqe_quality()
+    float redundancy;
+    float uplink;
+    float downlink;
+    float qdelay;
+    int p;
+    int q;
+
+    struct
+    {
+        u8 rate;
+        u16 frequency;
+        u16 flags;
+        s8 signal;
+        s8 noise;
+        u16 lock_quality;
+        u16 tx_attenuation;
+        u16 tx_attenuation_dB;
+        s8 tx_power;
+        u8 antenna;
+        u8 signal_dB;
+        u8 noise_dB;
+        u8 rts_retries;
+        u8 data_retries;
+        u8 mcs_known;
+        u8 mcs_flags;
+        u8 mcs;
+    } rt;
+};
+
+static struct
+{
+    struct lqe_sample ring[LQE_RING_SIZE];
+    unsigned int head;
+    unsigned int tail;
+    unsigned int dropped;
+    int stop;
+
+    int socket;
+    int interval;
+    int batch;
+    pthread_t tid;
+    int running;
+} exporter;
+
+/*
+ * Per session cache of the link quality values. These take several exp()
+ * calls and, depending on the redundancy scheme, a numerical search, which is
+ * too expensive to do for every received frame. Sessions are mapped directly
+ * by their address, colliding sessions simply refresh more often.
+ */
+struct lqe_quality
+{
+    session_t s;
+    struct timespec expires;
+    float redundancy;
+    float uplink;
+    float downlink;
+    float qdelay;
+    int p;
+    int q;
+};
+
+static struct lqe_quality quality_cache[LQE_QUALITY_CACHE];
+
+static const struct lqe_quality *lqe_quality(session_t s)
+{
+    struct lqe_quality *c;
+    struct timespec now;
+    u8 *remote;
+
+    c = &quality_cache[((uintptr_t)s / sizeof(*s)) % LQE_QUALITY_CACHE];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (c->s == s && timespeccmp(&now, &c->expires, <))
+        return c;
+
+    remote = session_find_remote_address(s);
+
+    c->s = s;
+    c->uplink = (float)nb_ul_quality(remote, &c->p, &c->q);
+    c->downlink = (float)nb_dl_quality(remote, NULL, NULL);
+    c->redundancy = (float)session_redundancy(s);
+    c->qdelay = (float)qdelay_get();
+
+    timespecmset(&c->expires, exporter.interval);
+    timespecadd(&c->expires, &now);
+
+    return c;
+}
+
+// Queues statistics of the current link for the exporter thread
+void lqe_push_data(session_t s, struct moep80211_radiotap *rt,
+                   const struct nb_features *f)
+{
+    const struct lqe_quality *quality;
+    struct lqe_sample *sample;
+    unsigned int head, tail;
     int ret1, ret2;
 
-    int p, q;
-    double uplink, downlink;
+    if (!exporter.running)
+        return;
 
-    lqe_info_data session_info;
+    head = exporter.head;
+    tail = __atomic_load_n(&exporter.tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= LQE_RING_SIZE)
+    {
+        __atomic_add_fetch(&exporter.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
 
-    remoteAddress = session_find_remote_address(s);
+    sample = &exporter.ring[head % LQE_RING_SIZE];
 
-    // LOG(LOG_INFO, "%u", *remoteAddress);
-    session_info.remoteAddress = *remoteAddress;
+    memcpy(sample->sid, s->sid, sizeof(sample->sid));
+    sample->tc = s->tc;
+    sample->remote = *session_find_remote_address(s);
+    memcpy(sample->remote_hwaddr, session_find_remote_address(s),
+           IEEE80211_ALEN);
 
     ret1 = memcmp(s->hwaddr.master, ncm_get_local_hwaddr(), IEEE80211_ALEN);
     ret2 = memcmp(s->hwaddr.slave, ncm_get_local_hwaddr(), IEEE80211_ALEN);
 
     if (ret1 == 0 && ret2 == 0)
-    {
-        session_info.masterOrSlave = -1;
-        // LOG(LOG_INFO, "session_push_data: Node neither Master nor Slave");
-    }
+        sample->master_or_slave = -1;
     else if (ret1 == 0)
-    {
-        session_info.masterOrSlave = 0;
-        // LOG(LOG_INFO, "session_push_data: Node is Slave");
-    }
+        sample->master_or_slave = 0;
     else
-    {
-        session_info.masterOrSlave = 1;
-        // LOG(LOG_INFO, "session_push_data: Node is Master");
-    }
+        sample->master_or_slave = 1;
+
+    sample->state = s->state;
+    if (f)
+        sample->features = *f;
+    else
+        (void)nb_features(sample->remote_hwaddr, &sample->features);
 
-    uplink = nb_ul_quality(session_find_remote_address(s), &p, &q),
-    downlink = nb_dl_quality(session_find_remote_address(s), NULL, NULL),
-
-    // Fill the session_info struct with data from session
-        snprintf(session_info.session, sizeof(session_info.session), "%s:%s", ether_ntoa((const struct ether_addr *)s), ether_ntoa((const struct ether_addr *)s + IEEE80211_ALEN));
-    session_info.count = s->state.count;
-    session_info.TX_data = (float)((double)s->state.tx.data / (double)s->state.count);
-    session_info.TX_ack = (float)((double)s->state.tx.ack / (double)s->state.count);
-    session_info.RX_data = (float)((double)s->state.rx.data / (double)s->state.count);
-    session_info.RX_ack = (float)((double)s->state.rx.ack / (double)s->state.count);
-    session_info.RX_EXCESS_DATA = (float)((double)s->state.rx.excess_data / (double)s->state.count);
-    session_info.RX_LATE_DATA = (float)((double)s->state.rx.late_data / (double)s->state.count);
-    session_info.RX_LATE_ACK = (float)((double)s->state.tx.redundant / (double)s->state.count);
-    session_info.TX_REDUNDANT = (float)((double)s->state.tx.redundant / (double)s->state.count);
-    session_info.redundancy = (float)session_redundancy(s);
-    session_info.uplink = (float)uplink;
-    session_info.p = p;
-    session_info.q = q;
-    session_info.downlink = (float)downlink;
-    session_info.qdelay = (float)qdelay_get();
-
-    // Fill the session_info struct with data from radiotap header of frame
+    quality = lqe_quality(s);
+    sample->redundancy = quality->redundancy;
+    sample->uplink = quality->uplink;
+    sample->downlink = quality->downlink;
+    sample->qdelay = quality->qdelay;
+    sample->p = quality->p;
+    sample->q = quality->q;
+
+    sample->has_rt = rt != NULL;
     if (rt != NULL)
     {
-        session_info.rate = rt->rate;
-        session_info.channelFrequency = rt->channel.frequency;
-        session_info.channelFlags = rt->channel.flags;
-        session_info.signal = rt->signal;
-        session_info.noise = rt->noise;
-        session_info.lockQuality = rt->lock_quality;
-        session_info.TX_attenuation = rt->tx_attenuation;
-        session_info.TX_attenuation_dB = rt->tx_attenuation_dB;
-        session_info.TX_power = rt->tx_power;
-        session_info.antenna = rt->antenna;
-        session_info.signal_dB = rt->signal_dB;
-        session_info.noise_dB = rt->noise_dB;
-        session_info.RTS_retries = rt->rts_retries;
-        session_info.DATA_retries = rt->data_retries;
-        session_info.MCS_known = rt->mcs.known;
-        session_info.MCS_flags = rt->mcs.flags;
-        session_info.MCS_MCS = rt->mcs.mcs;
+        sample->rt.rate = rt->rate;
+        sample->rt.frequency = rt->channel.frequency;
+        sample->rt.flags = rt->channel.flags;
+        sample->rt.signal = rt->signal;
+        sample->rt.noise = rt->noise;
+        sample->rt.lock_quality = rt->lock_quality;
+        sample->rt.tx_attenuation = rt->tx_attenuation;
+        sample->rt.tx_attenuation_dB = rt->tx_attenuation_dB;
+        sample->rt.tx_power = rt->tx_power;
+        sample->rt.antenna = rt->antenna;
+        sample->rt.signal_dB = rt->signal_dB;
+        sample->rt.noise_dB = rt->noise_dB;
+        sample->rt.rts_retries = rt->rts_retries;
+        sample->rt.data_retries = rt->data_retries;
+        sample->rt.mcs_known = rt->mcs.known;
+        sample->rt.mcs_flags = rt->mcs.flags;
+        sample->rt.mcs = rt->mcs.mcs;
     }
 
-    // Copy in order to make sure that data didn't change while sending via socket
-    lqe_info_data session_info_sending = session_info;
+    __atomic_store_n(&exporter.head, head + 1, __ATOMIC_RELEASE);
+}
 
-    // Send the product data to the client
-    if (socket != -1)
+/*
+ * Aggregate of all samples of one session within a batch. Signal, noise, rate
+ * and retries are averaged over the samples that carried a radiotap header,
+ * everything else is taken from the latest sample.
+ */
+struct lqe_aggregate
+{
+    struct lqe_sample last;
+    int samples;
+    int rt_samples;
+    long rate;
+    long signal;
+    long noise;
+    long signal_dB;
+    long noise_dB;
+    long rts_retries;
+    long data_retries;
+};
+
+static struct lqe_aggregate *
+lqe_aggregate_find(struct lqe_aggregate *agg, int *count,
+                   const struct lqe_sample *sample)
+{
+    int i;
+
+    for (i = 0; i < *count; i++)
     {
-        LOG(LOG_INFO, "session_push_data: Pushing data via Socket");
+        if (agg[i].last.tc == sample->tc &&
+            0 == memcmp(agg[i].last.sid, sample->sid, sizeof(sample->sid)))
+            return &agg[i];
+    }
+
+    if (*count == LQE_MAX_SESSIONS)
+        return NULL;
 
-        if (send(socket, &session_info_sending, sizeof(lqe_info_data), 0) < 0)
+    memset(&agg[*count], 0, sizeof(agg[*count]));
+    return &agg[(*count)++];
+}
+
+static void lqe_aggregate_add(struct lqe_aggregate *agg,
+                              const struct lqe_sample *sample)
+{
+    agg->last = *sample;
+    agg->samples++;
+
+    if (!sample->has_rt)
+        return;
+
+    agg->rt_samples++;
+    agg->rate += sample->rt.rate;
+    agg->signal += sample->rt.signal;
+    agg->noise += sample->rt.noise;
+    agg->signal_dB += sample->rt.signal_dB;
+    agg->noise_dB += sample->rt.noise_dB;
+    agg->rts_retries += sample->rt.rts_retries;
+    agg->data_retries += sample->rt.data_retries;
+}
+
+static void lqe_aggregate_fill(lqe_info_data *info,
+                               const struct lqe_aggregate *agg)
+{
+    const struct lqe_sample *s = &agg->last;
+    double count = (double)s->state.count;
+    int n = agg->rt_samples ? agg->rt_samples : 1;
+    char master[18], slave[18];
+
+    memset(info, 0, sizeof(*info));
+
+    // Runs on the exporter thread, ether_ntoa() is not thread-safe
+    snprintf(info->session, sizeof(info->session), "%s:%s",
+             ether_ntoa_r((const struct ether_addr *)s->sid, master),
+             ether_ntoa_r((const struct ether_addr *)(s->sid + IEEE80211_ALEN),
+                          slave));
+
+    info->count = s->state.count;
+    info->TX_data = (float)((double)s->state.tx.data / count);
+    info->TX_ack = (float)((double)s->state.tx.ack / count);
+    info->RX_data = (float)((double)s->state.rx.data / count);
+    info->RX_ack = (float)((double)s->state.rx.ack / count);
+    info->RX_EXCESS_DATA = (float)((double)s->state.rx.excess_data / count);
+    info->RX_LATE_DATA = (float)((double)s->state.rx.late_data / count);
+    info->RX_LATE_ACK = (float)((double)s->state.tx.redundant / count);
+    info->TX_REDUNDANT = (float)((double)s->state.tx.redundant / count);
+    info->redundancy = s->redundancy;
+    info->uplink = s->uplink;
+    info->p = s->p;
+    info->q = s->q;
+    info->downlink = s->downlink;
+    info->qdelay = s->qdelay;
+
+    info->rate = agg->rate / n;
+    info->channelFrequency = s->rt.frequency;
+    info->channelFlags = s->rt.flags;
+    info->signal = agg->signal / n;
+    info->noise = agg->noise / n;
+    info->lockQuality = s->rt.lock_quality;
+    info->TX_attenuation = s->rt.tx_attenuation;
+    info->TX_attenuation_dB = s->rt.tx_attenuation_dB;
+    info->TX_power = s->rt.tx_power;
+    info->antenna = s->rt.antenna;
+    info->signal_dB = agg->signal_dB / n;
+    info->noise_dB = agg->noise_dB / n;
+    info->RTS_retries = agg->rts_retries / n;
+    info->DATA_retries = agg->data_retries / n;
+    info->MCS_known = s->rt.mcs_known;
+    info->MCS_flags = s->rt.mcs_flags;
+    info->MCS_MCS = s->rt.mcs;
+
+    info->remoteAddress = s->remote;
+    info->masterOrSlave = s->master_or_slave;
+    info->samples = agg->samples;
+    memcpy(info->remoteHwaddr, s->remote_hwaddr, IEEE80211_ALEN);
+
+    info->rssi = s->features.rssi;
+    info->rssi_avg = s->features.rssi_avg;
+    info->rssi_std = s->features.rssi_std;
+    info->rssi_ewma = s->features.rssi_ewma;
+    info->prr = s->features.prr;
+    info->retries_avg = s->features.retries_avg;
+    info->retries_std = s->features.retries_std;
+    info->retries_ewma = s->features.retries_ewma;
+}
+
+static int lqe_send_batch(const struct lqe_aggregate *agg, int count)
+{
+    static struct
+    {
+        lqe_batch_header hdr;
+        lqe_info_data info[LQE_MAX_SESSIONS];
+    } batch;
+    size_t len, off;
+    ssize_t ret;
+    int i;
+
+    for (i = 0; i < count; i++)
+        lqe_aggregate_fill(&batch.info[i], &agg[i]);
+
+    len = sizeof(batch.hdr) + count * sizeof(batch.info[0]);
+    batch.hdr.len = len - sizeof(batch.hdr.len);
+    batch.hdr.count = count;
+    batch.hdr.dropped = __atomic_exchange_n(&exporter.dropped, 0,
+                                            __ATOMIC_RELAXED);
+
+    for (off = 0; off < len; off += ret)
+    {
+        ret = send(exporter.socket, (u8 *)&batch + off, len - off,
+                   MSG_NOSIGNAL);
+        if (ret < 0)
         {
-            LOG(LOG_INFO, "session_push_data: Sending data failed!");
+            if (errno == EINTR)
+            {
+                ret = 0;
+                continue;
+            }
+            LOG(LOG_ERR, "lqe_send_batch: send() failed: %s", strerror(errno));
+            return -1;
         }
     }
-    else
-    {
-        LOG(LOG_INFO, "session_push_data: Socket not open!");
-    }
+
+    return 0;
 }
 
-// Starts the thread that receives link quality estimations from the socket connection
-void start_connection_test(lqe_connection_test_data data)
+/*
+ * The exporter thread drains the ring and sends one batch per interval, or as
+ * soon as the configured number of samples has been aggregated. While it is
+ * blocked in send(), the ring fills up and further samples are dropped, so a
+ * slow backend never stalls the radio RX path.
+ */
+static void *lqe_export_thread(void *arg)
 {
-    // Allocate new memory for the data
-    lqe_connection_test_data *new_data = (lqe_connection_test_data *)malloc(sizeof(lqe_connection_test_data));
-    if (!new_data)
+    static struct lqe_aggregate agg[LQE_MAX_SESSIONS];
+    struct timespec now, deadline, interval, poll;
+    struct lqe_sample *sample;
+    struct lqe_aggregate *a;
+    unsigned int head, tail;
+    int count, samples;
+    sigset_t set;
+
+    (void)arg;
+
+    // Timers of the main thread are signal driven, keep them off this thread
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    timespecmset(&poll, LQE_EXPORT_POLL);
+    timespecmset(&interval, exporter.interval);
+
+    count = 0;
+    samples = 0;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespecadd(&deadline, &interval);
+
+    while (!__atomic_load_n(&exporter.stop, __ATOMIC_ACQUIRE))
     {
-        LOG(LOG_ERR, "Error allocating memory for data\n");
-        exit(EXIT_FAILURE);
+        head = __atomic_load_n(&exporter.head, __ATOMIC_ACQUIRE);
+        for (tail = exporter.tail; tail != head; tail++)
+        {
+            sample = &exporter.ring[tail % LQE_RING_SIZE];
+            if ((a = lqe_aggregate_find(agg, &count, sample)))
+            {
+                lqe_aggregate_add(a, sample);
+                samples++;
+            }
+            else
+            {
+                __atomic_add_fetch(&exporter.dropped, 1, __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_store_n(&exporter.tail, tail, __ATOMIC_RELEASE);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespeccmp(&now, &deadline, >=) ||
+            (exporter.batch && samples >= exporter.batch))
+        {
+            if (count > 0 && 0 > lqe_send_batch(agg, count))
+                break;
+            count = 0;
+            samples = 0;
+            deadline = now;
+            timespecadd(&deadline, &interval);
+        }
+
+        if (tail == __atomic_load_n(&exporter.head, __ATOMIC_ACQUIRE))
+            nanosleep(&poll, NULL);
     }
 
-    // Copy the data to the new memory
-    memcpy(new_data, &data, sizeof(lqe_connection_test_data));
+    LOG(LOG_INFO, "LQE exporter stopped");
+    return NULL;
+}
 
-    pthread_t tid;
+int lqe_export_start(const struct lqe *lqe)
+{
     int rc;
 
-    rc = pthread_create(&tid, NULL, connection_test_thread, new_data);
+    exporter.socket = lqe->client_fd;
+    exporter.interval = lqe->interval;
+    exporter.batch = lqe->batch;
+
+    rc = pthread_create(&exporter.tid, NULL, lqe_export_thread, NULL);
     if (rc)
     {
         LOG(LOG_ERR, "Return code from pthread_create() is %d\n", rc);
-        free(new_data);
-        exit(EXIT_FAILURE);
+        errno = rc;
+        return -1;
     }
 
-    // Detach the thread
-    pthread_detach(tid);
+    exporter.running = 1;
+    return 0;
 }
 
-// Runs in a seperate thread
-// Pings a specified peer address and prints the received link quality estimations
-void *connection_test_thread(void *arg)
+void lqe_export_stop()
 {
-    // sleep(10); // Wait for the connection to be established between both nodes
+    if (!exporter.running)
+        return;
 
-    LOG(LOG_INFO, "Thread that performs the connection test started");
+    exporter.running = 0;
+    __atomic_store_n(&exporter.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(exporter.tid, NULL);
 
-    lqe_connection_test_data *lqe_data = (lqe_connection_test_data *)arg;
-    char *peer_address_string = inet_ntoa(lqe_data->peer_address);
-    char ping_cmd[100];
-    sprintf(ping_cmd, "ping -c 5 -i 1 -s 1000 %s", peer_address_string); // 5 times, 1 second interval, 1200 bytes payload
+    if (exporter.dropped)
+        LOG(LOG_WARNING, "LQE exporter dropped %u samples", exporter.dropped);
+}
 
-    // Signal handler
-    struct sigaction sa;
-    sa.sa_handler = rt_signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
+/*
+ * Latest prediction per neighbor. Slots are claimed by address with a CAS and
+ * never released, the prediction itself is a single 64 bit word holding the
+ * class, the confidence and the time it was stored, so readers always see a
+ * consistent prediction without taking a lock.
+ */
+struct lqe_prediction_slot
+{
+    u64 key; // address + LQE_SLOT_USED, 0 if the slot is free
+    u64 value;
+};
 
-    if (sigaction(SIGRTMIN, &sa, NULL) == -1)
-    {
-        perror("sigaction");
-        return 1;
-    }
+#define LQE_SLOT_USED (1ULL << 48)
 
-    /*
-    // Execute the ping command
-    system(ping_cmd);
-    LOG(LOG_INFO, "Connection test ping command is executed");
+static struct lqe_prediction_slot predictions[LQE_PREDICTION_SLOTS];
 
-    // Wait for incoming data from LQE socket and print it (should be exacly 5 data points)
-    int values[5];
-    for (int i = 0; i < 5; i++)
-    {
-        int bytes_read = recv(lqe_data->socket, &values[i], sizeof(values[i]), 0);
+static u64 lqe_slot_key(const u8 *hwaddr)
+{
+    u64 key = 0;
+    int i;
 
-        if (bytes_read < 0)
-        {
-            LOG(LOG_ERR, "Error return code from recv of LQE data socket");
-            //exit(EXIT_FAILURE);
-        }
-        if (bytes_read == 0)
-        {
-            LOG(LOG_ERR, "Socket for recv of LQE data closed");
-            //exit(EXIT_FAILURE);
-        }
+    for (i = 0; i < IEEE80211_ALEN; i++)
+        key = key << 8 | hwaddr[i];
 
-        values[i] = ntohl(values[i]);
-        LOG(LOG_INFO, "Received: %d", values[i]);
-    }
+    return key | LQE_SLOT_USED;
+}
 
-    LOG(LOG_INFO, "Connection test completed");
+static u64 lqe_now_ms()
+{
+    struct timespec now;
 
-    */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-    char buf[4096];
-    FILE *fp;
-    int status;
+// Returns the slot of a neighbor, claiming a free one if create is set
+static struct lqe_prediction_slot *lqe_slot(const u8 *hwaddr, int create)
+{
+    struct lqe_prediction_slot *slot;
+    u64 key, cur;
+    int i, idx;
+
+    key = lqe_slot_key(hwaddr);
+    idx = (key ^ key >> 17) % LQE_PREDICTION_SLOTS;
 
-    // Execute the command and capture its output
-    fp = popen(ping_cmd, "r");
-    if (fp == NULL)
+    for (i = 0; i < LQE_PREDICTION_SLOTS; i++)
     {
-        LOG(LOG_ERR, "Failed to execute the ping command");
-        exit(EXIT_FAILURE);
+        slot = &predictions[(idx + i) % LQE_PREDICTION_SLOTS];
+        cur = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+        if (cur == key)
+            return slot;
+        if (cur != 0)
+            continue;
+        if (!create)
+            return NULL;
+        if (__atomic_compare_exchange_n(&slot->key, &cur, key, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+            cur == key)
+            return slot;
     }
 
-    // Read the output of the command
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-        LOG(LOG_INFO, "%s", buf);
-    }
+    return NULL;
+}
+
+void lqe_prediction_set(const u8 *hwaddr, enum lq_class lqe, double confidence)
+{
+    struct lqe_prediction_slot *slot;
+    char addr[18];
+    u64 value;
 
-    // Close the file stream
-    status = pclose(fp);
-    if (status == -1)
+    if (!(slot = lqe_slot(hwaddr, 1)))
     {
-        LOG(LOG_ERR, "Failed to close the file descriptor reading from the command");
-        exit(EXIT_FAILURE);
+        LOG(LOG_WARNING, "lqe_prediction_set: no free slot for %s",
+            ether_ntoa_r((const struct ether_addr *)hwaddr, addr));
+        return;
     }
 
-    LOG(LOG_INFO, "Connection test is finished");
+    confidence = max(0.0, min(confidence, 1.0));
+    value = lqe_now_ms() << 16 | (u64)(confidence * 255.0) << 8 | (u8)lqe;
+    __atomic_store_n(&slot->value, value, __ATOMIC_RELEASE);
+}
 
-    free(lqe_data);
-    pthread_exit(NULL);
+enum lq_class lqe_prediction_get(const u8 *hwaddr, double *confidence)
+{
+    struct lqe_prediction_slot *slot;
+    u64 value;
+
+    if (!(slot = lqe_slot(hwaddr, 0)))
+        return LQ_UNKNOWN;
+
+    value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    if (!value || lqe_now_ms() - (value >> 16) > LQE_PREDICTION_TTL)
+        return LQ_UNKNOWN;
+
+    if (confidence)
+        *confidence = (double)(value >> 8 & 0xff) / 255.0;
+    return (enum lq_class)(s8)(value & 0xff);
 }
 
 void receive_link_quality_estimations(lqe_connection_test_data data)
@@ -277,12 +615,14 @@ void *receive_lqe_thread(void *arg)
         return 1;
     }
 
-    // Read data from the socket
-    uint32_t data;
+    // Read predictions from the socket, they may arrive in pieces
+    lqe_prediction_msg msg;
+    size_t off = 0;
     ssize_t num_read;
+    char addr[18];
     while (1)
     {
-        num_read = read(lqe_data->socket, &data, sizeof(data));
+        num_read = read(lqe_data->socket, (u8 *)&msg + off, sizeof(msg) - off);
 
         if (num_read == -1)
         {
@@ -304,11 +644,23 @@ void *receive_lqe_thread(void *arg)
             LOG(LOG_ERR, "Connection closed by remote peer");
             break;
         }
-        else
+
+        off += num_read;
+        if (off < sizeof(msg))
+            continue;
+        off = 0;
+
+        if (msg.lqe > LQ_GOOD)
         {
-            // Data received
-            LOG(LOG_INFO, "Received link quality estimation: %u\n", ntohl(data));
+            LOG(LOG_WARNING, "Invalid link quality estimation: %u", msg.lqe);
+            continue;
         }
+
+        // Data received, used by redundancy scheme 3
+        LOG(LOG_DEBUG, "Received link quality estimation for %s: %s (%u/255)",
+            ether_ntoa_r((const struct ether_addr *)msg.hwaddr, addr),
+            dtree_class_name(msg.lqe), msg.confidence);
+        lqe_prediction_set(msg.hwaddr, msg.lqe, msg.confidence / 255.0);
     }
 
     free(lqe_data);
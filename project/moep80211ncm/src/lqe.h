@@ -15,6 +15,8 @@ struct lqe
     int client_fd;
     int port;
     struct in_addr peer_address;
+    int interval; // ms between two batches
+    int batch;    // samples that trigger a batch early, 0 to disable
 };
 
 typedef struct lqe lqe;
@@ -62,17 +64,59 @@ typedef struct
     // Remote address + Master/Slave
     int remoteAddress;
     int masterOrSlave; // -1 neither, 0 slave, 1 master
+
+    // Number of received frames aggregated into this record
+    int samples;
+
+    // Full address of the remote node, echoed in lqe_prediction_msg
+    u8 remoteHwaddr[8];
+
+    // Rolling features of the link to the remote node, see nb_features()
+    int rssi;
+    float rssi_avg;
+    float rssi_std;
+    float rssi_ewma;
+    float prr;
+    float retries_avg;
+    float retries_std;
+    float retries_ewma;
 } lqe_info_data;
 
+// Header of a batch sent by the exporter thread, followed by count records of
+// type lqe_info_data. All fields are in host byte order.
+typedef struct
+{
+    u32 len;     // number of bytes following this field
+    u32 count;   // number of records
+    u32 dropped; // samples dropped since the previous batch
+} __attribute__((packed)) lqe_batch_header;
+
+// Prediction sent back by the inference backend for a neighbor
+typedef struct
+{
+    u8 hwaddr[IEEE80211_ALEN];
+    u8 lqe;        // enum lq_class
+    u8 confidence; // probability of the predicted class, scaled to 0..255
+} __attribute__((packed)) lqe_prediction_msg;
+
 typedef struct
 {
     int socket;
     struct in_addr peer_address;
 } lqe_connection_test_data;
 
-void lqe_push_data(session_t s, struct moep80211_radiotap *rt, int socket);
-void start_connection_test(lqe_connection_test_data lqe_connection_test_data);
-void *connection_test_thread(void *arg);
+// Queues a sample for the exporter thread, never blocks. f holds the features
+// of the remote endpoint if the caller has them at hand, or is NULL.
+void lqe_push_data(session_t s, struct moep80211_radiotap *rt,
+                   const struct nb_features *f);
+// Starts the thread that sends batches of aggregated samples to lqe->client_fd
+int lqe_export_start(const struct lqe *lqe);
+void lqe_export_stop();
+// Stores the latest prediction for a neighbor, callable from any thread
+void lqe_prediction_set(const u8 *hwaddr, enum lq_class lqe, double confidence);
+// Returns the latest prediction for a neighbor and its confidence, or
+// LQ_UNKNOWN if there is none younger than LQE_PREDICTION_TTL
+enum lq_class lqe_prediction_get(const u8 *hwaddr, double *confidence);
 void receive_link_quality_estimations(lqe_connection_test_data lqe_connection_test_data);
 void *receive_lqe_thread(void *arg);
 void rt_signal_handler(int sig);
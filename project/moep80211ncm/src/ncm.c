@@ -59,6 +59,12 @@
 #include "neighbor.h"
 #include "linkstate.h"
 #include "lqe.h"
+#include "dtree.h"
+#include "probe.h"
+#include "persist.h"
+#include "stats.h"
+#include "trace.h"
+#include "classify.h"
 
 #define TASK_NCM_BEACON 0
 
@@ -144,6 +150,56 @@ static struct argp_option options[] = {
 	 .arg = "PATH",
 	 .flags = 0,
 	 .doc = "Radio device to connect to the simulator"},
+	{.name = "packet-ring",
+	 .key = 'M',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Use memory mapped packet rings on the radio interface"},
+	{.name = "hugepages",
+	 .key = 'H',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Back frame and generation memory with hugepages"},
+	{.name = "max-forward",
+	 .key = 'X',
+	 .arg = "NUM",
+	 .flags = 0,
+	 .doc = "Relay for at most NUM overheard sessions at a time"},
+	{.name = "out-of-order",
+	 .key = 'O',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Deliver decoded packets as soon as they are decodable instead "
+			"of in order"},
+	{.name = "classify",
+	 .key = 'C',
+	 .arg = "RULE",
+	 .flags = 0,
+	 .doc = "Send packets matching RULE in the realtime class, where RULE is "
+			"dscp=N, proto=N or port=N (may be given multiple times)"},
+	{.name = "rt-gensize",
+	 .key = 'E',
+	 .arg = "GENSIZE",
+	 .flags = 0,
+	 .doc = "Generation size of the realtime class"},
+	{.name = "flush",
+	 .key = 'U',
+	 .arg = "MSEC",
+	 .flags = 0,
+	 .doc = "Lock partially filled generations MSEC ms after their first "
+			"packet, 0 disables flushing"},
+	{.name = "adapt",
+	 .key = 'A',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Adapt the size of every generation to link loss and delay, "
+			"GENSIZE becomes the upper limit (must be set on all nodes)"},
+	{.name = "unidirectional",
+	 .key = 'u',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Let the first sender of a session own whole generations until "
+			"the other side sends too (must be set on all nodes)"},
 	{.name = "gensize",
 	 .key = 'G',
 	 .arg = "GENSIZE",
@@ -163,7 +219,9 @@ static struct argp_option options[] = {
 	 .key = 's',
 	 .arg = "SCHEME",
 	 .flags = 0,
-	 .doc = "redundancy scheme to use"},
+	 .doc = "redundancy scheme to use: 0 (uplink quality), 1 (RALQE), "
+			"2 (relay) or 3 (RALQE scaled by the link quality estimations, "
+			"see -l, -q and -D)"},
 	{.name = "confidence-level",
 	 .key = 't',
 	 .arg = "THETA",
@@ -174,11 +232,35 @@ static struct argp_option options[] = {
 	 .arg = "PORT",
 	 .flags = 0,
 	 .doc = "Enables the push of link quality data to a socket running on the specified PORT"},
+	{.name = "lqe-interval",
+	 .key = 'L',
+	 .arg = "MSEC",
+	 .flags = 0,
+	 .doc = "Send aggregated link quality data every MSEC ms"},
+	{.name = "lqe-batch",
+	 .key = 'B',
+	 .arg = "NUM",
+	 .flags = 0,
+	 .doc = "Send link quality data early once NUM frames are aggregated, "
+			"0 disables"},
+	{.name = "lqe-model",
+	 .key = 'D',
+	 .arg = "FILE",
+	 .flags = 0,
+	 .doc = "Predict the link quality of every session in place with the "
+			"decision tree exported to FILE by the training pipeline"},
+	{.name = "state",
+	 .key = 'P',
+	 .arg = "FILE",
+	 .flags = 0,
+	 .doc = "Keep link estimates and learned session parameters in FILE and "
+			"start from them after a restart"},
 	{.name = "connection-test",
 	 .key = 'c',
-	 .arg = "PEER_ADDRESS",
+	 .arg = "HWADDR",
 	 .flags = 0,
-	 .doc = "Perform a connection test at NCM startup and adjust parameters accordingly"},
+	 .doc = "Probe the link to HWADDR at startup and seed the link estimate "
+			"and the MCS from the result"},
 	{.name = "receive link quality estimations",
 	 .key = 'q',
 	 .arg = NULL,
@@ -207,10 +289,18 @@ static struct cfg
 	struct params_device rad;
 	struct params_wireless wlan;
 	struct params_session session;
+	struct params_session tc[NCM_TC_COUNT];
+	int rt_gensize;
 	struct params_jsm jsm;
 
 	// Stores the socket connection and helpers for link quality transmissions
 	struct lqe lqe;
+
+	// Peer probed at startup, if any
+	u8 *probe_peer;
+
+	// State file kept across restarts, if any
+	const char *state;
 } cfg;
 
 static error_t
@@ -384,6 +474,47 @@ parse_opt(int key, char *arg, struct argp_state *state)
 	case 'R':
 		cfg->sim.sim_rad_dev = arg;
 		break;
+	case 'M':
+		cfg->wlan.ring = 1;
+		break;
+	case 'H':
+		cfg->session.hugepages = 1;
+		break;
+	case 'X':
+		cfg->session.max_forward = strtol(arg, &endptr, 0);
+		if (endptr != NULL && endptr != arg + strlen(arg))
+			argp_failure(state, 1, errno, "Invalid number: %s", arg);
+		if (cfg->session.max_forward < 0)
+			argp_failure(state, 1, errno,
+						 "Invalid number: %d", cfg->session.max_forward);
+		break;
+	case 'O':
+		cfg->session.out_of_order = 1;
+		break;
+	case 'C':
+		if (0 > classify_add_rule(arg))
+			argp_failure(state, 1, errno, "Invalid rule: %s", arg);
+		break;
+	case 'E':
+		cfg->rt_gensize = atoi(arg);
+		if (cfg->rt_gensize <= 1 || cfg->rt_gensize > 254 || cfg->rt_gensize % 2 != 0)
+			argp_failure(state, 1, errno, "Invalid gensize: %s",
+						 arg);
+		break;
+	case 'U':
+		cfg->session.flush = strtol(arg, &endptr, 0);
+		if (endptr != NULL && endptr != arg + strlen(arg))
+			argp_failure(state, 1, errno, "Invalid number: %s", arg);
+		if (cfg->session.flush < 0)
+			argp_failure(state, 1, errno,
+						 "Invalid number: %d", cfg->session.flush);
+		break;
+	case 'A':
+		cfg->session.adapt = 1;
+		break;
+	case 'u':
+		cfg->session.unidir = 1;
+		break;
 	case 'G':
 		cfg->session.gensize = atoi(arg);
 		if (cfg->session.gensize <= 1 || cfg->session.gensize > 254 || cfg->session.gensize % 2 != 0)
@@ -455,30 +586,35 @@ parse_opt(int key, char *arg, struct argp_state *state)
 
 		LOG(LOG_INFO, "socket is connected!");
 
+		break;
+	case 'L':
+		cfg->lqe.interval = strtol(arg, &endptr, 0);
+		if (endptr != NULL && endptr != arg + strlen(arg))
+			argp_failure(state, 1, errno, "Invalid number: %s", arg);
+		if (cfg->lqe.interval <= 0)
+			argp_failure(state, 1, errno,
+						 "Invalid number: %d", cfg->lqe.interval);
+		break;
+	case 'B':
+		cfg->lqe.batch = strtol(arg, &endptr, 0);
+		if (endptr != NULL && endptr != arg + strlen(arg))
+			argp_failure(state, 1, errno, "Invalid number: %s", arg);
+		if (cfg->lqe.batch < 0)
+			argp_failure(state, 1, errno,
+						 "Invalid number: %d", cfg->lqe.batch);
+		break;
+	case 'D':
+		if (0 > dtree_load(arg))
+			argp_failure(state, 1, errno, "Cannot load model: %s", arg);
+		break;
+	case 'P':
+		cfg->state = arg;
 		break;
 	// Option case that enables the connection test at startup of the NCM
 	case 'c':
-		// Parse the peer address argument
-		if (!inet_aton(arg, &cfg->lqe.peer_address))
-			argp_failure(state, 1, errno, "Invalid peer ip address");
-
-		char *peer_address_string = inet_ntoa(cfg->lqe.peer_address);
-		LOG(LOG_INFO, "Connection test is starting to peer with ip address %s!", peer_address_string);
-
-		// Check if the link quality socket is open
-		if (cfg->lqe.client_fd == -1)
-		{
-			LOG(LOG_ERR, "Transmission of link quality data not configured, this is required for the connection test!");
-			exit(EXIT_FAILURE);
-		}
-
-		lqe_connection_test_data connection_test_data;
-		connection_test_data.peer_address = cfg->lqe.peer_address;
-		connection_test_data.socket = cfg->lqe.client_fd;
-
-		// Start the receival of link quality estimations in a seperate thread
-		start_connection_test(connection_test_data);
-
+		if (!(cfg->probe_peer = ieee80211_aton(arg)))
+			argp_failure(state, 1, errno,
+						 "Invalid hardware address");
 		break;
 	// Option case that enables the receival of link quality estimations
 	case 'q':
@@ -559,7 +695,7 @@ send_beacon(timeout_t t, u32 overrun, void *data)
 	(void)data;
 	(void)t;
 	(void)overrun;
-	session_log_state();
+	stats_update();
 
 	moep_frame_t frame;
 	struct moep80211_hdr *hdr;
@@ -690,6 +826,10 @@ int ncm_frame_type(moep_frame_t frame)
 	if (ext)
 		return NCM_BEACON;
 
+	ext = moep_frame_moep_hdr_ext(frame, NCM_HDR_PROBE);
+	if (ext)
+		return NCM_PROBE;
+
 	return NCM_INVALID;
 }
 
@@ -707,6 +847,42 @@ int rad_tx(moep_frame_t f)
 	return ret;
 }
 
+int rad_tx_urgent(moep_frame_t f)
+{
+	int ret;
+
+	ncm_frame_init_l1hdr(f);
+	ncm_frame_init_l2hdr(f);
+	ncm_frame_set_txseq(f);
+
+	if (0 > (ret = moep_dev_tx_urgent(cfg.rad.dev, f)))
+		LOG(LOG_ERR, "moep_dev_tx_urgent() failed: %s", strerror(errno));
+
+	return ret;
+}
+
+int rad_tx_mcs(moep_frame_t f, int mcs)
+{
+	struct moep80211_radiotap *rt;
+	int ret;
+
+	ncm_frame_init_l1hdr(f);
+	ncm_frame_init_l2hdr(f);
+	ncm_frame_set_txseq(f);
+
+	if (mcs >= 0 && !cfg.sim.enabled &&
+		(cfg.wlan.rt.it_present & BIT(IEEE80211_RADIOTAP_MCS)))
+	{
+		rt = moep_frame_radiotap(f);
+		rt->mcs.mcs = mcs;
+	}
+
+	if (0 > (ret = moep_dev_tx(cfg.rad.dev, f)))
+		LOG(LOG_ERR, "moep80211_tx() failed: %s", strerror(errno));
+
+	return ret;
+}
+
 void write_csv_data(moep_frame_t f)
 {
 	static FILE *file = NULL;
@@ -777,6 +953,7 @@ taph(moep_dev_t dev, moep_frame_t frame)
 	struct ncm_hdr_bcast *bcast;
 	size_t len;
 	session_t s;
+	int tc;
 
 	etherptr = moep_frame_ieee8023_hdr(frame);
 	memcpy(&ether, etherptr, sizeof(ether));
@@ -815,8 +992,10 @@ taph(moep_dev_t dev, moep_frame_t frame)
 	if (0 > session_sid(sid, ether.ether_shost, ether.ether_dhost))
 		DIE("session_sid() failed: %s", strerror(errno));
 
-	if (!(s = session_find(sid)))
-		s = session_register(&cfg.session, NULL, sid);
+	tc = classify_frame(frame);
+
+	if (!(s = session_find(sid, tc)))
+		s = session_register(&cfg.tc[tc], NULL, sid, tc);
 
 	session_encoder_add(s, frame);
 
@@ -837,8 +1016,10 @@ radh(moep_dev_t dev, moep_frame_t frame)
 	struct ncm_hdr_bcast *bcast;
 	struct ncm_hdr_coded *coded;
 	struct ncm_beacon_payload *bcnp;
-	struct moep80211_radiotap *rt;
+	struct ncm_hdr_probe *probe;
+	struct moep80211_radiotap *rt = NULL;
 	struct ether_header *etherptr, ether;
+	struct nb_features features, *f = NULL;
 	size_t len;
 	session_t s;
 
@@ -872,8 +1053,13 @@ radh(moep_dev_t dev, moep_frame_t frame)
 		}
 	}
 
+	if (rt != NULL && 0 == nb_update_rx(hdr->ta, rt, &features))
+		f = &features;
+
 	type = ncm_frame_type(frame);
 
+	TRACE(rad_rx, type, hdr->ta, len);
+
 	switch (type)
 	{
 	case NCM_DATA:
@@ -905,18 +1091,44 @@ radh(moep_dev_t dev, moep_frame_t frame)
 		coded = (struct ncm_hdr_coded *)
 			moep_frame_moep_hdr_ext(frame, NCM_HDR_CODED);
 
-		if (!(s = session_find(coded->sid)))
-			s = session_register(&cfg.session, NULL, coded->sid);
+		moep_frame_get_payload(frame, &len);
+
+		if (coded->hdr.len < NCM_HDRLEN_CODED)
+		{
+			LOG(LOG_ERR, "short coding header received");
+			break;
+		}
+
+		if (coded->tc >= NCM_TC_COUNT)
+		{
+			LOG(LOG_ERR, "invalid traffic class received");
+			break;
+		}
+
+		if (!(s = session_find(coded->sid, coded->tc)) &&
+			!(s = session_overhear(&cfg.tc[coded->tc], hdr->ta, coded,
+								   len)))
+			break;
+
+		// Features of overheard senders do not describe the session's link
+		if (0 != memcmp(hdr->ta, session_find_remote_address(s),
+						IEEE80211_ALEN))
+			f = NULL;
 
-		// Upon receival of coded packets, push the link quality updates on the LQE socket
+		// Upon receival of coded packets, queue the link quality updates
+		// for the LQE exporter thread
 		if (cfg.lqe.client_fd != -1 && rt != NULL)
 		{
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-			lqe_push_data(s, rt, cfg.lqe.client_fd);
+			lqe_push_data(s, rt, f);
 #pragma GCC diagnostic pop
 		}
 
+		if (f != NULL &&
+			rt->hdr.it_present & BIT(IEEE80211_RADIOTAP_DBM_ANTSIGNAL))
+			session_commit_features(s, f);
+
 		session_decoder_add(s, frame);
 		break;
 
@@ -940,6 +1152,19 @@ radh(moep_dev_t dev, moep_frame_t frame)
 
 		break;
 
+	case NCM_PROBE:
+		probe = (struct ncm_hdr_probe *)
+			moep_frame_moep_hdr_ext(frame, NCM_HDR_PROBE);
+
+		if (probe->hdr.len < sizeof(*probe))
+		{
+			LOG(LOG_WARNING, "short probe received, frame discarded");
+			break;
+		}
+
+		probe_rx(hdr->ta, hdr->ra, probe, rt);
+		break;
+
 	default:
 		LOG(LOG_ERR, "invalid frame type received");
 		goto end;
@@ -954,6 +1179,54 @@ end:
 	return 0;
 }
 
+static void
+probe_done(const u8 *peer, const struct probe_result *r, void *data)
+{
+	(void)data;
+
+	if (!r->replies)
+	{
+		LOG(LOG_WARNING, "probe: no replies from %s, keeping defaults",
+			ether_ntoa((const struct ether_addr *)peer));
+		return;
+	}
+
+	// Requests received by the peer and replies received by us
+	(void)nb_seed(peer, r->rcvd, max(r->sent - r->rcvd, 0),
+				  r->replies, max(r->rcvd - r->replies, 0));
+
+	if (r->mcs >= 0)
+		cfg.wlan.rt.mcs.mcs = r->mcs;
+}
+
+static void
+start_probe()
+{
+	int mcs[PROBE_MAX_MCS];
+	int count, limit;
+
+	if (cfg.sim.enabled ||
+		!(cfg.wlan.rt.it_present & BIT(IEEE80211_RADIOTAP_MCS)))
+	{
+		mcs[0] = -1;
+		count = 1;
+	}
+	else
+	{
+		// Probe the configured MCS and a few faster ones of the same streams
+		limit = max((int)cfg.wlan.rt.mcs.mcs, PROBE_MCS_LIMIT);
+		for (count = 0; count < PROBE_MAX_MCS; count++)
+		{
+			mcs[count] = cfg.wlan.rt.mcs.mcs + count * PROBE_MCS_STEP;
+			if (mcs[count] > limit)
+				break;
+		}
+	}
+
+	if (0 > probe_start(cfg.probe_peer, mcs, count, probe_done, NULL))
+		LOG(LOG_ERR, "probe_start() failed: %s", strerror(errno));
+}
+
 void cfg_init()
 {
 	memset(&cfg, 0, sizeof(cfg));
@@ -973,7 +1246,10 @@ void cfg_init()
 
 	cfg.session.gensize = GENERATION_SIZE;
 	cfg.session.winsize = GENERATION_WINDOW;
+	cfg.session.max_forward = SESSION_MAX_FORWARD;
 	cfg.session.gftype = MOEPGF;
+	cfg.session.flush = GENERATION_FLUSH_TIMEOUT;
+	cfg.rt_gensize = TC_REALTIME_GENSIZE;
 
 	cfg.tap.name = "tap0";
 	cfg.tap.mtu = cfg.mtu + sizeof(struct ether_header);
@@ -992,6 +1268,8 @@ void cfg_init()
 	// PZ
 	cfg.lqe.client_fd = -1;
 	cfg.lqe.port = -1;
+	cfg.lqe.interval = LQE_EXPORT_INTERVAL;
+	cfg.lqe.batch = 0;
 }
 
 static int
@@ -1033,7 +1311,7 @@ int main(int argc, char **argv)
 {
 	int ret;
 
-	LOG(LOG_ERR, "hdr len = %d", NCM_HDRLEN_CODED_TOTAL);
+	LOG(LOG_ERR, "hdr len = %zu", NCM_HDRLEN_CODED_TOTAL);
 
 	LOG(LOG_INFO, "ncm starting...");
 
@@ -1042,6 +1320,26 @@ int main(int argc, char **argv)
 
 	argp_parse(&argp, argc, argv, 0, 0, &cfg);
 
+	/* Generations hold the serialized tap frames, see
+	 * serialize_for_encoding(), so their slots only need to fit the MTU. */
+	cfg.session.pdusize = cfg.tap.mtu + sizeof(struct ncm_hdr_pctrl);
+	if (cfg.session.hugepages)
+		moep_set_hugepages(1);
+	if (0 > generation_slab_init(cfg.session.pdusize,
+				     cfg.session.hugepages))
+		DIE("generation_slab_init() failed");
+
+	/* Bulk traffic uses the configured session parameters. Realtime traffic
+	 * uses small generations, which are delivered out of order, sent ahead
+	 * of queued bulk frames and flushed after at most TC_REALTIME_FLUSH ms. */
+	cfg.tc[NCM_TC_BULK] = cfg.session;
+	cfg.tc[NCM_TC_REALTIME] = cfg.session;
+	cfg.tc[NCM_TC_REALTIME].gensize = cfg.rt_gensize;
+	cfg.tc[NCM_TC_REALTIME].out_of_order = 1;
+	cfg.tc[NCM_TC_REALTIME].priority = 1;
+	if (cfg.session.flush > TC_REALTIME_FLUSH)
+		cfg.tc[NCM_TC_REALTIME].flush = TC_REALTIME_FLUSH;
+
 	if (cfg.daemon)
 	{
 		daemonize();
@@ -1069,6 +1367,8 @@ int main(int argc, char **argv)
 	}
 	else
 	{
+		if (cfg.wlan.ring)
+			moep_dev_radio_set_ring(&(struct moep80211_ring_params){0});
 		if (!(cfg.rad.dev = moep_dev_moep80211_open(cfg.rad.name,
 													cfg.wlan.freq0,
 													cfg.wlan.moep_chan_width,
@@ -1104,8 +1404,30 @@ int main(int argc, char **argv)
 							  _set_tap_status,
 							  NULL);
 
+	if (cfg.session.rscheme == 3 && cfg.lqe.client_fd == -1 &&
+		!dtree_loaded())
+		LOG(LOG_WARNING, "redundancy scheme 3 without link quality "
+				 "estimations or a decision tree behaves like scheme 1");
+
+	if (cfg.lqe.client_fd != -1 && 0 > lqe_export_start(&cfg.lqe))
+		DIE("lqe_export_start() failed: %s", strerror(errno));
+
+	if (cfg.state && 0 > persist_open(cfg.state))
+		LOG(LOG_ERR, "persist_open() failed: %s: %s", cfg.state,
+			strerror(errno));
+
+	if (0 > stats_open())
+		LOG(LOG_WARNING, "stats_open() failed: %s", strerror(errno));
+
+	if (cfg.probe_peer)
+		start_probe();
+
 	run();
 
+	stats_close();
+	persist_close();
+	lqe_export_stop();
+
 	moep_dev_close(cfg.rad.dev);
 	moep_dev_close(cfg.tap.dev);
 
@@ -22,11 +22,19 @@ u8 *ncm_get_local_hwaddr();
  * are copied, i.e., memory must be deallocated by the caller.
  */
 int rad_tx(struct moep_frame *f);
+int rad_tx_urgent(struct moep_frame *f);
+/*
+ * Like rad_tx(), but sends at the given MCS instead of the configured one. A
+ * negative mcs, or a legacy rate configuration, sends at the configured rate.
+ */
+int rad_tx_mcs(struct moep_frame *f, int mcs);
 int tap_tx(struct moep_frame *f);
 
 int rad_tx_ready();
 int tap_tx_ready();
 
+int set_tap_status();
+
 moep_frame_t create_rad_frame();
 
 static inline int
@@ -0,0 +1,398 @@
+/*
+ * Prints the statistics an NCM keeps in its shared memory segment, see stats.h.
+ * Reading does not involve the NCM at all, so it can be polled at any rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <argp.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/ether.h>
+
+#include "stats.h"
+
+#define STATS_RETRIES 1000
+#define STATS_RETRY_DELAY 100 // us
+
+static char args_doc[] = "[PID]";
+
+static char doc[] =
+	"ncmstat - print the statistics of a running ncm\n\n"
+	"  PID                        Process id of the ncm, may be omitted if "
+	"only one is running";
+
+static struct argp_option options[] = {
+	{.name = "json",
+	 .key = 'j',
+	 .arg = NULL,
+	 .flags = 0,
+	 .doc = "Print JSON instead of text"},
+	{.name = "interval",
+	 .key = 'i',
+	 .arg = "MS",
+	 .flags = 0,
+	 .doc = "Print again every MS milliseconds"},
+	{NULL}};
+
+static struct
+{
+	int json;
+	int interval;
+	int pid;
+} cfg;
+
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	char *endptr = NULL;
+
+	switch (key)
+	{
+	case 'j':
+		cfg.json = 1;
+		break;
+	case 'i':
+		cfg.interval = strtol(arg, &endptr, 0);
+		if (*endptr || cfg.interval <= 0)
+			argp_failure(state, 1, 0, "Invalid interval: %s", arg);
+		break;
+	case ARGP_KEY_ARG:
+		if (state->arg_num > 0)
+			argp_usage(state);
+		cfg.pid = strtol(arg, &endptr, 0);
+		if (*endptr || cfg.pid <= 0)
+			argp_failure(state, 1, 0, "Invalid pid: %s", arg);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = {
+	.options = options,
+	.parser = parse_opt,
+	.args_doc = args_doc,
+	.doc = doc};
+
+static int
+find_pid()
+{
+	struct dirent *e;
+	DIR *dir;
+	int pid = 0, n = 0;
+
+	if (!(dir = opendir("/dev/shm")))
+		return -1;
+
+	while ((e = readdir(dir)))
+	{
+		if (strncmp(e->d_name, STATS_SHM_PREFIX + 1,
+			    strlen(STATS_SHM_PREFIX) - 1))
+			continue;
+		pid = atoi(e->d_name + strlen(STATS_SHM_PREFIX) - 1);
+		n++;
+	}
+	closedir(dir);
+
+	if (n != 1)
+	{
+		fprintf(stderr, n ? "ncmstat: several ncm running, give a PID\n"
+				  : "ncmstat: no ncm running\n");
+		return -1;
+	}
+	return pid;
+}
+
+static int
+snapshot(const struct stats_shm *shm, struct stats_shm *copy)
+{
+	u32 seq;
+	int i;
+
+	for (i = 0; i < STATS_RETRIES; i++)
+	{
+		if (i)
+			usleep(STATS_RETRY_DELAY);
+
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		memcpy(copy, shm, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (seq == __atomic_load_n(&shm->seq, __ATOMIC_RELAXED))
+			return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+static double
+avg(u32 sum, u32 count)
+{
+	return count ? (double)sum / count : 0;
+}
+
+static const char *
+link_name(s8 link)
+{
+	switch (link)
+	{
+	case 0:
+		return "bad";
+	case 1:
+		return "interm.";
+	case 2:
+		return "good";
+	default:
+		return "unknown";
+	}
+}
+
+static const char *hist_names[STATS_HISTS] = {
+	[STATS_HIST_DELIVERY] = "delivery_us",
+	[STATS_HIST_RANK] = "rank_us",
+	[STATS_HIST_TX] = "tx_per_generation",
+	[STATS_HIST_DEPENDENT] = "dependent_per_generation",
+	[STATS_HIST_RTX] = "rtx_per_generation",
+};
+
+static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+#define PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+static void
+print_hist_text(const struct hist *h, const char *name)
+{
+	unsigned int i;
+
+	printf("%s	n=%llu mean=%.1f", name, (unsigned long long)h->count,
+	       h->count ? (double)h->sum / h->count : 0.0);
+	for (i = 0; i < PERCENTILES; i++)
+		printf(" %s=%llu", percentile_names[i],
+		       (unsigned long long)hist_percentile(h, percentiles[i]));
+	printf(" max=%llu\n", (unsigned long long)h->max);
+}
+
+static void
+print_hist_json(const struct hist *h, const char *name)
+{
+	unsigned int i;
+
+	printf(", \"%s\": {\"count\": %llu, \"mean\": %g", name,
+	       (unsigned long long)h->count,
+	       h->count ? (double)h->sum / h->count : 0.0);
+	for (i = 0; i < PERCENTILES; i++)
+		printf(", \"%s\": %llu", percentile_names[i],
+		       (unsigned long long)hist_percentile(h, percentiles[i]));
+	printf(", \"max\": %llu}", (unsigned long long)h->max);
+}
+
+static const char *
+mac(const u8 *addr, char *buf)
+{
+	return ether_ntoa_r((const struct ether_addr *)addr, buf);
+}
+
+static void
+print_text(const struct stats_shm *s)
+{
+	const struct stats_session *ss;
+	const struct stats_neighbor *nb;
+	char a[18], b[18];
+	u32 i;
+	int j;
+
+	printf("ncm %u: update %llu\n"
+	       "qdelay\t%.4f\n"
+	       "qdelay.loss\t%.4f\n"
+	       "qdelay.packets\t%u\n\n",
+	       s->pid, (unsigned long long)s->global.updates,
+	       s->global.qdelay, s->global.qdelay_loss,
+	       s->global.qdelay_packets);
+
+	for (i = 0; i < s->sessions; i++)
+	{
+		ss = &s->session[i];
+		printf("session: %s:%s tc %u\n"
+		       "count\t%u\n"
+		       "tx.data\t%.2f\n"
+		       "tx.ack\t%.2f\n"
+		       "rx.data\t%.2f\n"
+		       "rx.ack\t%.2f\n"
+		       "rx.excess_data\t%.2f\n"
+		       "rx.late_data\t%.2f\n"
+		       "rx.late_ack\t%.2f\n"
+		       "tx.redundant\t%.2f\n"
+		       "redundancy\t%.2f\n"
+		       "uplink\t%.2f\n"
+		       "p = %d, q = %d\n"
+		       "downlink\t%.2f\n"
+		       "gensize\t%d\n"
+		       "latency\t%.4f\n"
+		       "srtt\t%.4f\n"
+		       "rttvar\t%.4f\n"
+		       "rto\t%.4f\n"
+		       "link\t%s\n",
+		       mac(ss->master, a), mac(ss->slave, b), ss->tc,
+		       ss->count,
+		       avg(ss->tx_data, ss->count),
+		       avg(ss->tx_ack, ss->count),
+		       avg(ss->rx_data, ss->count),
+		       avg(ss->rx_ack, ss->count),
+		       avg(ss->rx_excess_data, ss->count),
+		       avg(ss->rx_late_data, ss->count),
+		       avg(ss->rx_late_ack, ss->count),
+		       avg(ss->tx_redundant, ss->count),
+		       ss->redundancy, ss->uplink, ss->p, ss->q, ss->downlink,
+		       ss->gensize, ss->latency, ss->srtt, ss->rttvar, ss->rto,
+		       link_name(ss->link));
+		if (ss->jsm)
+			printf("jsm\tipt_avg=%g ms, ipt_timer=%g ms, backlog=%u "
+			       "pkt, backlog_target=%g ms\n",
+			       ss->jsm_ipt_avg * 1000.0,
+			       ss->jsm_ipt_timer * 1000.0, ss->jsm_backlog,
+			       ss->jsm_backlog_target * 1000.0);
+		for (j = 0; j < STATS_HISTS; j++)
+			print_hist_text(&ss->hist[j], hist_names[j]);
+		printf("\n");
+	}
+
+	for (i = 0; i < s->neighbors; i++)
+	{
+		nb = &s->neighbor[i];
+		printf("neighbor: %s\n"
+		       "ul: p = %.1f, q = %.1f\n"
+		       "dl: p = %.1f, q = %.1f\n"
+		       "redundancy\t%.2f\n\n",
+		       mac(nb->hwaddr, a), nb->ulp, nb->ulq, nb->dlp, nb->dlq,
+		       nb->redundancy);
+	}
+}
+
+static void
+print_json(const struct stats_shm *s)
+{
+	const struct stats_session *ss;
+	const struct stats_neighbor *nb;
+	char a[18], b[18];
+	u32 i;
+	int j;
+
+	printf("{\"pid\": %u, \"updates\": %llu, \"qdelay\": %g, "
+	       "\"qdelay_loss\": %g, \"qdelay_packets\": %u, \"sessions\": [",
+	       s->pid, (unsigned long long)s->global.updates,
+	       s->global.qdelay, s->global.qdelay_loss,
+	       s->global.qdelay_packets);
+
+	for (i = 0; i < s->sessions; i++)
+	{
+		ss = &s->session[i];
+		printf("%s{\"master\": \"%s\", \"slave\": \"%s\", \"tc\": %u, "
+		       "\"count\": %u, \"tx_data\": %u, \"tx_ack\": %u, "
+		       "\"tx_redundant\": %u, \"rx_data\": %u, \"rx_ack\": %u, "
+		       "\"rx_excess_data\": %u, \"rx_late_data\": %u, "
+		       "\"rx_late_ack\": %u, \"redundancy\": %g, "
+		       "\"uplink\": %g, \"p\": %d, \"q\": %d, \"downlink\": %g, "
+		       "\"gensize\": %d, \"latency\": %g, \"srtt\": %g, "
+		       "\"rttvar\": %g, \"rto\": %g, \"link\": \"%s\"",
+		       i ? ", " : "", mac(ss->master, a), mac(ss->slave, b),
+		       ss->tc, ss->count, ss->tx_data, ss->tx_ack,
+		       ss->tx_redundant, ss->rx_data, ss->rx_ack,
+		       ss->rx_excess_data, ss->rx_late_data, ss->rx_late_ack,
+		       ss->redundancy, ss->uplink, ss->p, ss->q, ss->downlink,
+		       ss->gensize, ss->latency, ss->srtt, ss->rttvar, ss->rto,
+		       link_name(ss->link));
+		if (ss->jsm)
+			printf(", \"jsm\": {\"ipt_avg\": %g, \"ipt_timer\": %g, "
+			       "\"backlog\": %u, \"backlog_target\": %g}",
+			       ss->jsm_ipt_avg, ss->jsm_ipt_timer,
+			       ss->jsm_backlog, ss->jsm_backlog_target);
+		for (j = 0; j < STATS_HISTS; j++)
+			print_hist_json(&ss->hist[j], hist_names[j]);
+		printf("}");
+	}
+
+	printf("], \"neighbors\": [");
+
+	for (i = 0; i < s->neighbors; i++)
+	{
+		nb = &s->neighbor[i];
+		printf("%s{\"hwaddr\": \"%s\", \"ulp\": %g, \"ulq\": %g, "
+		       "\"dlp\": %g, \"dlq\": %g, \"redundancy\": %g}",
+		       i ? ", " : "", mac(nb->hwaddr, a), nb->ulp, nb->ulq,
+		       nb->dlp, nb->dlq, nb->redundancy);
+	}
+
+	printf("]}\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct stats_shm copy;
+	const struct stats_shm *shm;
+	struct stat st;
+	char name[32];
+	int fd;
+
+	argp_parse(&argp, argc, argv, 0, NULL, NULL);
+
+	if (!cfg.pid && 0 > (cfg.pid = find_pid()))
+		return EXIT_FAILURE;
+
+	snprintf(name, sizeof(name), "%s%d", STATS_SHM_PREFIX, cfg.pid);
+	if (0 > (fd = shm_open(name, O_RDONLY, 0)))
+	{
+		fprintf(stderr, "ncmstat: %s: %s\n", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (0 > fstat(fd, &st) || st.st_size != sizeof(*shm))
+	{
+		fprintf(stderr, "ncmstat: %s has an unknown layout\n", name);
+		return EXIT_FAILURE;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+	{
+		fprintf(stderr, "ncmstat: mmap() failed: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+	    shm->version != STATS_VERSION || shm->size != sizeof(*shm))
+	{
+		fprintf(stderr, "ncmstat: %s has an unknown layout\n", name);
+		return EXIT_FAILURE;
+	}
+
+	do
+	{
+		if (0 > snapshot(shm, &copy))
+		{
+			fprintf(stderr, "ncmstat: no consistent snapshot\n");
+			return EXIT_FAILURE;
+		}
+
+		if (cfg.json)
+			print_json(&copy);
+		else
+			print_text(&copy);
+		fflush(stdout);
+	} while (cfg.interval && !usleep(cfg.interval * 1000));
+
+	return EXIT_SUCCESS;
+}
@@ -1,13 +1,72 @@
 #include <netinet/ether.h>
+#include <math.h>
 
 #include "neighbor.h"
 #include "ralqe.h"
+#include "dtree.h"
 
 #define NB_COMMIT 1000
 #define NB_TIMEOUT 60000
 
 float ralqe_theta = RALQE_THETA;
 
+/*
+ * Ring of the last NB_WINDOW values with running sums, so mean and variance
+ * are updated in O(1) per frame. Values are small integers, hence the sums are
+ * exact and do not drift.
+ */
+struct nb_window
+{
+	int v[NB_WINDOW];
+	int pos;
+	int count;
+	int sum;
+	int sq;
+	double ewma;
+};
+
+static void
+window_add(struct nb_window *w, int v)
+{
+	if (w->count == NB_WINDOW)
+	{
+		w->sum -= w->v[w->pos];
+		w->sq -= w->v[w->pos] * w->v[w->pos];
+	}
+	else
+	{
+		w->count++;
+	}
+
+	w->v[w->pos] = v;
+	w->sum += v;
+	w->sq += v * v;
+	w->pos = (w->pos + 1) % NB_WINDOW;
+
+	if (w->count == 1)
+		w->ewma = v;
+	else
+		w->ewma += NB_FEATURE_EWMA * (v - w->ewma);
+}
+
+static float
+window_avg(const struct nb_window *w)
+{
+	return w->count ? (float)w->sum / w->count : 0;
+}
+
+static float
+window_std(const struct nb_window *w)
+{
+	double var;
+
+	if (w->count < 2)
+		return 0;
+
+	var = (w->sq - (double)w->sum * w->sum / w->count) / (w->count - 1);
+	return sqrt(max(var, 0.0));
+}
+
 struct neighbor
 {
 	struct list_head list;
@@ -21,6 +80,11 @@ struct neighbor
 	ralqe_link_t ul;
 	ralqe_link_t dl;
 	double ulq;
+
+	struct nb_window rssi;
+	struct nb_window retries;
+	u32 rx;		// one bit per transmission, set if received
+	int tx;		// transmissions seen, up to NB_WINDOW
 };
 
 LIST_HEAD(nl);
@@ -171,6 +235,10 @@ int nb_update_seq(const u8 *hwaddr, u16 seq)
 		return 0;
 	}
 	nb->lseq = seq;
+
+	nb->rx = q + 1 < NB_WINDOW ? nb->rx << (q + 1) | 1 : 1;
+	nb->tx = min(nb->tx + q + 1, NB_WINDOW);
+
 	ralqe_update(nb->dl, &p, &q);
 
 	timeout_settime(nb->task.timeout, 0, timeout_msec(NB_TIMEOUT, 0));
@@ -194,6 +262,105 @@ int nb_update_ul(const u8 *hwaddr, int p, int q)
 	return 0;
 }
 
+int nb_seed(const u8 *hwaddr, int ulp, int ulq, int dlp, int dlq)
+{
+	struct neighbor *nb;
+
+	if (!(nb = find(hwaddr)))
+	{
+		if (0 > nb_add(hwaddr))
+			DIE("nb_add() failed where it must not");
+		if (!(nb = find(hwaddr)))
+			DIE("nb_find() failed where it must not");
+	}
+
+	ralqe_init(nb->ul, ulp, ulq);
+	ralqe_init(nb->dl, dlp, dlq);
+
+	// Do not wait for the next commit to use the seeded estimate
+	nb->ulq = ralqe_redundancy(nb->ul, ralqe_theta);
+
+	return 0;
+}
+
+int nb_restore(const u8 *hwaddr, double ulp, double ulq, double dlp,
+			   double dlq, double age)
+{
+	struct neighbor *nb;
+
+	if (!(nb = find(hwaddr)))
+	{
+		if (0 > nb_add(hwaddr))
+			DIE("nb_add() failed where it must not");
+		if (!(nb = find(hwaddr)))
+			DIE("nb_find() failed where it must not");
+	}
+
+	ralqe_set(nb->ul, ulp, ulq, age);
+	ralqe_set(nb->dl, dlp, dlq, age);
+	nb->ulq = ralqe_redundancy(nb->ul, ralqe_theta);
+
+	return 0;
+}
+
+static void
+fill_features(const struct neighbor *nb, struct nb_features *f)
+{
+	if (nb->rssi.count)
+		f->rssi = nb->rssi.v[(nb->rssi.pos + NB_WINDOW - 1) % NB_WINDOW];
+	f->rssi_avg = window_avg(&nb->rssi);
+	f->rssi_std = window_std(&nb->rssi);
+	f->rssi_ewma = nb->rssi.ewma;
+	if (nb->tx)
+		f->prr = (float)__builtin_popcount(nb->rx & (BIT(nb->tx) - 1)) /
+			 nb->tx;
+	f->retries_avg = window_avg(&nb->retries);
+	f->retries_std = window_std(&nb->retries);
+	f->retries_ewma = nb->retries.ewma;
+}
+
+int nb_update_rx(const u8 *hwaddr, const struct moep80211_radiotap *rt,
+		 struct nb_features *f)
+{
+	struct neighbor *nb;
+
+	if (f)
+		memset(f, 0, sizeof(*f));
+
+	if (!(nb = find(hwaddr)))
+	{
+		errno = ENODEV;
+		return -1;
+	}
+
+	if (rt->hdr.it_present & BIT(IEEE80211_RADIOTAP_DBM_ANTSIGNAL))
+		window_add(&nb->rssi, dtree_rssi(rt->signal));
+	if (rt->hdr.it_present & BIT(IEEE80211_RADIOTAP_DATA_RETRIES))
+		window_add(&nb->retries, rt->data_retries);
+
+	if (f)
+		fill_features(nb, f);
+
+	return 0;
+}
+
+int nb_features(const u8 *hwaddr, struct nb_features *f)
+{
+	struct neighbor *nb;
+
+	memset(f, 0, sizeof(*f));
+
+	if (!(nb = find(hwaddr)))
+	{
+		errno = ENODEV;
+		return -1;
+	}
+
+	fill_features(nb, f);
+
+	return 0;
+}
+
 double
 nb_ul_redundancy(const u8 *hwaddr)
 {
@@ -278,3 +445,21 @@ int nb_fill_dl(nb_dl_filler_t filler, void *data)
 
 	return i;
 }
+
+int nb_fill_state(nb_state_filler_t filler, void *data)
+{
+	struct neighbor *nb;
+	double ulp, ulq, dlp, dlq;
+	int i;
+
+	i = 0;
+	list_for_each_entry(nb, &nl, list)
+	{
+		ralqe_get(nb->ul, &ulp, &ulq);
+		ralqe_get(nb->dl, &dlp, &dlq);
+		filler(data, i, nb->hwaddr, ulp, ulq, dlp, dlq);
+		i++;
+	}
+
+	return i;
+}
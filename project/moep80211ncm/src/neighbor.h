@@ -5,21 +5,60 @@
 #include <moepcommon/list.h>
 #include <moepcommon/timeout.h>
 
+#include <moep/radiotap.h>
+
 #include "global.h"
 #include "ralqe.h"
 
 extern float ralqe_theta;
 
+/**
+ * Rolling link features of a neighbor, computed like the training pipeline
+ * does over the last NB_WINDOW frames. RSSI is in the scale of the training
+ * data, see dtree_rssi(), invalid samples are masked as 0. PRR is the share of received frames among the last
+ * NB_WINDOW transmissions of the neighbor, derived from txseq gaps. Standard
+ * deviations are sample deviations over the window, 0 while it holds fewer
+ * than two values.
+ */
+struct nb_features
+{
+	int rssi;
+	float rssi_avg;
+	float rssi_std;
+	float rssi_ewma;
+	float prr;
+	float retries_avg;
+	float retries_std;
+	float retries_ewma;
+};
+
 
 int nb_exists(const u8 *hwaddr);
 int nb_add(const u8 *hwaddr);
 int nb_del(const u8 *hwaddr);
 int nb_update_seq(const u8 *hwaddr, u16 seq);
 int nb_update_ul(const u8 *hwaddr, int p, int q);
+/* Replaces the uplink and downlink estimates, e.g. with the outcome of a probe
+ * burst, creating the neighbor if needed. */
+int nb_seed(const u8 *hwaddr, int ulp, int ulq, int dlp, int dlq);
+/* Like nb_seed(), but for an estimate taken age seconds ago, which is decayed
+ * accordingly. */
+int nb_restore(const u8 *hwaddr, double ulp, double ulq, double dlp,
+	       double dlq, double age);
+/* Updates the rolling signal and retry features with a received frame. Call
+ * after nb_update_seq(), fields missing in the radiotap header are skipped. If
+ * f is not NULL, it is filled with the updated features like nb_features()
+ * does, which saves another lookup of the neighbor. */
+int nb_update_rx(const u8 *hwaddr, const struct moep80211_radiotap *rt,
+		 struct nb_features *f);
+int nb_features(const u8 *hwaddr, struct nb_features *f);
 double nb_ul_redundancy(const u8 *hwaddr);
 double nb_ul_quality(const u8 *hwaddr, int *p, int *q);
 double nb_dl_quality(const u8 *hwaddr, int *p, int *q);
 typedef void (*nb_dl_filler_t)(void *data, int i, u8 *hwaddr, int p, int q);
 int nb_fill_dl(nb_dl_filler_t filler, void *data);
+typedef void (*nb_state_filler_t)(void *data, int i, const u8 *hwaddr,
+				  double ulp, double ulq, double dlp, double dlq);
+int nb_fill_state(nb_state_filler_t filler, void *data);
 
 #endif
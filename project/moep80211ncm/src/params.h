@@ -22,6 +22,14 @@ struct params_jsm {
 struct params_session {
 	int			gensize;
 	int			winsize;
+	size_t			pdusize;
+	int			hugepages;
+	int			max_forward;
+	int			out_of_order;
+	int			priority;
+	int			flush;
+	int			adapt;
+	int			unidir;
 	int			rscheme;
 	float			theta;
 	enum MOEPGF_TYPE	gftype;
@@ -31,6 +39,7 @@ struct params_wireless {
 	u64	freq0;
 	u64	freq1;
 	u64	moep_chan_width;
+	int	ring;
 	struct {
 		u32	it_present;
 		u8	rate;
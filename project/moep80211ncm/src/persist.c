@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <moep/system.h>
+#include <moep/types.h>
+#include <moep/ieee80211_addr.h>
+
+#include <moepcommon/list.h>
+#include <moepcommon/util.h>
+#include <moepcommon/timeout.h>
+
+#include "generation.h"
+#include "session.h"
+#include "persist.h"
+#include "neighbor.h"
+#include "linkstate.h"
+
+struct persist_neighbor
+{
+	u8 hwaddr[IEEE80211_ALEN];
+	double ulp, ulq;
+	double dlp, dlq;
+};
+
+struct persist_link
+{
+	u8 ta[IEEE80211_ALEN];
+	u8 ra[IEEE80211_ALEN];
+	double p, q;
+};
+
+struct persist_session
+{
+	u8 sid[2 * IEEE80211_ALEN];
+	u8 tc;
+	int gensize; // 0 for records already restored
+	double latency;
+	double srtt;
+	double rttvar;
+};
+
+/*
+ * Layout of the state file. The magic is cleared before and set after every
+ * update, so a file left behind by a crash in the middle of persist_save() is
+ * ignored on the next start instead of being half applied.
+ */
+struct persist_file
+{
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 neighbors;
+	u32 links;
+	u32 sessions;
+	u64 saved; // CLOCK_REALTIME in ns, which unlike CLOCK_MONOTONIC
+		   // keeps counting across restarts
+	struct persist_neighbor nb[PERSIST_MAX_NEIGHBORS];
+	struct persist_link ls[PERSIST_MAX_LINKS];
+	struct persist_session s[PERSIST_MAX_SESSIONS];
+};
+
+static struct
+{
+	int fd;
+	struct persist_file *file;
+	timeout_t save;
+	struct persist_session sessions[PERSIST_MAX_SESSIONS];
+	int session_count;
+} state = {.fd = -1};
+
+static u64
+realtime_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+nb_filler(void *data, int i, const u8 *hwaddr, double ulp, double ulq,
+		  double dlp, double dlq)
+{
+	struct persist_file *f = data;
+
+	if (i >= PERSIST_MAX_NEIGHBORS)
+		return;
+
+	memcpy(f->nb[i].hwaddr, hwaddr, IEEE80211_ALEN);
+	f->nb[i].ulp = ulp;
+	f->nb[i].ulq = ulq;
+	f->nb[i].dlp = dlp;
+	f->nb[i].dlq = dlq;
+}
+
+static void
+ls_filler(void *data, int i, const u8 *ta, const u8 *ra, double p, double q)
+{
+	struct persist_file *f = data;
+
+	if (i >= PERSIST_MAX_LINKS)
+		return;
+
+	memcpy(f->ls[i].ta, ta, IEEE80211_ALEN);
+	memcpy(f->ls[i].ra, ra, IEEE80211_ALEN);
+	f->ls[i].p = p;
+	f->ls[i].q = q;
+}
+
+static void
+session_filler(void *data, int i, const session_t s)
+{
+	struct persist_file *f = data;
+
+	if (i >= PERSIST_MAX_SESSIONS)
+		return;
+
+	memcpy(f->s[i].sid, s->sid, sizeof(f->s[i].sid));
+	f->s[i].tc = s->tc;
+	f->s[i].gensize = s->gensize;
+	f->s[i].latency = s->latency;
+	f->s[i].srtt = s->srtt;
+	f->s[i].rttvar = s->rttvar;
+}
+
+static void
+persist_write(int flags)
+{
+	struct persist_file *f = state.file;
+
+	__atomic_store_n(&f->magic, 0, __ATOMIC_SEQ_CST);
+
+	f->version = PERSIST_VERSION;
+	f->size = sizeof(*f);
+	f->neighbors = min(nb_fill_state(nb_filler, f), PERSIST_MAX_NEIGHBORS);
+	f->links = min(ls_fill_state(ls_filler, f), PERSIST_MAX_LINKS);
+	f->sessions = min(session_fill_state(session_filler, f),
+					  PERSIST_MAX_SESSIONS);
+	f->saved = realtime_ns();
+
+	__atomic_store_n(&f->magic, PERSIST_MAGIC, __ATOMIC_SEQ_CST);
+
+	if (0 > msync(f, sizeof(*f), flags))
+		LOG(LOG_WARNING, "persist: msync() failed: %s", strerror(errno));
+}
+
+void persist_save()
+{
+	if (state.file)
+		persist_write(MS_ASYNC);
+}
+
+static int
+cb_save(timeout_t t, u32 overrun, void *data)
+{
+	(void)t;
+	(void)overrun;
+	(void)data;
+
+	persist_save();
+	return 0;
+}
+
+static void
+persist_load(const struct persist_file *f)
+{
+	double age;
+	int i, n;
+
+	if (f->magic != PERSIST_MAGIC || f->version != PERSIST_VERSION ||
+		f->size != sizeof(*f))
+	{
+		LOG(LOG_INFO, "persist: no usable state, starting cold");
+		return;
+	}
+
+	age = ((double)realtime_ns() - (double)f->saved) / 1000000000.0;
+
+	n = min(f->neighbors, (u32)PERSIST_MAX_NEIGHBORS);
+	for (i = 0; i < n; i++)
+	{
+		(void)nb_restore(f->nb[i].hwaddr, f->nb[i].ulp, f->nb[i].ulq,
+						 f->nb[i].dlp, f->nb[i].dlq, age);
+	}
+
+	n = min(f->links, (u32)PERSIST_MAX_LINKS);
+	for (i = 0; i < n; i++)
+		(void)ls_restore(f->ls[i].ta, f->ls[i].ra, f->ls[i].p, f->ls[i].q, age);
+
+	// Session parameters do not decay, so old ones are dropped instead
+	state.session_count = 0;
+	if (age <= PERSIST_MAX_AGE)
+	{
+		state.session_count = min(f->sessions, (u32)PERSIST_MAX_SESSIONS);
+		memcpy(state.sessions, f->s,
+			   state.session_count * sizeof(*state.sessions));
+	}
+
+	LOG(LOG_INFO, "persist: restored %u neighbors, %u links and %d sessions "
+				  "saved %.1f s ago",
+		f->neighbors, f->links, state.session_count, age);
+}
+
+int persist_open(const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd, valid;
+
+	if (0 > (fd = open(path, O_RDWR | O_CREAT, 0644)))
+		return -1;
+
+	if (0 > fstat(fd, &st))
+		goto fail;
+
+	// A file of another size is from another build, start over with zeros
+	valid = st.st_size == sizeof(struct persist_file);
+	if (!valid && (0 > ftruncate(fd, 0) ||
+				   0 > ftruncate(fd, sizeof(struct persist_file))))
+		goto fail;
+
+	map = mmap(NULL, sizeof(struct persist_file), PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	state.fd = fd;
+	state.file = map;
+
+	if (valid)
+		persist_load(state.file);
+
+	if (0 > timeout_create(CLOCK_MONOTONIC, &state.save, cb_save, NULL))
+		DIE("timeout_create() failed: %s", strerror(errno));
+	timeout_settime(state.save, 0,
+					timeout_msec(PERSIST_INTERVAL, PERSIST_INTERVAL));
+
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+void persist_close()
+{
+	if (!state.file)
+		return;
+
+	timeout_delete(state.save);
+	persist_write(MS_SYNC);
+
+	munmap(state.file, sizeof(*state.file));
+	close(state.fd);
+	state.file = NULL;
+	state.fd = -1;
+}
+
+void persist_restore_session(struct session *s)
+{
+	struct persist_session *r;
+	int i;
+
+	for (i = 0; i < state.session_count; i++)
+	{
+		r = &state.sessions[i];
+		if (!r->gensize || r->tc != s->tc ||
+			memcmp(r->sid, s->sid, sizeof(r->sid)))
+			continue;
+
+		if (session_adaptive(s))
+			s->gensize = max(GENERATION_ADAPT_MIN_SIZE,
+							 min(r->gensize, s->params.gensize)) & ~1;
+		s->latency = r->latency;
+		s->srtt = r->srtt;
+		s->rttvar = r->rttvar;
+
+		r->gensize = 0;
+		return;
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef __PERSIST_H
+#define __PERSIST_H
+
+#include "global.h"
+
+struct session;
+
+/*
+ * Keeps the RALQE estimates of neighbors and links and the learned parameters
+ * of sessions in a state file, so that a restarted NCM does not start from
+ * empty estimates. The file is mapped and rewritten every PERSIST_INTERVAL
+ * and on persist_close(). persist_open() restores neighbors and links right
+ * away, decayed by the time since the file was written, while sessions pick up
+ * their parameters from persist_restore_session() when they are registered.
+ */
+int persist_open(const char *path);
+void persist_close();
+
+// Writes the current state to the file
+void persist_save();
+
+// Applies the saved parameters of the same sid and tc to a new session
+void persist_restore_session(struct session *s);
+
+#endif
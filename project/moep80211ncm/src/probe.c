@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <time.h>
+#include <netinet/ether.h>
+
+#include <moep/system.h>
+#include <moep/ieee80211_addr.h>
+#include <moep/modules/moep80211.h>
+
+#include <moepcommon/util.h>
+#include <moepcommon/timeout.h>
+
+#include "ncm.h"
+#include "probe.h"
+
+static const int probe_sizes[] = PROBE_SIZES;
+
+#define PROBE_SIZE_COUNT (sizeof(probe_sizes) / sizeof(probe_sizes[0]))
+
+/*
+ * State of the outstanding burst. Probing happens once at startup and is
+ * driven by the main loop only, hence there is no locking.
+ */
+static struct
+{
+	int active;
+	int sending;
+	u8 peer[IEEE80211_ALEN];
+	u8 burst;
+	int mcs[PROBE_MAX_MCS];
+	int mcs_count;
+	struct
+	{
+		int sent;
+		int replies;
+	} per_mcs[PROBE_MAX_MCS];
+
+	int sent;
+	int rcvd;
+	int replies;
+	double rtt;
+	long signal;
+	int signals;
+
+	timeout_t timeout;
+	probe_cb_t cb;
+	void *data;
+} prober;
+
+/*
+ * Number of requests received per peer within its latest burst, reported back
+ * in every reply. Peers beyond PROBE_MAX_PEERS replace the oldest entry.
+ */
+static struct
+{
+	u8 peer[IEEE80211_ALEN];
+	u8 burst;
+	u16 rcvd;
+} responders[PROBE_MAX_PEERS];
+
+static int responder_next;
+
+static u64
+now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+send_probe(const u8 *ra, const struct ncm_hdr_probe *tmpl, size_t len, int mcs)
+{
+	static u8 pad[PROBE_MAX_SIZE];
+	struct moep80211_hdr *hdr;
+	struct ncm_hdr_probe *probe;
+	moep_frame_t frame;
+	int ret = -1;
+
+	if (!(frame = create_rad_frame()))
+		return -1;
+
+	if (!(hdr = moep_frame_moep80211_hdr(frame)))
+		goto end;
+	memcpy(hdr->ra, ra, IEEE80211_ALEN);
+
+	if (!(probe = (void *)moep_frame_add_moep_hdr_ext(frame, NCM_HDR_PROBE,
+							   sizeof(*probe))))
+		goto end;
+	memcpy((u8 *)probe + sizeof(probe->hdr), (const u8 *)tmpl +
+	       sizeof(tmpl->hdr), sizeof(*probe) - sizeof(probe->hdr));
+
+	if (!moep_frame_set_payload(frame, pad, min(len, sizeof(pad))))
+		goto end;
+
+	ret = rad_tx_mcs(frame, mcs);
+
+end:
+	moep_frame_destroy(frame);
+	return ret;
+}
+
+static void
+probe_finish()
+{
+	struct probe_result r;
+	int i;
+
+	prober.active = 0;
+	timeout_settime(prober.timeout, 0, NULL);
+
+	r.sent = prober.sent;
+	r.rcvd = prober.rcvd;
+	r.replies = prober.replies;
+	r.rtt = prober.replies ? prober.rtt / prober.replies : 0;
+	r.signal = prober.signals ? prober.signal / prober.signals : 0;
+
+	r.mcs = -1;
+	for (i = 0; i < prober.mcs_count; i++)
+	{
+		if (!prober.per_mcs[i].sent || prober.mcs[i] < r.mcs)
+			continue;
+		if ((double)prober.per_mcs[i].replies /
+		    prober.per_mcs[i].sent >= PROBE_MIN_PRR)
+			r.mcs = prober.mcs[i];
+	}
+
+	LOG(LOG_INFO, "probe: %s: %d/%d requests, %d replies, rtt %.2f ms, "
+		"signal %d dBm, mcs %d",
+		ether_ntoa((const struct ether_addr *)prober.peer),
+		r.rcvd, r.sent, r.replies, r.rtt, r.signal, r.mcs);
+
+	if (prober.cb)
+		prober.cb(prober.peer, &r, prober.data);
+}
+
+static int
+cb_probe_timeout(timeout_t t, u32 overrun, void *data)
+{
+	(void)t;
+	(void)overrun;
+	(void)data;
+
+	if (prober.active)
+		probe_finish();
+	return 0;
+}
+
+int probe_start(const u8 *peer, const int *mcs, int mcs_count, probe_cb_t cb,
+		void *data)
+{
+	struct ncm_hdr_probe req;
+	int i, j, k;
+
+	if (prober.active)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	if (mcs_count < 1 || mcs_count > PROBE_MAX_MCS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!prober.timeout && 0 > timeout_create(CLOCK_MONOTONIC,
+						  &prober.timeout, cb_probe_timeout, NULL))
+		DIE("timeout_create() failed: %s", strerror(errno));
+
+	memset(prober.per_mcs, 0, sizeof(prober.per_mcs));
+	memcpy(prober.peer, peer, IEEE80211_ALEN);
+	memcpy(prober.mcs, mcs, mcs_count * sizeof(*mcs));
+	prober.mcs_count = mcs_count;
+	prober.burst++;
+	prober.sent = 0;
+	prober.rcvd = 0;
+	prober.replies = 0;
+	prober.rtt = 0;
+	prober.signal = 0;
+	prober.signals = 0;
+	prober.cb = cb;
+	prober.data = data;
+	prober.active = 1;
+	prober.sending = 1;
+
+	memset(&req, 0, sizeof(req));
+	req.type = PROBE_REQUEST;
+	req.burst = prober.burst;
+
+	// Interleave sizes and rates so that a short fade hits all of them alike
+	for (k = 0; k < PROBE_REPEAT; k++)
+	{
+		for (j = 0; j < (int)PROBE_SIZE_COUNT; j++)
+		{
+			for (i = 0; i < mcs_count; i++)
+			{
+				req.seq = prober.sent;
+				req.mcs = mcs[i];
+				req.ts = now_ns();
+				if (0 > send_probe(peer, &req, probe_sizes[j], mcs[i]))
+					continue;
+				prober.per_mcs[i].sent++;
+				prober.sent++;
+			}
+		}
+	}
+
+	prober.sending = 0;
+
+	if (prober.replies == prober.sent)
+		probe_finish();
+	else
+		timeout_settime(prober.timeout, 0,
+				timeout_msec(PROBE_TIMEOUT, 0));
+	return 0;
+}
+
+static void
+probe_reply(const u8 *ta, const struct ncm_hdr_probe *req,
+	    const struct moep80211_radiotap *rt)
+{
+	struct ncm_hdr_probe rep;
+	int i;
+
+	for (i = 0; i < PROBE_MAX_PEERS; i++)
+	{
+		if (!memcmp(responders[i].peer, ta, IEEE80211_ALEN))
+			break;
+	}
+	if (i == PROBE_MAX_PEERS)
+	{
+		i = responder_next;
+		responder_next = (responder_next + 1) % PROBE_MAX_PEERS;
+		memcpy(responders[i].peer, ta, IEEE80211_ALEN);
+		responders[i].burst = req->burst - 1;
+	}
+	if (responders[i].burst != req->burst)
+	{
+		responders[i].burst = req->burst;
+		responders[i].rcvd = 0;
+	}
+	responders[i].rcvd++;
+
+	rep = *req;
+	rep.type = PROBE_REPLY;
+	rep.rcvd = responders[i].rcvd;
+	rep.signal = 0;
+	if (rt && rt->hdr.it_present & BIT(IEEE80211_RADIOTAP_DBM_ANTSIGNAL))
+		rep.signal = rt->signal;
+
+	(void)send_probe(ta, &rep, PROBE_REPLY_SIZE, -1);
+}
+
+static void
+probe_account(const u8 *ta, const struct ncm_hdr_probe *rep)
+{
+	int i;
+
+	if (!prober.active || rep->burst != prober.burst ||
+	    memcmp(ta, prober.peer, IEEE80211_ALEN))
+		return;
+
+	prober.replies++;
+	prober.rcvd = max(prober.rcvd, (int)rep->rcvd);
+	prober.rtt += (double)(now_ns() - rep->ts) / 1000000.0;
+	if (rep->signal)
+	{
+		prober.signal += rep->signal;
+		prober.signals++;
+	}
+
+	for (i = 0; i < prober.mcs_count; i++)
+	{
+		if ((u8)prober.mcs[i] == rep->mcs)
+		{
+			prober.per_mcs[i].replies++;
+			break;
+		}
+	}
+
+	if (!prober.sending && prober.replies == prober.sent)
+		probe_finish();
+}
+
+void probe_rx(const u8 *ta, const u8 *ra, const struct ncm_hdr_probe *probe,
+	      const struct moep80211_radiotap *rt)
+{
+	if (memcmp(ra, ncm_get_local_hwaddr(), IEEE80211_ALEN))
+		return;
+
+	switch (probe->type)
+	{
+	case PROBE_REQUEST:
+		probe_reply(ta, probe, rt);
+		break;
+	case PROBE_REPLY:
+		probe_account(ta, probe);
+		break;
+	default:
+		LOG(LOG_WARNING, "probe: invalid probe type %d", probe->type);
+	}
+}
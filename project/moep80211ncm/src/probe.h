@@ -0,0 +1,43 @@
+#ifndef __PROBE_H_
+#define __PROBE_H_
+
+#include <moep/types.h>
+#include <moep/radiotap.h>
+
+#include "global.h"
+#include "frametypes.h"
+
+/*
+ * Result of a probe burst. Requests lost on the way to the peer (uplink) and
+ * replies lost on the way back (downlink) are told apart by the number of
+ * requests the peer reports to have received.
+ */
+struct probe_result {
+	int sent;	// requests sent
+	int rcvd;	// requests received by the peer
+	int replies;	// replies received
+	double rtt;	// mean round trip time in ms, 0 without replies
+	int signal;	// mean signal of the requests at the peer in dBm
+	int mcs;	// highest MCS with PROBE_MIN_PRR round trip delivery, or -1
+};
+
+typedef void (*probe_cb_t)(const u8 *peer, const struct probe_result *r,
+								void *data);
+
+/*
+ * Sends a burst of PROBE_REPEAT requests per MCS in mcs[] and size in
+ * PROBE_SIZES to peer. A negative MCS sends at the configured rate. Once all
+ * replies are in, or after PROBE_TIMEOUT ms, cb is called with the result.
+ * Only one burst is outstanding at a time.
+ */
+int probe_start(const u8 *peer, const int *mcs, int mcs_count, probe_cb_t cb,
+								void *data);
+
+/*
+ * Handles a received probe frame: requests for this node are answered, replies
+ * are accounted to the outstanding burst. rt may be NULL.
+ */
+void probe_rx(const u8 *ta, const u8 *ra, const struct ncm_hdr_probe *probe,
+				const struct moep80211_radiotap *rt);
+
+#endif
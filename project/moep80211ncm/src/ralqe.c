@@ -6,12 +6,26 @@
 
 #include <moepcommon/util.h>
 
+#include <moepgf/moepgf.h>
+
 #include "global.h"
 #include "ralqe.h"
 
 
+/*
+ * Returns the number of coded packets per source packet needed to decode a
+ * generation with probability thresh, given p received and q lost packets on
+ * the link. Iteration j updates the probabilities s[i] of having
+ * received i packets after j transmissions, which is a multiplication by
+ *
+ *	f(i,j) = (p+j)/(p+q+j+1)			if j <= i
+ *	f(i,j) = (q+j-i)*j/((j-i)*(p+q+j+1))		otherwise
+ *
+ * The SIMD variants compute the same factors lane by lane and differ from the
+ * scalar one only in the order the probabilities are summed up.
+ */
 static double
-numpackets_stable(int p, int q, double thresh)
+numpackets_stable_scalar(int p, int q, double thresh)
 {
 	int i,j;
 	double sum, p1, pqj1;
@@ -39,100 +53,157 @@ numpackets_stable(int p, int q, double thresh)
 	return (double)j/GENERATION_SIZE;
 }
 
+#ifdef __x86_64__
+/* Lanes with j <= i divide by zero, which is harmless since the blend replaces
+ * their result by p1 anyway. */
+__attribute__((target("sse2")))
+static double
+numpackets_stable_sse2(int p, int q, double thresh)
+{
+	int j, k;
+	double sum, sr[2];
+	double s[GENERATION_SIZE] __attribute__((aligned(16)));
+	__m128d i, jj, p1, pqj1, qj, f, d, m, acc, v;
+	const __m128d c2 = _mm_set1_pd(2.0);
+
+	for (k=0; k<GENERATION_SIZE; k+=2)
+		_mm_store_pd(&s[k], _mm_set1_pd(1.0));
+
+	sum = 1.0;
+	for (j=1; (1.0-sum)<thresh; j++) {
+		acc  = _mm_setzero_pd();
+		i    = _mm_set_pd(1.0, 0.0);
+		jj   = _mm_set1_pd(j);
+		pqj1 = _mm_set1_pd(p+q+j+1);
+		qj   = _mm_set1_pd(q+j);
+		p1   = _mm_set1_pd((double)(p+j)/(double)(p+q+j+1));
+
+		for (k=0; k<GENERATION_SIZE; k+=2) {
+			f = _mm_mul_pd(_mm_sub_pd(qj, i), jj);
+			d = _mm_mul_pd(_mm_sub_pd(jj, i), pqj1);
+			f = _mm_div_pd(f, d);
+			m = _mm_cmple_pd(jj, i);
+			f = _mm_or_pd(_mm_and_pd(m, p1), _mm_andnot_pd(m, f));
+
+			v = _mm_mul_pd(_mm_load_pd(&s[k]), f);
+			_mm_store_pd(&s[k], v);
+			acc = _mm_add_pd(acc, v);
+			i = _mm_add_pd(i, c2);
+		}
+
+		_mm_storeu_pd(sr, acc);
+		sum = sr[0] + sr[1];
+	}
+
+	return (double)j/GENERATION_SIZE;
+}
+
+__attribute__((target("avx2")))
+static double
+numpackets_stable_avx2(int p, int q, double thresh)
+{
+	int j, k;
+	double sum, sr[4];
+	double s[GENERATION_SIZE] __attribute__((aligned(32)));
+	__m256d i, jj, p1, pqj1, qj, f, d, m, acc, v;
+	const __m256d c4 = _mm256_set1_pd(4.0);
+
+	for (k=0; k<GENERATION_SIZE; k+=4)
+		_mm256_store_pd(&s[k], _mm256_set1_pd(1.0));
+
+	sum = 1.0;
+	for (j=1; (1.0-sum)<thresh; j++) {
+		acc  = _mm256_setzero_pd();
+		i    = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+		jj   = _mm256_set1_pd(j);
+		pqj1 = _mm256_set1_pd(p+q+j+1);
+		qj   = _mm256_set1_pd(q+j);
+		p1   = _mm256_set1_pd((double)(p+j)/(double)(p+q+j+1));
+
+		for (k=0; k<GENERATION_SIZE; k+=4) {
+			f = _mm256_mul_pd(_mm256_sub_pd(qj, i), jj);
+			d = _mm256_mul_pd(_mm256_sub_pd(jj, i), pqj1);
+			f = _mm256_div_pd(f, d);
+			m = _mm256_cmp_pd(jj, i, _CMP_LE_OQ);
+			f = _mm256_blendv_pd(f, p1, m);
+
+			v = _mm256_mul_pd(_mm256_load_pd(&s[k]), f);
+			_mm256_store_pd(&s[k], v);
+			acc = _mm256_add_pd(acc, v);
+			i = _mm256_add_pd(i, c4);
+		}
+
+		_mm256_storeu_pd(sr, acc);
+		sum = (sr[0] + sr[1]) + (sr[2] + sr[3]);
+	}
+
+	return (double)j/GENERATION_SIZE;
+}
+#endif
+
+static double (*numpackets_stable_impl)(int, int, double);
+
+/* Picks the fastest implementation the CPU supports, using the same detection
+ * as libmoepgf. */
+static void
+numpackets_stable_select()
+{
+	numpackets_stable_impl = numpackets_stable_scalar;
+
+#ifdef __x86_64__
+	uint32_t hwcaps = moepgf_check_available_simd_extensions();
+
+	if (hwcaps & (1 << MOEPGF_HWCAPS_SIMD_AVX2))
+		numpackets_stable_impl = numpackets_stable_avx2;
+	else if (hwcaps & (1 << MOEPGF_HWCAPS_SIMD_SSE2))
+		numpackets_stable_impl = numpackets_stable_sse2;
+#endif
+}
+
+/*
+ * Results are memoized in a direct mapped table. Large estimates are quantized
+ * to steps of 2^-RALQE_MEMO_BITS of their sum before both the lookup and the
+ * computation: the sum is rounded to the nearest step, the losses q are rounded
+ * up and p is derived from both. The loss rate is thus never understated, and
+ * neither is the redundancy. Only called from the main thread, hence no
+ * locking.
+ */
+struct ralqe_memo {
+	int p, q;
+	float thresh;
+	double n;
+};
+
+static struct ralqe_memo memo[RALQE_MEMO_SIZE];
+
+static double
+numpackets_stable(int p, int q, double thresh)
+{
+	struct ralqe_memo *e;
+	int step, n;
+
+	if (!numpackets_stable_impl)
+		numpackets_stable_select();
+
+	step = max((p+q) >> RALQE_MEMO_BITS, 1);
+	n = (p + q + step/2) / step * step;
+	q = min((q + step - 1) / step * step, n);
+	p = n - q;
+
+	e = &memo[((unsigned int)p * 2654435761u ^ (unsigned int)q * 40503u)
+							% RALQE_MEMO_SIZE];
+	if (e->p == p && e->q == q && e->thresh == (float)thresh && e->n > 0)
+		return e->n;
+
+	e->p = p;
+	e->q = q;
+	e->thresh = thresh;
+	e->n = numpackets_stable_impl(p, q, thresh);
+
+	return e->n;
+}
+
 
-//static double
-//numpackets_stable(int p, int q, double thresh)
-//{
-//	double s[GENERATION_SIZE], sr[4], *sp;
-//	float _pqj1[8];
-//	float _pqj1j[8];
-//	float _jqjj[8];
-//	float _p1[8];
-//	int _j, k;
-//
-//	__m256d s1, s2, acc;
-//	__m256 p1, p2, i, j, pqj1, pqj1j, jqjj, tmp, i2;
-//	__m128 low;
-//
-//	__m256 ymm0, ymm1, ymm2, ymm3, ymm4, ymm5;
-//
-//	const __m256 c8 = _mm256_set1_ps(8);
-//
-//	for (sp=s; sp<&s[GENERATION_SIZE]; sp+=4)
-//		_mm256_store_pd(sp, _mm256_set1_pd(1.0));
-//
-//	sr[0] = 1.0;
-//	for (_j=1; (1.0-sr[0]) < thresh; _j++) {
-//		acc = _mm256_setzero_pd();
-//		i = _mm256_set_ps(7,6,5,4,3,2,1,0);
-//
-////		p1    = _mm256_set1_ps((float)(p+_j)/(float)(p+q+_j+1));
-////
-////		j     = _mm256_set1_ps(_j);
-////		pqj1  = _mm256_set1_ps(p+q+_j+1);
-////		jqjj  = _mm256_set1_ps(_j*(_j+q));
-////		pqj1j = _mm256_set1_ps((p+q+_j+1)*_j);
-//
-//		k = (_j-1) % 8;
-//		if (k == 0) {
-//			ymm0 = _mm256_set_ps(_j+7,_j+6,_j+5,_j+4,_j+3,_j+2,_j+1,_j);
-//			ymm1 = _mm256_add_ps(ymm0, _mm256_set1_ps(p));	// p+j
-//			ymm2 = _mm256_add_ps(ymm0, _mm256_set1_ps(p+q+1));	// p+q+1+j
-//			ymm3 = _mm256_mul_ps(ymm0, ymm2);	// j*(p+q+j+1)
-//			ymm4 = _mm256_set1_ps(q);		// j*(j+q)
-//			ymm4 = _mm256_add_ps(ymm4,ymm0);	// j*(j+q)
-//			ymm4 = _mm256_mul_ps(ymm4,ymm0);	// j*(j+q)
-//			ymm5 = _mm256_div_ps(ymm1,ymm2);
-//
-//			_mm256_store_ps(_pqj1, ymm2);
-//			_mm256_store_ps(_pqj1j, ymm3);
-//			_mm256_store_ps(_jqjj, ymm4);
-//			_mm256_store_ps(_p1, ymm5);
-//		}
-//
-//		p1    = _mm256_set1_ps(_p1[k]);
-//		j     = _mm256_set1_ps(_j);
-//		pqj1  = _mm256_set1_ps(_pqj1[k]);
-//		jqjj  = _mm256_set1_ps(_jqjj[k]);
-//		pqj1j = _mm256_set1_ps(_pqj1j[k]);
-//
-//		for (sp=s; sp<s+GENERATION_SIZE; sp+=8) {
-//			tmp = _mm256_fmsub_ps(i, pqj1, pqj1j);
-//			p2 = _mm256_fmsub_ps(i, j, jqjj);
-//			tmp = _mm256_rcp_ps(tmp);
-//
-//			s1 = _mm256_load_pd(sp);
-//			s2 = _mm256_load_pd(sp+4);
-//
-//			p2 = _mm256_mul_ps(p2, tmp);
-//
-//			tmp = _mm256_cmp_ps(j, i, _CMP_LE_OS);
-//
-//			i = _mm256_add_ps(i, c8);
-//
-//			tmp = _mm256_blendv_ps(p2, p1, tmp);
-//
-//			low = _mm256_extractf128_ps(tmp, 0);
-//			s1 = _mm256_mul_pd(s1, _mm256_cvtps_pd(low));
-//			_mm256_store_pd(sp, s1);
-//			acc = _mm256_add_pd(acc, s1);
-//
-//			low = _mm256_extractf128_ps(tmp, 1);
-//			s2 = _mm256_mul_pd(s2, _mm256_cvtps_pd(low));
-//			_mm256_store_pd(sp+4, s2);
-//			acc = _mm256_add_pd(acc, s2);
-//		}
-//
-//		acc = _mm256_hadd_pd(acc, acc);
-//		acc = _mm256_permute4x64_pd(acc, 0xe8);
-//		acc = _mm256_hadd_pd(acc, acc);
-//
-//		_mm256_store_pd(sr, acc);
-//	}
-//
-//	return (float)_j/GENERATION_SIZE;
-//}
-//
 //static double
 //binommean(int p, int q, double t)
 //{
@@ -210,6 +281,30 @@ ralqe_update(ralqe_link_t l, int *p, int *q)
 	*q = l->q;
 }
 
+void
+ralqe_get(ralqe_link_t l, double *p, double *q)
+{
+	int _p, _q;
+
+	_p = 0;
+	_q = 0;
+	ralqe_update(l, &_p, &_q);
+
+	*p = l->p;
+	*q = l->q;
+}
+
+void
+ralqe_set(ralqe_link_t l, double p, double q, double age)
+{
+	double t;
+
+	clock_gettime(CLOCK_MONOTONIC, &l->t);
+	t = exp(RALQE_TAU * -max(age, 0.0));
+	l->p = p * t;
+	l->q = q * t;
+}
+
 double
 ralqe_redundancy(ralqe_link_t l, double thresh)
 {
@@ -16,6 +16,16 @@ ralqe_init(ralqe_link_t l, int p, int q);
 void
 ralqe_update(ralqe_link_t l, int *p, int *q);
 
+/*
+ * Returns the estimate decayed to the current time, and replaces it with one
+ * that was taken age seconds ago, e.g. before a restart.
+ */
+void
+ralqe_get(ralqe_link_t l, double *p, double *q);
+
+void
+ralqe_set(ralqe_link_t l, double p, double q, double age);
+
 double
 ralqe_redundancy(ralqe_link_t l, double thresh);
 
@@ -8,6 +8,7 @@
 #include <moepcommon/list.h>
 #include <moepcommon/util.h>
 #include <moepcommon/timeout.h>
+#include <moepcommon/util/timespec.h>
 
 #include <jsm.h>
 
@@ -18,6 +19,9 @@
 #include "ncm.h"
 #include "neighbor.h"
 #include "linkstate.h"
+#include "lqe.h"
+#include "persist.h"
+#include "trace.h"
 
 /**
  * Callbacks for timeouts
@@ -35,6 +39,7 @@ struct session_rtt
 struct session_tasks tasks;
 
 static int (*tx_encoded)(struct moep_frame *) = rad_tx;
+static int (*tx_encoded_urgent)(struct moep_frame *) = rad_tx_urgent;
 static int (*tx_decoded)(struct moep_frame *) = tap_tx;
 
 /**
@@ -42,10 +47,52 @@ static int (*tx_decoded)(struct moep_frame *) = tap_tx;
  */
 static LIST_HEAD(sl);
 
+/**
+ * Sessions overheard on a node that is neither master nor slave. Such a
+ * session is kept as a passive record with the latest feedback of both
+ * endpoints only, until a relay decision promotes it to a full FORWARD session.
+ * @heard: endpoints a coded frame was overheard from (bit 0 master, bit 1 slave)
+ * @deficit: number of consecutive overheard frames whose feedback reports
+ * packets persistently missing at the destination of a flow
+ * @watch: flow of a generation whose deficit is timed, see feedback_deficit()
+ */
+struct passive_session
+{
+	struct list_head list;
+	u8 sid[2 * IEEE80211_ALEN];
+	u8 tc;
+	struct timespec seen;
+	int heard;
+	int deficit;
+	struct
+	{
+		int active;
+		u16 seq;
+		int dir;	// 0 master to slave, 1 slave to master
+		u8 sdim;
+		struct timespec since;
+	} watch;
+	u16 lseq;
+	int window_size;
+	struct generation_feedback fb[GENERATION_MAX_WINDOW];
+	struct
+	{
+		int data;
+		int ack;
+	} rx;
+};
+
+static LIST_HEAD(pl);
+static int forward_count;
+
 static inline int
 compare(struct session *s1, struct session *s2)
 {
-	return memcmp(s1->sid, s2->sid, sizeof(s1->sid));
+	int ret;
+
+	if ((ret = memcmp(s1->sid, s2->sid, sizeof(s1->sid))))
+		return ret;
+	return s1->tc - s2->tc;
 }
 
 u8 *
@@ -64,19 +111,6 @@ session_find_remote_address(struct session *s)
 		return s->hwaddr.master;
 }
 
-static char *get_log_fn(session_t s)
-{
-	static char filename[1000];
-
-	snprintf(filename, 1000, "%s%d_%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x.log",
-			 SESSION_LOG_FILE_PREFIX,
-			 getpid(),
-			 s->sid[0], s->sid[1], s->sid[2], s->sid[3],
-			 s->sid[4], s->sid[5], s->sid[6], s->sid[7],
-			 s->sid[8], s->sid[9], s->sid[10], s->sid[11]);
-	return filename;
-}
-
 static int
 session_type(const u8 *sid)
 {
@@ -92,14 +126,18 @@ session_type(const u8 *sid)
 static void
 session_destroy(struct session *s)
 {
+	TRACE(session_destroy, s, s->tc, s->state.count);
+
 	list_del(&s->list);
 
+	if (s->gentype == FORWARD)
+		forward_count--;
+
 	jsm80211_cleanup(s->jsm_module);
 
 	generation_list_destroy(&s->gl);
 	timeout_delete(s->task.destroy);
-
-	unlink(get_log_fn(s));
+	free(s->parked);
 
 	LOG(LOG_INFO, "session destroyed");
 
@@ -111,6 +149,7 @@ init_coding_header(const struct session *s, const generation_t g,
 				   struct ncm_hdr_coded *hdr)
 {
 	memcpy(hdr->sid, s->sid, sizeof(hdr->sid));
+	hdr->tc = s->tc;
 	hdr->lseq = generation_lseq(&s->gl);
 	hdr->seq = generation_seq(g);
 	hdr->gf = s->params.gftype;
@@ -122,8 +161,9 @@ serialize_for_encoding(void *buffer, size_t maxlen, struct moep_frame *f)
 {
 	size_t len;
 	u8 *payload;
-	struct moep_hdr_pctrl *pctrl;
+	struct ncm_hdr_pctrl *pctrl;
 	struct ether_header *ether;
+	struct timespec ts;
 
 	if (!(ether = moep_frame_ieee8023_hdr(f)))
 		DIE("ether_header not found");
@@ -134,10 +174,12 @@ serialize_for_encoding(void *buffer, size_t maxlen, struct moep_frame *f)
 		DIE("unable to serialize frame for encoding (frame too long)");
 
 	pctrl = buffer;
-	pctrl->hdr.type = MOEP_HDR_PCTRL;
-	pctrl->hdr.len = sizeof(*pctrl);
-	pctrl->type = htole16(be16toh(ether->ether_type));
-	pctrl->len = len;
+	pctrl->pctrl.hdr.type = MOEP_HDR_PCTRL;
+	pctrl->pctrl.hdr.len = sizeof(*pctrl);
+	pctrl->pctrl.type = htole16(be16toh(ether->ether_type));
+	pctrl->pctrl.len = len;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	pctrl->ts = htole64((u64)ts.tv_sec * 1000000000 + ts.tv_nsec);
 
 	memcpy(buffer + sizeof(*pctrl), payload, len);
 
@@ -169,13 +211,13 @@ int session_sid(u8 *sid, const u8 *hwaddr1, const u8 *hwaddr2)
 }
 
 session_t
-session_find(const u8 *sid)
+session_find(const u8 *sid, u8 tc)
 {
 	struct session *tmp, *cur;
 
 	list_for_each_entry_safe(cur, tmp, &sl, list)
 	{
-		if (0 == memcmp(sid, cur->sid, sizeof(cur->sid)))
+		if (0 == memcmp(sid, cur->sid, sizeof(cur->sid)) && cur->tc == tc)
 			return cur;
 	}
 
@@ -184,7 +226,7 @@ session_find(const u8 *sid)
 
 session_t
 session_register(const struct params_session *params,
-				 const struct params_jsm *jsm, const u8 *sid)
+				 const struct params_jsm *jsm, const u8 *sid, u8 tc)
 {
 	struct session *s;
 	int i;
@@ -194,9 +236,15 @@ session_register(const struct params_session *params,
 
 	s->params = *params;
 	memcpy(s->sid, sid, sizeof(s->sid));
+	s->tc = tc;
+	s->gensize = params->gensize;
+	s->layout = params->unidir ? LAYOUT_NONE : LAYOUT_BIDIR;
+	s->link = LQ_UNKNOWN;
 
 	s->gentype = session_type(s->sid);
 
+	persist_restore_session(s);
+
 	if (jsm)
 	{
 		if (0 > jsm80211_init(&s->jsm_module,
@@ -214,36 +262,234 @@ session_register(const struct params_session *params,
 	for (i = 0; i < s->params.winsize; i++)
 	{
 		(void)generation_init(s, &s->gl, s->gentype,
-							  params->gftype, params->gensize, 8192, i);
+							  params->gftype, params->gensize,
+							  params->pdusize, i);
 	}
 
 	list_add(&s->list, &sl);
 
+	if (s->gentype == FORWARD)
+		forward_count++;
+
+	TRACE(session_create, s, s->hwaddr.master, s->hwaddr.slave, s->tc,
+		  s->gentype);
+
 	LOG(LOG_INFO, "new sesion created");
 
 	return s;
 }
 
+static void
+passive_expire(const struct timespec *now)
+{
+	struct passive_session *tmp, *cur;
+	struct timespec age;
+
+	list_for_each_entry_safe(cur, tmp, &pl, list)
+	{
+		age = *now;
+		timespecsub(&age, &cur->seen);
+		if (age.tv_sec * 1000 + age.tv_nsec / 1000000 < SESSION_TIMEOUT)
+			continue;
+
+		list_del(&cur->list);
+		free(cur);
+	}
+}
+
+static struct passive_session *
+passive_find(const u8 *sid, u8 tc)
+{
+	struct passive_session *cur;
+
+	list_for_each_entry(cur, &pl, list)
+	{
+		if (0 == memcmp(sid, cur->sid, sizeof(cur->sid)) && cur->tc == tc)
+			return cur;
+	}
+
+	return NULL;
+}
+
+/*
+ * Packets missing at the destination of a flow are the normal state while they
+ * are in flight. A deficit only counts if the destination itself reports it for
+ * a locked flow, or if the destination has not caught up with the source
+ * dimension a flow had when its deficit was first seen SESSION_PASSIVE_TIMEOUT
+ * ago. @from is the endpoint the feedback was overheard from, as in @heard.
+ */
+static int
+feedback_deficit(struct passive_session *p, int from, const struct timespec *now)
+{
+	const struct generation_feedback *fb;
+	struct timespec age;
+	int i, dir, seq, sdim, ddim, lock;
+	int ret = 0;
+
+	if (p->watch.active &&
+		(p->watch.seq - p->lseq + GENERATION_MAX_SEQ + 1) %
+		(GENERATION_MAX_SEQ + 1) >= p->window_size)
+		p->watch.active = 0;
+
+	for (i = 0; i < p->window_size; i++)
+	{
+		fb = &p->fb[i];
+		seq = (p->lseq + i) % (GENERATION_MAX_SEQ + 1);
+
+		for (dir = 0; dir < 2; dir++)
+		{
+			sdim = dir ? fb->sdim.sm : fb->sdim.ms;
+			ddim = dir ? fb->ddim.sm : fb->ddim.ms;
+			lock = dir ? fb->lock.sm : fb->lock.ms;
+
+			if (p->watch.active && p->watch.seq == seq &&
+				p->watch.dir == dir && ddim >= p->watch.sdim)
+				p->watch.active = 0;
+
+			if (sdim <= ddim)
+				continue;
+
+			// The master's flow ends at the slave and vice versa
+			if (lock && from == (dir ? 0x1 : 0x2))
+			{
+				ret = 1;
+			}
+			else if (!p->watch.active)
+			{
+				p->watch.active = 1;
+				p->watch.seq = seq;
+				p->watch.dir = dir;
+				p->watch.sdim = sdim;
+				p->watch.since = *now;
+			}
+		}
+	}
+
+	if (p->watch.active)
+	{
+		age = *now;
+		timespecsub(&age, &p->watch.since);
+		if (age.tv_sec * 1000 + age.tv_nsec / 1000000 >=
+			SESSION_PASSIVE_TIMEOUT)
+			ret = 1;
+	}
+
+	return ret;
+}
+
+/*
+ * This node is worth relaying for if it is in range of both endpoints and the
+ * feedback keeps reporting packets that did not make it to the destination.
+ */
+static int
+passive_relay_decision(const struct passive_session *p, int max_forward)
+{
+	if (forward_count >= max_forward)
+		return 0;
+	if (p->heard != 0x3)
+		return 0;
+	return p->deficit >= SESSION_PASSIVE_DEFICIT;
+}
+
+session_t
+session_overhear(const struct params_session *params, const u8 *ta,
+				 const struct ncm_hdr_coded *coded, size_t len)
+{
+	static struct timespec last_expire;
+	struct passive_session *p;
+	struct timespec now;
+	session_t s;
+	int count, from;
+
+	if (session_type(coded->sid) != FORWARD)
+		return session_register(params, NULL, coded->sid, coded->tc);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec != last_expire.tv_sec)
+	{
+		passive_expire(&now);
+		last_expire = now;
+	}
+
+	if (!(p = passive_find(coded->sid, coded->tc)))
+	{
+		if (!(p = calloc(1, sizeof(*p))))
+			DIE("calloc() failed: %s", strerror(errno));
+		memcpy(p->sid, coded->sid, sizeof(p->sid));
+		p->tc = coded->tc;
+		list_add(&p->list, &pl);
+	}
+
+	p->seen = now;
+
+	from = 0;
+	if (0 == memcmp(ta, coded->sid, IEEE80211_ALEN))
+		from = 0x1;
+	else if (0 == memcmp(ta, coded->sid + IEEE80211_ALEN, IEEE80211_ALEN))
+		from = 0x2;
+	p->heard |= from;
+
+	if (len > 0)
+		p->rx.data++;
+	else
+		p->rx.ack++;
+
+	count = 0;
+	if (coded->hdr.len > sizeof(*coded))
+		count = (coded->hdr.len - sizeof(*coded)) / sizeof(*coded->fb);
+	count = min(count, GENERATION_MAX_WINDOW);
+	p->lseq = coded->lseq;
+	p->window_size = count;
+	memcpy(p->fb, coded->fb, count * sizeof(*coded->fb));
+
+	if (feedback_deficit(p, from, &now))
+		p->deficit++;
+	else
+		p->deficit = 0;
+
+	if (!passive_relay_decision(p, params->max_forward))
+		return NULL;
+
+	list_del(&p->list);
+	free(p);
+
+	s = session_register(params, NULL, coded->sid, coded->tc);
+	LOG(LOG_INFO, "overheard session promoted to forward session");
+
+	return s;
+}
+
 void session_cleanup()
 {
 	struct session *tmp, *cur;
 
+	struct passive_session *ptmp, *pcur;
+
 	list_for_each_entry_safe(cur, tmp, &sl, list)
 	{
 		session_destroy(cur);
 	}
+
+	list_for_each_entry_safe(pcur, ptmp, &pl, list)
+	{
+		list_del(&pcur->list);
+		free(pcur);
+	}
 }
 
 int tx_decoded_frame(struct session *s)
 {
 	moep_frame_t frame;
 	ssize_t len;
-	struct moep_hdr_pctrl *pctrl;
+	const struct moep_hdr_pctrl *pctrl;
+	const struct ncm_hdr_pctrl *ncm_pctrl;
 	struct ether_header *etherptr;
+	struct timespec ts;
 	u8 *hwaddr_remote;
-	u8 buffer[8192];
+	const void *data;
+	s64 delay;
 
-	len = generation_decoder_get(&s->gl, buffer, sizeof(buffer));
+	len = generation_decoder_get_view(&s->gl, &data);
 
 	if (len == EGENNOMORE)
 		return -1;
@@ -251,6 +497,15 @@ int tx_decoded_frame(struct session *s)
 	if (0 >= len)
 		DIE("gswin_decoder_get() failed: %d", (int)len);
 
+	// Both lengths come from the remote node and must fit the packet
+	pctrl = data;
+	if ((size_t)len < sizeof(*pctrl) || pctrl->hdr.len < sizeof(*pctrl) ||
+	    (size_t)pctrl->hdr.len + pctrl->len > (size_t)len)
+	{
+		LOG(LOG_WARNING, "malformed decoded packet, frame discarded");
+		return 0;
+	}
+
 	hwaddr_remote = session_find_remote_address(s);
 	if (!hwaddr_remote)
 		DIE("failed to dermine remote hwaddr");
@@ -261,18 +516,36 @@ int tx_decoded_frame(struct session *s)
 	memcpy(etherptr->ether_shost, hwaddr_remote, IEEE80211_ALEN);
 	memcpy(etherptr->ether_dhost, ncm_get_local_hwaddr(), IEEE80211_ALEN);
 
-	pctrl = (void *)buffer;
 	etherptr->ether_type = htobe16(le16toh(pctrl->type));
 
-	moep_frame_set_payload(frame, (void *)pctrl + sizeof(*pctrl), pctrl->len);
+	// Nodes without ingress timestamps send the bare pctrl header
+	if (pctrl->hdr.len >= sizeof(*ncm_pctrl))
+	{
+		ncm_pctrl = data;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		delay = (s64)((u64)ts.tv_sec * 1000000000 + ts.tv_nsec -
+			      le64toh(ncm_pctrl->ts));
+		hist_add(&s->hist.delivery, max(delay, (s64)0) / 1000);
+	}
 
 	if (s->jsm_module)
 	{
+		/* The frame outlives the view in the jsm queue, so it needs
+		 * its own copy of the payload. */
+		moep_frame_set_payload(frame, (void *)pctrl + pctrl->hdr.len,
+				       pctrl->len);
+		TRACE(jsm_enqueue, s, frame, pctrl->len);
 		if (0 != jsm80211_queue(s->jsm_module, frame))
 			DIE("jsm80211_queue() failed");
 	}
 	else
 	{
+		/* The view stays valid until the generation is reset, which
+		 * cannot happen before the TAP device has written or queued
+		 * its own copy of the frame. */
+		moep_frame_set_payload_view(frame, (void *)pctrl + pctrl->hdr.len,
+					    pctrl->len);
+		TRACE(tap_tx, s, pctrl->len);
 		tx_decoded(frame);
 		moep_frame_destroy(frame);
 	}
@@ -280,10 +553,22 @@ int tx_decoded_frame(struct session *s)
 	return 0;
 }
 
+/*
+ * Coded frames of prioritized sessions overtake the frames of other sessions
+ * that are queued at the radio.
+ */
+static int
+tx_coded(const struct session *s, moep_frame_t frame)
+{
+	if (s->params.priority)
+		return tx_encoded_urgent(frame);
+	return tx_encoded(frame);
+}
+
 int tx_encoded_frame(struct session *s, generation_t g)
 {
 	moep_frame_t frame;
-	u8 payload[8192];
+	void *payload;
 	struct ncm_hdr_coded *coded;
 	struct generation_feedback *fb;
 	struct moep80211_hdr *hdr;
@@ -304,17 +589,19 @@ int tx_encoded_frame(struct session *s, generation_t g)
 	if (0 > generation_feedback(g, fb, count * sizeof(*fb)))
 		DIE("generation_feedback() failed: %s", strerror(errno));
 
-	ret = generation_encoder_get(g, payload, sizeof(payload));
+	ret = generation_encoder_get_view(g, &payload);
 	if (0 > ret)
-		DIE("generation_encoder_get() failed: %d", (int)ret);
+		DIE("generation_encoder_get_view() failed: %d", (int)ret);
 
-	moep_frame_set_payload(frame, payload, ret);
+	moep_frame_set_payload_view(frame, payload, ret);
 
 	hdr = moep_frame_moep80211_hdr(frame);
 	memset(hdr->ra, 0xff, IEEE80211_ALEN);
 	memcpy(hdr->ta, ncm_get_local_hwaddr(), IEEE80211_ALEN);
 
-	tx_encoded(frame);
+	TRACE(rad_tx, s, generation_seq(g), generation_encoder_dimension(g), ret);
+
+	tx_coded(s, frame);
 
 	moep_frame_destroy(frame);
 
@@ -347,7 +634,9 @@ int tx_ack_frame(struct session *s, generation_t g)
 	memset(hdr->ra, 0xff, IEEE80211_ALEN);
 	memcpy(hdr->ta, ncm_get_local_hwaddr(), IEEE80211_ALEN);
 
-	tx_encoded(frame);
+	TRACE(rad_tx, s, generation_seq(g), generation_encoder_dimension(g), 0);
+
+	tx_coded(s, frame);
 
 	moep_frame_destroy(frame);
 
@@ -368,6 +657,15 @@ void session_commit_state(struct session *s, const struct generation_state *stat
 	if (s->gentype != FORWARD)
 		s->state.rx.excess_data += (state->rx.data - state->remote->sdim);
 
+	// Generations skipped without traffic would drown the distributions
+	if (state->tx.data + state->tx.redundant > 0)
+	{
+		hist_add(&s->hist.tx, state->tx.data + state->tx.redundant);
+		hist_add(&s->hist.rtx, state->rtx);
+	}
+	if (state->rx.data > 0)
+		hist_add(&s->hist.dependent, state->rx.excess);
+
 	return;
 }
 
@@ -390,6 +688,13 @@ void session_decoder_add(struct session *s, moep_frame_t frame)
 		else
 			s->state.rx.late_ack++;
 	}
+
+	// The feedback may have granted the pivots a parked frame waits for
+	if (s->parked && generation_encoder_add(&s->gl, s->parked, s->parked_len))
+	{
+		free(s->parked);
+		s->parked = NULL;
+	}
 }
 
 int session_encoder_add(struct session *s, moep_frame_t f)
@@ -401,8 +706,20 @@ int session_encoder_add(struct session *s, moep_frame_t f)
 	timeout_settime(s->task.destroy, 0, timeout_msec(SESSION_TIMEOUT, 0));
 
 	len = serialize_for_encoding(buffer, sizeof(buffer), f);
+	TRACE(tap_rx, s, len);
 	g = generation_encoder_add(&s->gl, buffer, len);
 
+	if (!g && !s->parked)
+	{
+		// Keep the frame until generation_encoder_add() finds space, e.g.
+		// once the pivots it requested are granted
+		if (!(s->parked = malloc(len)))
+			DIE("malloc() failed: %s", strerror(errno));
+		memcpy(s->parked, buffer, len);
+		s->parked_len = len;
+		return 0;
+	}
+
 	if (!g)
 	{
 		LOG(LOG_WARNING, "session full, frame discarded");
@@ -412,6 +729,54 @@ int session_encoder_add(struct session *s, moep_frame_t f)
 	return 0;
 }
 
+/*
+ * Returns the link class predicted for the neighbor of a session and its
+ * confidence. Predictions of the inference server take precedence, the native
+ * tree fills in if there is none. Its classes have no confidence and count as
+ * certain.
+ */
+static enum lq_class
+predicted_class(const session_t s, const u8 *hwaddr, double *c)
+{
+	enum lq_class class;
+
+	if (LQ_UNKNOWN != (class = lqe_prediction_get(hwaddr, c)))
+		return class;
+
+	*c = 1.0;
+	return session_link_class(s);
+}
+
+/*
+ * PREDICTION SCHEME
+ * Scales the RALQE redundancy by the latest link class predicted for the
+ * neighbor. The more confident a prediction, the closer links predicted good
+ * get to no redundancy, and the closer links predicted bad get to
+ * SESSION_LQE_BAD_FACTOR times the RALQE redundancy. Predictions below
+ * SESSION_LQE_MIN_CONFIDENCE and outdated ones are ignored.
+ */
+static double
+predicted_redundancy(const session_t s, const u8 *hwaddr, double ralqe)
+{
+	double c;
+
+	switch (predicted_class(s, hwaddr, &c))
+	{
+	case LQ_GOOD:
+		if (c < SESSION_LQE_MIN_CONFIDENCE)
+			break;
+		return ralqe - c * (ralqe - 1.0);
+	case LQ_BAD:
+		if (c < SESSION_LQE_MIN_CONFIDENCE)
+			break;
+		return ralqe * (1.0 + c * (SESSION_LQE_BAD_FACTOR - 1.0));
+	default:
+		break;
+	}
+
+	return ralqe;
+}
+
 double
 session_redundancy(session_t s)
 {
@@ -467,9 +832,27 @@ session_redundancy(session_t s)
 	else
 		ret = nb_ul_redundancy(hwaddr);
 
+	if (s->params.rscheme == 3)
+		ret = predicted_redundancy(s, hwaddr, ret);
+
 	return ret;
 }
 
+double
+session_rtx_pace(session_t s)
+{
+	double c;
+
+	if (s->params.rscheme != 3)
+		return 1.0;
+
+	if (LQ_BAD != predicted_class(s, session_find_remote_address(s), &c) ||
+		c < SESSION_LQE_MIN_CONFIDENCE)
+		return 1.0;
+
+	return 1.0 - c * (1.0 - SESSION_LQE_RTX_PACE);
+}
+
 int cb_destroy(timeout_t t, u32 overrun, void *data)
 {
 	(void)t;
@@ -481,72 +864,146 @@ int cb_destroy(timeout_t t, u32 overrun, void *data)
 
 int cb_dequeue(struct jsm80211_module *module, void *packet, void *data)
 {
+	size_t len;
+
 	(void)module;
 	(void)data;
+
+	(void)moep_frame_get_payload(packet, &len);
+	TRACE(jsm_dequeue, data, packet);
+	TRACE(tap_tx, data, len);
 	tx_decoded(packet);
 	moep_frame_destroy(packet);
 	return 0;
 }
 
-void session_log_state()
+int session_fill_state(session_state_filler_t filler, void *data)
 {
-	session_t s;
-	char *filename;
-	FILE *file;
-	int p, q;
-	double uplink, downlink;
+	struct session *s;
+	int i;
 
+	i = 0;
 	list_for_each_entry(s, &sl, list)
 	{
-		uplink = nb_ul_quality(session_find_remote_address(s), &p, &q),
-		downlink = nb_dl_quality(session_find_remote_address(s), NULL, NULL),
-		filename = get_log_fn(s);
-		file = fopen(filename, "w");
-		if (!file)
-			DIE("cannot open file: %s", filename);
-		fprintf(file,
-				"session: %s:%s\n"
-				"count\t%d\n"
-				"tx.data\t%.2f\n"
-				"tx.ack\t%.2f\n"
-				"rx.data\t%.2f\n"
-				"rx.ack\t%.2f\n"
-				"rx.excess_data\t%.2f\n"
-				"rx.late_data\t%.2f\n"
-				"rx.late_ack\t%.f\n"
-				"tx.redundant\t%.2f\n"
-				"redundancy\t%.2f\n"
-				"uplink\t%.2f\n"
-				"p = %d, q = %d\n"
-				"downlink\t%.2f\n"
-				"qdelay\t%.4f\n"
-				"\n",
-				ether_ntoa((const struct ether_addr *)s),
-				ether_ntoa((const struct ether_addr *)s + IEEE80211_ALEN),
-				s->state.count,
-				(double)s->state.tx.data / (double)s->state.count,
-				(double)s->state.tx.ack / (double)s->state.count,
-				(double)s->state.rx.data / (double)s->state.count,
-				(double)s->state.rx.ack / (double)s->state.count,
-				(double)s->state.rx.excess_data / (double)s->state.count,
-				(double)s->state.rx.late_data / (double)s->state.count,
-				(double)s->state.rx.late_ack / (double)s->state.count,
-				(double)s->state.tx.redundant / (double)s->state.count,
-				session_redundancy(s),
-				uplink,
-				p, q,
-				downlink,
-				qdelay_get());
-		fclose(file);
-
-		if (s->jsm_module)
-			jsm80211_log_state(s->jsm_module);
+		filler(data, i, s);
+		i++;
 	}
+
+	return i;
+}
+
+int session_out_of_order(const session_t s)
+{
+	return s->params.out_of_order;
+}
+
+int session_flush_timeout(const session_t s)
+{
+	return s->params.flush;
+}
+
+int session_adaptive(const session_t s)
+{
+	return s->params.adapt;
+}
+
+int session_unidirectional(const session_t s)
+{
+	return s->params.unidir;
+}
+
+enum GENERATION_LAYOUT session_layout(const session_t s)
+{
+	return s->layout;
+}
+
+void session_set_layout(session_t s, enum GENERATION_LAYOUT layout)
+{
+	if (s->layout != layout)
+		LOG(LOG_INFO, "session layout %d -> %d", s->layout, layout);
+	s->layout = layout;
+}
+
+int session_gensize(session_t s)
+{
+	int p, q, size;
+	double loss;
+
+	size = s->gensize;
+
+	// p counts received and q lost frames on the uplink
+	nb_ul_quality(session_find_remote_address(s), &p, &q);
+	if (p + q > 0)
+	{
+		loss = (double)q / (double)(p + q);
+		if (loss > SESSION_ADAPT_LOSS_HIGH)
+			size *= 2;
+		else if (loss < SESSION_ADAPT_LOSS_LOW)
+			size /= 2;
+	}
+
+	if (qdelay_get() > SESSION_ADAPT_QDELAY || s->latency > SESSION_ADAPT_LATENCY)
+		size = min(size, s->gensize / 2);
+
+	size = max(GENERATION_ADAPT_MIN_SIZE, min(size, s->params.gensize));
+	s->gensize = size & ~1;
+
+	return s->gensize;
+}
+
+void session_commit_latency(session_t s, double ms)
+{
+	if (s->latency == 0)
+		s->latency = ms;
+	else
+		s->latency += SESSION_ADAPT_ALPHA * (ms - s->latency);
+}
+
+void session_commit_rank_latency(session_t s, double ms)
+{
+	hist_add(&s->hist.rank, ms * 1000.0);
+}
+
+void session_commit_rtt(session_t s, double ms)
+{
+	if (s->srtt == 0)
+	{
+		s->srtt = ms;
+		s->rttvar = ms / 2;
+		return;
+	}
+
+	s->rttvar += SESSION_RTT_BETA * (fabs(s->srtt - ms) - s->rttvar);
+	s->srtt += SESSION_RTT_ALPHA * (ms - s->srtt);
+}
+
+double session_srtt(const session_t s)
+{
+	return s->srtt;
+}
+
+double session_rto(const session_t s)
+{
+	if (s->srtt == 0)
+		return GENERATION_RTX_MIN_TIMEOUT;
+
+	return max((double)SESSION_RTO_MIN,
+			   min(s->srtt + 4 * s->rttvar, (double)SESSION_RTO_MAX));
 }
 
 int session_remaining_space(const session_t s)
 {
-	return generation_remaining_space(&s->gl);
+	int space;
+
+	if (s->parked)
+		return 0;
+
+	// Without pivots, one frame is taken from the tap to request them
+	space = generation_remaining_space(&s->gl);
+	if (!space && generation_remote_owned(&s->gl))
+		return 1;
+
+	return space;
 }
 
 int session_min_remaining_space()
@@ -559,3 +1016,26 @@ int session_min_remaining_space()
 
 	return ret;
 }
+
+void session_commit_features(session_t s, const struct nb_features *f)
+{
+	enum lq_class prev = s->link;
+	float x[DTREE_FEATURES];
+
+	if (!dtree_loaded())
+		return;
+
+	x[DTREE_RSSI] = f->rssi;
+	x[DTREE_RSSI_AVG] = f->rssi_avg;
+
+	if (prev != (s->link = dtree_predict(x)))
+		LOG(LOG_DEBUG, "link to %s is %s",
+			ether_ntoa((const struct ether_addr *)
+				   session_find_remote_address(s)),
+			dtree_class_name(s->link));
+}
+
+enum lq_class session_link_class(const session_t s)
+{
+	return s->link;
+}
@@ -9,6 +9,8 @@
 
 #include <jsm.h>
 #include "params.h"
+#include "dtree.h"
+#include "hist.h"
 
 /**
  * Global statistics of this sesssion:
@@ -42,6 +44,25 @@ struct session_state
     int count;
 };
 
+/**
+ * Distributions of per packet and per generation quantities, for tail
+ * percentiles that the averages of session_state hide. Latencies are in us,
+ * delivery latency is only meaningful with synchronized clocks.
+ * @delivery: from TAP ingress at the sender to delivery to the local TAP
+ * @rank: from the first received packet to full rank of the remote flow
+ * @tx: coded transmissions per generation
+ * @dependent: linearly dependent receptions per generation
+ * @rtx: retransmission timer firings per generation
+ */
+struct session_hist
+{
+    struct hist delivery;
+    struct hist rank;
+    struct hist tx;
+    struct hist dependent;
+    struct hist rtx;
+};
+
 struct session_tasks
 {
     timeout_t destroy;
@@ -63,19 +84,51 @@ struct session
             u8 slave[IEEE80211_ALEN];
         } hwaddr;
     };
+    u8 tc;
     enum GENERATION_TYPE gentype;
+    enum GENERATION_LAYOUT layout; // layout of new generations
+
+    int gensize;    // size of the next generation, see session_gensize()
+    double latency; // smoothed generation latency in ms
+
+    double srtt;    // smoothed feedback RTT in ms, 0 without samples
+    double rttvar;  // RTT variation in ms
+
+    enum lq_class link; // predicted from the neighbor's features
+
+    u8 *parked;         // frame waiting for space, see session_encoder_add()
+    size_t parked_len;
 
     struct session_state state;
+    struct session_hist hist;
     struct session_tasks task;
 
     struct list_head gl;
 };
 typedef struct session *session_t;
 
+/**
+ * Sessions are identified by the pair of endpoints (sid) and the traffic class
+ * (tc), i.e. every class has its own coding pipeline between two nodes.
+ */
 session_t
-session_register(const struct params_session *params, const struct params_jsm *jsm, const u8 *sid);
+session_register(const struct params_session *params, const struct params_jsm *jsm, const u8 *sid, u8 tc);
 
-session_t session_find(const u8 *sid);
+session_t session_find(const u8 *sid, u8 tc);
+
+struct ncm_hdr_coded;
+struct nb_features;
+
+/**
+ * Looks up the session of an overheard coded frame that has no session yet.
+ * Sessions of which this node is an endpoint are registered right away. Other
+ * sessions are tracked passively and NULL is returned until a relay decision
+ * promotes them to a FORWARD session, of which there are at most
+ * params->max_forward at a time.
+ */
+session_t
+session_overhear(const struct params_session *params, const u8 *ta,
+                 const struct ncm_hdr_coded *coded, size_t len);
 
 int session_sid(u8 *sid, const u8 *hwaddr1, const u8 *hwaddr2);
 
@@ -89,18 +142,79 @@ int tx_ack_frame(struct session *s, generation_t g);
 
 void session_commit_state(struct session *s, const struct generation_state *state);
 
-void session_log_state();
+typedef void (*session_state_filler_t)(void *data, int i, const session_t s);
+int session_fill_state(session_state_filler_t filler, void *data);
 
 void session_cleanup();
 
 double session_redundancy(session_t s);
 
+/**
+ * Returns the factor applied to retransmission timeouts. Redundancy scheme 3
+ * shortens them on links predicted bad, so that redundant packets are sent
+ * before feedback would ask for them. It is 1 otherwise.
+ */
+double session_rtx_pace(session_t s);
+
+int session_out_of_order(const session_t s);
+
+int session_flush_timeout(const session_t s);
+
+int session_adaptive(const session_t s);
+
+/**
+ * Unidirectional sessions start with generations owned by the first endpoint
+ * that sends, and become bidirectional once the other endpoint sends as well.
+ * Only the layout kept by the master is authoritative.
+ */
+int session_unidirectional(const session_t s);
+
+enum GENERATION_LAYOUT session_layout(const session_t s);
+
+void session_set_layout(session_t s, enum GENERATION_LAYOUT layout);
+
+/**
+ * Returns the size of the next generation of an adaptive session. Lossy links
+ * get larger generations to amortize the coding overhead, while queueing delay
+ * and slow generations shrink them. The size never exceeds the configured
+ * generation size, which is what the coding blocks were allocated for.
+ */
+int session_gensize(session_t s);
+
+void session_commit_latency(session_t s, double ms);
+
+void session_commit_rank_latency(session_t s, double ms);
+
+/**
+ * Feeds an RTT sample, i.e. the time between sending a data frame and
+ * receiving feedback that covers it, into the SRTT/RTTVAR estimator of the
+ * session (RFC 6298).
+ */
+void session_commit_rtt(session_t s, double ms);
+
+double session_srtt(const session_t s);
+
+/**
+ * Returns the retransmission timeout in ms, SRTT + 4*RTTVAR bounded by
+ * SESSION_RTO_MIN and SESSION_RTO_MAX, or GENERATION_RTX_MIN_TIMEOUT as long
+ * as there are no RTT samples.
+ */
+double session_rto(const session_t s);
+
 int session_remaining_space(const session_t s);
 
 int session_min_remaining_space();
 
 double session_ul_quality(session_t s);
 
+/**
+ * Predicts the link class from the features of the remote endpoint after it
+ * sent a frame, see nb_features(). Does nothing without a model.
+ */
+void session_commit_features(session_t s, const struct nb_features *f);
+
+enum lq_class session_link_class(const session_t s);
+
 u8 *session_find_remote_address(struct session *s);
 
 #endif
@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <moep/system.h>
+#include <moep/types.h>
+#include <moep/ieee80211_addr.h>
+
+#include <moepcommon/list.h>
+#include <moepcommon/util.h>
+#include <moepcommon/timeout.h>
+
+#include <jsm.h>
+
+#include "generation.h"
+#include "session.h"
+#include "neighbor.h"
+#include "qdelay.h"
+#include "stats.h"
+
+static struct stats_shm *shm;
+static char shm_name[32];
+
+static void
+session_filler(void *data, int i, const session_t s)
+{
+	struct stats_session *st;
+	struct jsm80211_state jsm;
+	u8 *remote;
+
+	(void)data;
+
+	if (i >= STATS_MAX_SESSIONS)
+		return;
+	st = &shm->session[i];
+
+	memcpy(st->master, s->hwaddr.master, IEEE80211_ALEN);
+	memcpy(st->slave, s->hwaddr.slave, IEEE80211_ALEN);
+	st->tc = s->tc;
+	st->link = s->link;
+	st->gentype = s->gentype;
+	st->layout = s->layout;
+
+	st->count = s->state.count;
+	st->tx_data = s->state.tx.data;
+	st->tx_ack = s->state.tx.ack;
+	st->tx_redundant = s->state.tx.redundant;
+	st->rx_data = s->state.rx.data;
+	st->rx_ack = s->state.rx.ack;
+	st->rx_excess_data = s->state.rx.excess_data;
+	st->rx_late_data = s->state.rx.late_data;
+	st->rx_late_ack = s->state.rx.late_ack;
+
+	st->gensize = s->gensize;
+	st->latency = s->latency;
+	st->redundancy = session_redundancy(s);
+	st->srtt = s->srtt;
+	st->rttvar = s->rttvar;
+	st->rto = session_rto(s);
+
+	st->uplink = st->downlink = 0;
+	st->p = st->q = 0;
+	if ((remote = session_find_remote_address(s)))
+	{
+		st->uplink = nb_ul_quality(remote, &st->p, &st->q);
+		st->downlink = nb_dl_quality(remote, NULL, NULL);
+	}
+
+	st->hist[STATS_HIST_DELIVERY] = s->hist.delivery;
+	st->hist[STATS_HIST_RANK] = s->hist.rank;
+	st->hist[STATS_HIST_TX] = s->hist.tx;
+	st->hist[STATS_HIST_DEPENDENT] = s->hist.dependent;
+	st->hist[STATS_HIST_RTX] = s->hist.rtx;
+
+	st->jsm = !!s->jsm_module;
+	if (s->jsm_module)
+	{
+		jsm80211_get_state(s->jsm_module, &jsm);
+		st->jsm_backlog = jsm.backlog;
+		st->jsm_ipt_avg = jsm.ipt_avg;
+		st->jsm_ipt_timer = jsm.ipt_timer;
+		st->jsm_backlog_target = jsm.backlog_target;
+	}
+}
+
+static void
+nb_filler(void *data, int i, const u8 *hwaddr, double ulp, double ulq,
+		  double dlp, double dlq)
+{
+	struct stats_neighbor *st;
+
+	(void)data;
+
+	if (i >= STATS_MAX_NEIGHBORS)
+		return;
+	st = &shm->neighbor[i];
+
+	memcpy(st->hwaddr, hwaddr, IEEE80211_ALEN);
+	st->ulp = ulp;
+	st->ulq = ulq;
+	st->dlp = dlp;
+	st->dlq = dlq;
+	st->redundancy = nb_ul_redundancy(hwaddr);
+}
+
+int stats_open()
+{
+	int fd;
+
+	snprintf(shm_name, sizeof(shm_name), "%s%d", STATS_SHM_PREFIX, getpid());
+
+	if (0 > (fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644)))
+		return -1;
+
+	if (0 > ftruncate(fd, sizeof(*shm)))
+		goto fail;
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED)
+	{
+		shm = NULL;
+		goto fail;
+	}
+	close(fd);
+
+	shm->version = STATS_VERSION;
+	shm->size = sizeof(*shm);
+	shm->pid = getpid();
+	__atomic_store_n(&shm->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(shm_name);
+	return -1;
+}
+
+void stats_close()
+{
+	if (!shm)
+		return;
+
+	munmap(shm, sizeof(*shm));
+	shm_unlink(shm_name);
+	shm = NULL;
+}
+
+void stats_update()
+{
+	int n;
+
+	if (!shm)
+		return;
+
+	// Odd while updating, the fence keeps the stores below after it
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	shm->global.updates++;
+	shm->global.qdelay = qdelay_get();
+	shm->global.qdelay_loss = qdelay_loss();
+	shm->global.qdelay_packets = qdelay_packet_cnt();
+
+	n = session_fill_state(session_filler, NULL);
+	shm->sessions = min(n, STATS_MAX_SESSIONS);
+	n = nb_fill_state(nb_filler, NULL);
+	shm->neighbors = min(n, STATS_MAX_NEIGHBORS);
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,112 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <moep/types.h>
+
+#include "hist.h"
+
+/*
+ * Layout of the statistics segment shared with ncmstat. Bump STATS_VERSION on
+ * every change, readers refuse segments of another version.
+ */
+#define STATS_MAGIC		0x6e636d74	// "ncmt"
+#define STATS_VERSION		2
+#define STATS_SHM_PREFIX	"/ncm_stats_"	// followed by the pid
+#define STATS_MAX_SESSIONS	64
+#define STATS_MAX_NEIGHBORS	64
+
+struct stats_global
+{
+	u64 updates;
+	double qdelay;		// ms
+	double qdelay_loss;	// share of frames not echoed by the driver
+	u32 qdelay_packets;
+};
+
+// Histograms of struct session_hist, latencies in us
+enum stats_hist
+{
+	STATS_HIST_DELIVERY,
+	STATS_HIST_RANK,
+	STATS_HIST_TX,
+	STATS_HIST_DEPENDENT,
+	STATS_HIST_RTX,
+	STATS_HISTS,
+};
+
+/*
+ * Counters are sums over the count generations committed so far, readers
+ * divide them by count to get per generation averages.
+ */
+struct stats_session
+{
+	u8 master[6];
+	u8 slave[6];
+	u8 tc;
+	s8 link;		// enum lq_class
+	u8 gentype;
+	u8 layout;
+	u32 count;
+	u32 tx_data;
+	u32 tx_ack;
+	u32 tx_redundant;
+	u32 rx_data;
+	u32 rx_ack;
+	u32 rx_excess_data;
+	u32 rx_late_data;
+	u32 rx_late_ack;
+	s32 gensize;		// size of the next generation
+	s32 p;			// uplink frames received
+	s32 q;			// uplink frames lost
+	double latency;		// ms
+	double redundancy;
+	double uplink;
+	double downlink;
+	double srtt;		// ms
+	double rttvar;		// ms
+	double rto;		// ms
+	u32 jsm;		// jitter suppression enabled
+	u32 jsm_backlog;	// packets
+	double jsm_ipt_avg;	// s
+	double jsm_ipt_timer;	// s
+	double jsm_backlog_target; // s
+	struct hist hist[STATS_HISTS];
+};
+
+struct stats_neighbor
+{
+	u8 hwaddr[6];
+	double ulp;
+	double ulq;
+	double dlp;
+	double dlq;
+	double redundancy;
+};
+
+/*
+ * The NCM increments seq before and after every update, so it is odd while an
+ * update is in progress. Readers copy the segment and retry until seq was even
+ * and unchanged across the copy.
+ */
+struct stats_shm
+{
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 pid;
+	u32 seq;
+	u32 sessions;
+	u32 neighbors;
+	struct stats_global global;
+	struct stats_session session[STATS_MAX_SESSIONS];
+	struct stats_neighbor neighbor[STATS_MAX_NEIGHBORS];
+};
+
+// Creates the segment STATS_SHM_PREFIX<pid>
+int stats_open();
+// Removes the segment
+void stats_close();
+// Refreshes the segment with the current state of sessions and neighbors
+void stats_update();
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * Static tracepoints (USDT) on the datapath. With --enable-usdt, every TRACE()
+ * is a single nop in the binary and an ELF note that bpftrace, perf and
+ * systemtap attach to, e.g. "usdt:./ncm:ncm:rad_rx". Otherwise TRACE() expands
+ * to nothing and its arguments are not evaluated. Arguments must be integers or
+ * pointers, at most twelve per probe.
+ *
+ * Probes of provider ncm, sid is the address of the struct session, which is
+ * stable for the lifetime of the session and announced by session_create:
+ *
+ * rad_rx(type, ta, len)		frame received from the radio
+ * rad_tx(sid, seq, rank, len)		coded frame sent, len is 0 for acks
+ * tap_rx(sid, len)			frame taken from the TAP for a session
+ * tap_tx(sid, len)			decoded frame written to the TAP
+ * session_create(sid, master, slave, tc, gentype)
+ * session_destroy(sid, tc, generations)
+ * encode(sid, seq, rank, len)		source packet added to a generation
+ * innovative(sid, seq, rank, len)	coded packet raised the decoder rank
+ * dependent(sid, seq, rank, len)	coded packet was linearly dependent
+ * generation_lock(sid, seq, rank)	no more source packets are accepted
+ * generation_reset(sid, seq, newseq)	generation recycled for newseq
+ * generation_advance(sid, lseq, n)	window moved by n generations
+ * rtx_fire(sid, seq, rank, count)	retransmission timer fired
+ * ack_fire(sid, seq, rank)		ack timer fired
+ * jsm_enqueue(sid, frame, len)		frame queued for jitter suppression
+ * jsm_dequeue(sid, frame)		frame released by jitter suppression
+ *
+ * Ranks are those of the encoder for rad_tx, encode and generation_lock, of the
+ * decoder otherwise. Ready-made bpftrace scripts are in tools/.
+ */
+#ifdef NCM_USDT
+#include <sys/sdt.h>
+#define TRACE(probe, ...)	STAP_PROBEV(ncm, probe, __VA_ARGS__)
+#else
+#define TRACE(probe, ...)	do {} while (0)
+#endif
+
+#endif